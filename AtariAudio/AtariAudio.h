@@ -6,7 +6,10 @@
 --------------------------------------------------------------------*/
 #pragma once
 
-#include "Ym2149c.h"
+// bump it each time an emulation change could alter rendered audio (batch renders of older versions are redone)
+#define	ATARI_AUDIO_EMULATION_VERSION	1
+
+#include "ym2149c.h"
 #include "AtariMachine.h"
 #include "SndhFile.h"
 
@@ -7,8 +7,21 @@
 #include <stdlib.h>		// malloc & free
 #include <string.h>		// memset & memcpy
 #include <assert.h>
+#include <mutex>
 #include "external/Musashi/m68k.h"
 #include "AtariMachine.h"
+#include "SndhImage.h"
+
+// Atari RAM is reserved as virtual memory when the platform has it: untouched pages are
+// zero-filled by the OS and use no physical memory, and Startup gives pages back instead of clearing them.
+// On Windows the whole RAM is still committed (4 MiB of commit charge per machine): committing on demand
+// would need a fault handler, as RAM is also read and written directly (DAC, Upload)
+#if defined(_WIN32)
+#define	WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
 
 #define D_DUMP_READ		0
 #define D_DUMP_WRITE	0
@@ -20,9 +33,68 @@ static const uint32_t D_DUMP_WRITE_AD2 = 0xfffaff;
 #include <stdio.h>
 #endif
 
-static AtariMachine*	gCurrentMachine = NULL;
+// Musashi CPU state is thread local: any thread could run its own machines
+static thread_local AtariMachine*	gCurrentMachine = NULL;
+static thread_local bool	gCpuReady = false;
+static std::once_flag	gOpcodeTableOnce;
 static const uint32_t ivector[5] = { 0x134,0x120,0x114,0x110,0x13c };
 
+static uint8_t*	ramAlloc(uint32_t size)
+{
+#if defined(_WIN32)
+	return (uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__unix__) || defined(__APPLE__)
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (MAP_FAILED == p) ? NULL : (uint8_t*)p;
+#else
+	return (uint8_t*)malloc(size);
+#endif
+}
+
+static void	ramFree(uint8_t* ram, uint32_t size)
+{
+#if defined(_WIN32)
+	VirtualFree(ram, 0, MEM_RELEASE);
+#elif defined(__unix__) || defined(__APPLE__)
+	munmap(ram, size);
+#else
+	free(ram);
+#endif
+}
+
+// back to all zero RAM, dropping any touched page
+static void	ramClear(uint8_t* ram, uint32_t size, bool fileMapped)
+{
+#if defined(__unix__) || defined(__APPLE__)
+	if (fileMapped)
+	{
+		// madvise would reload a file mapping with its file content, not zero. If the anonymous mapping
+		// fails, the image pages are cleared by hand, so the next music never sees them
+		if (MAP_FAILED == mmap(ram, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0))
+			memset(ram, 0, size);
+		return;
+	}
+#endif
+#if defined(_WIN32)
+	VirtualFree(ram, size, MEM_DECOMMIT);
+	VirtualAlloc(ram, size, MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+	if (0 != madvise(ram, size, MADV_DONTNEED))		// private anonymous pages read back as zero
+		memset(ram, 0, size);
+#elif defined(__unix__) || defined(__APPLE__)
+	if (MAP_FAILED == mmap(ram, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0))
+		memset(ram, 0, size);
+#else
+	memset(ram, 0, size);
+#endif
+}
+
+// writing to a cached opcode drops the translated blocks of its code page
+static inline bool	isCachedOpcode(const uint8_t* codeMap, uint32_t address)
+{
+	return (codeMap[address >> 4] >> ((address >> 1) & 7)) & 1;
+}
+
 unsigned int  m68k_read_memory_8(unsigned int address)
 {
 	return gCurrentMachine->memRead8(address);
@@ -45,9 +117,34 @@ void m68k_write_memory_16(unsigned int address, unsigned int value)
 
 unsigned int  m68k_read_memory_32(unsigned int address)
 {
-	uint32_t r = m68k_read_memory_16(address) << 16;
-	r |= m68k_read_memory_16(address + 2);
-	return r;
+	return gCurrentMachine->memRead32(address);
+}
+
+// M68K_SEPARATE_READS: immediate and PC relative data use the same reads as data (RAM first, then IO).
+// Opcodes of cached blocks are not read again, see m68k_block_cache
+unsigned int  m68k_read_immediate_16(unsigned int address)
+{
+	return gCurrentMachine->memRead16(address);
+}
+
+unsigned int  m68k_read_immediate_32(unsigned int address)
+{
+	return gCurrentMachine->memRead32(address);
+}
+
+unsigned int  m68k_read_pcrelative_8(unsigned int address)
+{
+	return gCurrentMachine->memRead8(address);
+}
+
+unsigned int  m68k_read_pcrelative_16(unsigned int address)
+{
+	return gCurrentMachine->memRead16(address);
+}
+
+unsigned int  m68k_read_pcrelative_32(unsigned int address)
+{
+	return gCurrentMachine->memRead32(address);
 }
 
 void m68k_write_memory_32(unsigned int address, unsigned int value)
@@ -105,12 +202,26 @@ unsigned int  AtariMachine::memRead16(unsigned int address)
 	return r;
 }
 
+// one RAM access for a long word instead of two word reads. IO area goes through the regular word read
+unsigned int  AtariMachine::memRead32(unsigned int address)
+{
+	assert(0 == (address & 0xff000000));
+	if (address < RAM_SIZE - 3)
+	{
+		const uint8_t* r = m_RAM + address;
+		return (uint32_t(r[0]) << 24) | (r[1] << 16) | (r[2] << 8) | r[3];
+	}
+	return (memRead16(address) << 16) | memRead16(address + 2);
+}
+
 void AtariMachine::memWrite8(unsigned int address, unsigned int value)
 {
 	assert(0 == (address & 0xff000000));
 	if (address < RAM_SIZE)
 	{
 		m_RAM[address] = value;
+		if (isCachedOpcode(m_codeMap, address))
+			m68k_block_cache_invalidate(m_blockCache, address);
 		return;
 	}
 #if D_DUMP_WRITE
@@ -135,6 +246,10 @@ void AtariMachine::memWrite16(unsigned int address, unsigned int value)
 	{
 		m_RAM[address] = uint8_t(value >> 8);
 		m_RAM[address + 1] = uint8_t(value);
+		if (isCachedOpcode(m_codeMap, address))
+			m68k_block_cache_invalidate(m_blockCache, address);
+		if ((address & 1) && (isCachedOpcode(m_codeMap, address + 1)))		// odd address writes two words
+			m68k_block_cache_invalidate(m_blockCache, address + 1);
 		return;
 	}
 #if D_DUMP_WRITE
@@ -154,16 +269,26 @@ void AtariMachine::memWrite16(unsigned int address, unsigned int value)
 
 AtariMachine::AtariMachine()
 {
-	m_RAM = (uint8_t*)malloc(RAM_SIZE);
+	m_RAM = ramAlloc(RAM_SIZE);
+	m_cpuContext = calloc(1, m68k_context_size());
+	m_blockCache = m_RAM ? m68k_block_cache_create(m_RAM, RAM_SIZE) : NULL;
+	m_codeMap = m_blockCache ? m68k_block_cache_code_map(m_blockCache) : NULL;
+	m_mappedImageAddr = 0;
+	m_mappedImageSize = 0;
+	SetViewInfoDecimation(1);
 }
 
 AtariMachine::~AtariMachine()
 {
 	if (m_RAM)
 	{
-		free(m_RAM);
+		ramFree(m_RAM, RAM_SIZE);
 		m_RAM = NULL;
 	}
+	free(m_cpuContext);
+	m_cpuContext = NULL;
+	m68k_block_cache_destroy(m_blockCache);
+	m_blockCache = NULL;
 }
 
 static int	fIllegalCb(int opcode)
@@ -311,22 +436,64 @@ void	AtariMachine::TrapInstructionCallback(int v)
 	}
 }
 
-void	AtariMachine::Startup(uint32_t hostReplayRate)
+// setup this thread CPU core (once per thread, as every machine uses the same settings)
+void	AtariMachine::CpuThreadSetup()
+{
+	if (!gCpuReady)
+	{
+		// first m68k_init builds the opcode table shared by all threads
+		std::call_once(gOpcodeTableOnce, [] { m68k_init(); });
+		m68k_set_cpu_type(M68K_CPU_TYPE_68000);
+		m68k_init();
+		m68k_set_illg_instr_callback(fIllegalCb);
+		m68k_set_reset_instr_callback(fResetCb);
+//		m68k_set_instr_hook_callback(fDebugCb);
+		gCpuReady = true;
+	}
+}
+
+// this thread CPU core runs this machine: restore the registers it had at the end of its previous run
+void	AtariMachine::CpuEnter()
+{
+	CpuThreadSetup();
+	m68k_set_context(m_cpuContext);
+	m68k_set_block_cache(m_blockCache);
+	gCurrentMachine = this;
+}
+
+void	AtariMachine::CpuLeave()
+{
+	m68k_get_context(m_cpuContext);
+	m68k_set_block_cache(NULL);
+	gCurrentMachine = NULL;
+}
+
+void	AtariMachine::Startup(uint32_t hostReplayRate, Ym2149c::OutputMode ymOutputMode, Ym2149c::StereoPanning ymPanning)
 {
 	gCurrentMachine = this;
 	assert(m_RAM);
-	memset(m_RAM, 0, RAM_SIZE);
+	assert(m_blockCache);
+	if (m_mappedImageSize)
+	{
+		ramClear(m_RAM + m_mappedImageAddr, m_mappedImageSize, true);
+		m_mappedImageSize = 0;
+	}
+	ramClear(m_RAM, RAM_SIZE, false);
+	m68k_block_cache_flush(m_blockCache);
 
-	m_Ym2149.Reset(hostReplayRate);
+	m_Ym2149.Reset(hostReplayRate, 2000000, ymOutputMode, ymPanning);
 	m_Mfp.Reset(hostReplayRate);
 	m_SteDac.Reset(hostReplayRate);
+	SetViewInfoDecimation(1);
 	m_NextGemdosMallocAd = GEMDOS_MALLOC_EMUL_BUFFER;
 
-	m68k_set_cpu_type(M68K_CPU_TYPE_68000);
-	m68k_init();
-	m68k_set_illg_instr_callback(fIllegalCb);
-	m68k_set_reset_instr_callback(fResetCb);
-//	m68k_set_instr_hook_callback(fDebugCb);
+	CpuThreadSetup();
+
+	// 68000 reset doesn't clear data & address registers: start from zero, so a driver never sees
+	// the registers of a previous music (or of another machine running on this thread)
+	for (int r = M68K_REG_D0; r <= M68K_REG_A6; r++)
+		m68k_set_reg(m68k_register_t(r), 0);
+	m68k_set_reg(M68K_REG_USP, 0);
 
 	// setup some cookie jar for MaxyMizer player!
 	m68k_write_memory_32(0x900, '_SND');
@@ -343,7 +510,7 @@ void	AtariMachine::Startup(uint32_t hostReplayRate)
 	// so by default, set the timer C handler to RTE, just in case
 	m68k_write_memory_32(0x114, RTE_INSTRUCTION_ADDR);
 
-	gCurrentMachine = NULL;
+	CpuLeave();
 }
 
 bool	AtariMachine::Upload(const void* src, uint32_t addr, uint32_t size)
@@ -355,9 +522,36 @@ bool	AtariMachine::Upload(const void* src, uint32_t addr, uint32_t size)
 		return false;
 
 	memcpy(m_RAM + addr, src, size);
+	m68k_block_cache_flush(m_blockCache);
 	return true;
 }
 
+bool	AtariMachine::Upload(const SndhImage& image, uint32_t addr)
+{
+	if (addr + image.GetSize() > RAM_SIZE)
+		return false;
+
+#if defined(__linux__)
+	// map the shared image pages into RAM, private copy of a page only happens if the driver writes to it
+	if ((image.GetMapHandle() >= 0) && (0 == m_mappedImageSize) && ((addr & (SndhImage::kMapAlign - 1)) == image.GetMapOffset()))
+	{
+		const uint32_t mapAddr = addr - image.GetMapOffset();
+		if (mapAddr + image.GetMapSize() <= RAM_SIZE)
+		{
+			void* p = mmap(m_RAM + mapAddr, image.GetMapSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image.GetMapHandle(), 0);
+			if (p != MAP_FAILED)
+			{
+				m_mappedImageAddr = mapAddr;
+				m_mappedImageSize = image.GetMapSize();
+				m68k_block_cache_flush(m_blockCache);
+				return true;
+			}
+		}
+	}
+#endif
+	return Upload(image.GetData(), addr, image.GetSize());
+}
+
 void	AtariMachine::ConfigureReturnByRts()
 {
 	m68k_write_memory_32(RAM_SIZE - 4, RESET_INSTRUCTION_ADDR);		// next RTS will go to RESET_INSTRUCTION_ADDR (reset)
@@ -371,7 +565,7 @@ void	AtariMachine::ConfigureReturnByRte()
 	m68k_write_memory_32(0, RAM_SIZE - 6);				// stack ptr at next reset on TOP of RAM
 }
 
-bool	AtariMachine::JmpBinary(int pc, int timeOut50Hz)
+bool	AtariMachine::JmpBinary(int pc, int timeOut50Hz, const std::atomic<bool>* cancel)
 {
 	m68k_write_memory_32(0x14, RTE_INSTRUCTION_ADDR);		// DIV by ZERO excep jump at $500
 
@@ -383,41 +577,134 @@ bool	AtariMachine::JmpBinary(int pc, int timeOut50Hz)
 	for (int t = 0; t < timeOut50Hz; t++)
 	{
 		cycles += m68k_execute(512 * 313);				// 50hz frame
-		if (m_ExitCode)
+		if ((m_ExitCode) || ((cancel) && (cancel->load(std::memory_order_relaxed))))
 			break;
 	}
 	return (kReset == m_ExitCode);
 }
 
-bool	AtariMachine::Jsr(uint32_t addr, uint32_t d0)
+bool	AtariMachine::Jsr(uint32_t addr, uint32_t d0, const std::atomic<bool>* cancel)
 {
-	gCurrentMachine = this;
+	CpuEnter();
 
 	bool ret = false;
 	// upload data in RAM
 	ConfigureReturnByRts();
 	m68k_set_reg(M68K_REG_D0, d0);
-	ret = JmpBinary(addr, 50*10);		// timeout of 1sec for init
-	gCurrentMachine = NULL;
+	ret = JmpBinary(addr, 50*10, cancel);		// timeout of 1sec for init
+	CpuLeave();
 	return ret;
 }
 
 int16_t	AtariMachine::ComputeNextSample(uint32_t* pSampleDebugInfo)
 {
-	gCurrentMachine = this;
-	int32_t level = m_Ym2149.ComputeNextSample(pSampleDebugInfo);
-	int32_t steLevel = m_SteDac.ComputeNextSample((const int8_t*)m_RAM, RAM_SIZE, m_Mfp);
-	if (steLevel && (pSampleDebugInfo))
-		*pSampleDebugInfo |= (steLevel >> 8) << 24;
-	level += steLevel;
+	assert(1 == GetChannelCount());
+	int16_t out;
+	Render(&out, 1, pSampleDebugInfo);
+	return out;
+}
 
-	if (level > 32767)
-		level = 32767;
-	else if (level < -32768)
-		level = -32768;
+// add YM and DAC and saturate (plain loop on interleaved samples, easy to vectorize for the compiler)
+static void	mixSpan(int16_t* out, const int16_t* ym, const int16_t* dac, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		int32_t level = int32_t(ym[i]) + int32_t(dac[i]);
+		if (level > 32767)
+			level = 32767;
+		else if (level < -32768)
+			level = -32768;
+		out[i] = (int16_t)level;
+	}
+}
 
-	int16_t out = (int16_t)level;
+// Samples are rendered by spans: no timer irq (so no 68k code) could happen before the last sample of a span.
+// So YM & DAC are computed without interruption, and timers are advanced in one go
+int	AtariMachine::Render(int16_t* buffer, int count, uint32_t* pSampleDebugInfo, int16_t* const* stems)
+{
+	CpuEnter();
+	const uint32_t* debugInfoStart = pSampleDebugInfo;
+	const int channels = GetChannelCount();
+	int16_t* stemPos[kStemCount];
+	for (int s = 0; s < kStemCount; s++)
+		stemPos[s] = stems ? stems[s] : NULL;
+	while (count > 0)
+	{
+		int n = m_Mfp.SamplesBeforeIrq((count < kSpanMax) ? count : kSpanMax);
+
+		// DAC span stops at the end of a DMA buffer, because of the MFP external event
+		const bool dacOn = m_SteDac.IsOn();
+		n = m_SteDac.RenderSpan(m_dacSpan, n, channels, (const int8_t*)m_RAM, RAM_SIZE, m_Mfp);
+
+		// YM only span (most of SNDH files) doesn't need any mix: YM kernel writes in the output buffer
+		int16_t* ymOut = dacOn ? m_ymSpan : buffer;
+		int16_t* voices = m_Ym2149.IsVoiceOutputEnabled() ? m_voiceSpan : NULL;
+#if ATARI_AUDIO_VIEW_INFO
+		if (pSampleDebugInfo)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				// only one sample out of m_viewStep is worth visualization data
+				uint32_t* info = NULL;
+				if (0 == m_viewPhase)
+					info = pSampleDebugInfo++;
+				if (++m_viewPhase == m_viewStep)
+					m_viewPhase = 0;
+
+				int16_t* voice = voices ? voices + i * 3 : NULL;
+				if (1 == channels)
+					ymOut[i] = m_Ym2149.ComputeNextSample(info, voice);
+				else
+					m_Ym2149.ComputeNextStereoSample(ymOut + i * 2, info, voice);
+				if (info)
+				{
+					const int32_t steLevel = (1 == channels) ? m_dacSpan[i] : ((m_dacSpan[i * 2] + m_dacSpan[i * 2 + 1]) >> 1);
+					if (steLevel)
+						*info |= (steLevel >> 8) << 24;
+				}
+			}
+		}
+		else
+#endif
+		{
+			m_Ym2149.RenderSpan(ymOut, n, voices);
+		}
 
+		// stems are full precision, mono
+		for (int v = 0; v < 3; v++)
+		{
+			if (stemPos[kStemYmA + v])
+			{
+				for (int i = 0; i < n; i++)
+					stemPos[kStemYmA + v][i] = m_voiceSpan[i * 3 + v];
+			}
+		}
+		if (stemPos[kStemSteDac])
+		{
+			for (int i = 0; i < n; i++)
+				stemPos[kStemSteDac][i] = (1 == channels) ? m_dacSpan[i] : int16_t((m_dacSpan[i * 2] + m_dacSpan[i * 2 + 1]) >> 1);
+		}
+
+		if (dacOn)
+			mixSpan(buffer, m_ymSpan, m_dacSpan, n * channels);
+
+		m_Mfp.Advance(n - 1);
+		TickTimers();
+
+		buffer += n * channels;
+		for (int s = 0; s < kStemCount; s++)
+		{
+			if (stemPos[s])
+				stemPos[s] += n;
+		}
+		count -= n;
+	}
+	CpuLeave();
+	return int(pSampleDebugInfo - debugInfoStart);
+}
+
+void	AtariMachine::TickTimers()
+{
 	// tick 4 Atari timers, maybe one of them is running
 	for (int t = 0; t < 4+1; t++)
 	{
@@ -430,6 +717,4 @@ int16_t	AtariMachine::ComputeNextSample(uint32_t* pSampleDebugInfo)
 			m_Ym2149.InsideTimerIrq(false);
 		}
 	}
-	gCurrentMachine = NULL;
-	return out;
 }
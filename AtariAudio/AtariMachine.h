@@ -6,6 +6,7 @@
 --------------------------------------------------------------------*/
 #pragma once
 #include <stdint.h>
+#include <atomic>
 #include "ym2149c.h"
 #include "Mk68901.h"
 #include "SteDac.h"
@@ -15,7 +16,10 @@ static	const	uint32_t	RTE_INSTRUCTION_ADDR = 0x500;
 static	const	uint32_t	RESET_INSTRUCTION_ADDR = 0x502;
 static	const	uint32_t	SNDH_UPLOAD_ADDR = 0x10002;		// some SNDH can't play below (ie SynthDream2) Also some driver crash if loaded at 64KiB bound ( metal planet by Floopy at 1:44 )
 static	const	uint32_t	GEMDOS_MALLOC_EMUL_BUFFER = RAM_SIZE-0x100000;
+static	const	uint32_t	kAtariTimebaseRate = 250000;		// YM2149 clock/8, highest rate of any Atari audio event
 
+class SndhImage;
+struct m68k_block_cache;
 
 class AtariMachine
 {
@@ -29,13 +33,28 @@ public:
 		kReset = (1 << 1),
 	};
 
-	void		Startup(uint32_t hostReplayRate);
+	enum Stem
+	{
+		kStemYmA,
+		kStemYmB,
+		kStemYmC,
+		kStemSteDac,
+		kStemCount
+	};
+
+	void		Startup(uint32_t hostReplayRate, Ym2149c::OutputMode ymOutputMode = Ym2149c::kOutputOversampled, Ym2149c::StereoPanning ymPanning = Ym2149c::kPanningMono);
+	int			GetChannelCount() const { return m_Ym2149.GetChannelCount(); }
+	void		EnableStems(bool enable) { m_Ym2149.EnableVoiceOutput(enable); }		// right after Startup, needed to render YM stems
+	void		SetViewInfoDecimation(int step) { m_viewStep = (step > 0) ? step : 1; m_viewPhase = 0; }	// debug info for the next sample, then one every "step" samples
 	bool		Upload(const void* src, uint32_t addr, uint32_t size);
-	bool		Jsr(uint32_t addr, uint32_t d0);
+	bool		Upload(const SndhImage& image, uint32_t addr);		// copy-on-write map of a shared image when possible
+	bool		Jsr(uint32_t addr, uint32_t d0, const std::atomic<bool>* cancel = NULL);		// cancel (optional) is checked every emulated 50hz frame
 	int16_t		ComputeNextSample(uint32_t* pSampleDebugInfo = NULL);
+	int			Render(int16_t* buffer, int count, uint32_t* pSampleDebugInfo = NULL, int16_t* const* stems = NULL);	// interleaved if stereo, stems are one entry per sample. Returns debug info count
 
 	unsigned int	memRead8(unsigned int address);
 	unsigned int	memRead16(unsigned int address);
+	unsigned int	memRead32(unsigned int address);
 	void			memWrite8(unsigned int address, unsigned int value);
 	void			memWrite16(unsigned int address, unsigned int value);
 	void			TrapInstructionCallback(int v);
@@ -45,16 +64,32 @@ public:
 private:
 	void		ConfigureReturnByRts();
 	void		ConfigureReturnByRte();
-	bool		JmpBinary(int pc, int timeOut50Hz);
+	bool		JmpBinary(int pc, int timeOut50Hz, const std::atomic<bool>* cancel = NULL);
 	void		Gemdos(int func, uint32_t a7);
 	void		XBios(int func, uint32_t a7);
 	void		XbiosTimerSet(int ctrlPort, int dataPort, int enablePort, int bit, int mask, int ctrlValue, int dataValue);
+	void		TickTimers();
+	static void	CpuThreadSetup();
+	void		CpuEnter();
+	void		CpuLeave();
+
+	static const int kSpanMax = 256;
 
 	uint8_t*	m_RAM;
+	void*		m_cpuContext;		// 68000 registers of this machine, so it can run on any thread (and move between threads)
+	m68k_block_cache*	m_blockCache;		// translated code of this machine RAM
+	const uint8_t*		m_codeMap;			// one bit per RAM word holding a cached opcode
+	uint32_t	m_mappedImageAddr;
+	uint32_t	m_mappedImageSize;
 	int			m_ExitCode;
 	uint32_t	m_NextGemdosMallocAd;
 	Ym2149c		m_Ym2149;
 	Mk68901		m_Mfp;
 	SteDac		m_SteDac;
+	int16_t		m_ymSpan[kSpanMax * 2];
+	int16_t		m_dacSpan[kSpanMax * 2];
+	int16_t		m_voiceSpan[kSpanMax * 3];
+	int			m_viewStep;
+	int			m_viewPhase;
 
 };
@@ -9,6 +9,7 @@
 #include "external/Musashi/m68k.h"
 
 static const uint32_t	kAtariMfpClock = 2457600;
+static	const	int	s_Prescale[8] = { 0,kAtariMfpClock / 4,kAtariMfpClock / 10,kAtariMfpClock / 16,kAtariMfpClock / 50,kAtariMfpClock / 64,kAtariMfpClock / 100,kAtariMfpClock / 200 };
 
 void	Mk68901::Reset(uint32_t hostReplayRate)
 {
@@ -34,6 +35,7 @@ void	Mk68901::Timer::Reset()
 {
 	controlRegister = 0;
 	dataRegister = 0;
+	dataRegisterInit = 0;
 	enable = false;
 	mask = false;
 	innerClock = 0;
@@ -188,7 +190,6 @@ bool	Mk68901::Timer::Tick(uint32_t hostReplayRate)
 		else if (controlRegister & 7)
 		{
 			// timer counter mode
-			static	const	int	s_Prescale[8] = { 0,kAtariMfpClock / 4,kAtariMfpClock / 10,kAtariMfpClock / 16,kAtariMfpClock / 50,kAtariMfpClock / 64,kAtariMfpClock / 100,kAtariMfpClock / 200 };
 			innerClock += s_Prescale[controlRegister & 7];
 			// most of the time this while will never loop
 			while (innerClock >= hostReplayRate)
@@ -206,3 +207,63 @@ bool	Mk68901::Timer::Tick(uint32_t hostReplayRate)
 
 	return ret && mask;
 }
+
+int	Mk68901::SamplesBeforeIrq(int maxCount) const
+{
+	int count = maxCount;
+	for (int t = 0; t < 4 + 1; t++)
+		count = m_timers[t].SamplesBeforeIrq(m_hostReplayRate, count);
+	return count;
+}
+
+void	Mk68901::Advance(int count)
+{
+	for (int t = 0; t < 4 + 1; t++)
+		m_timers[t].Advance(m_hostReplayRate, count);
+}
+
+int	Mk68901::Timer::SamplesBeforeIrq(uint32_t hostReplayRate, int maxCount) const
+{
+	if (enable)
+	{
+		if (controlRegister&(1 << 3))
+		{
+			// pending event will be counted at next tick (even if irq is masked)
+			if (externalEvent)
+				return 1;
+		}
+		else if ((controlRegister & 7) && (mask))
+		{
+			// timer reaches 0 at the k-th tick
+			const uint64_t count = dataRegister ? dataRegister : 256;
+			const uint64_t prescale = s_Prescale[controlRegister & 7];
+			const uint64_t k = (count * hostReplayRate - innerClock + prescale - 1) / prescale;
+			if (k < uint64_t(maxCount))
+				return int(k);
+		}
+	}
+	return maxCount;
+}
+
+void	Mk68901::Timer::Advance(uint32_t hostReplayRate, int count)
+{
+	// event mode timers can't change here, no event could be pending
+	if ((enable) && (0 == (controlRegister&(1 << 3))) && (controlRegister & 7) && (count > 0))
+	{
+		innerClock += s_Prescale[controlRegister & 7] * count;
+		uint32_t steps = innerClock / hostReplayRate;
+		innerClock -= steps * hostReplayRate;
+
+		// timer with masked irq could loop several times
+		const uint32_t first = dataRegister ? dataRegister : 256;
+		if (steps < first)
+		{
+			dataRegister -= uint8_t(steps);
+		}
+		else
+		{
+			const uint32_t period = dataRegisterInit ? dataRegisterInit : 256;
+			dataRegister = dataRegisterInit - uint8_t((steps - first) % period);
+		}
+	}
+}
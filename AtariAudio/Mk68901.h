@@ -13,6 +13,8 @@ class Mk68901
 public:
 	void	Reset(uint32_t hostReplayRate);
 	bool	Tick(int timerId);
+	int		SamplesBeforeIrq(int maxCount) const;		// n samples where only the last one could raise a timer irq
+	void	Advance(int count);							// same as "count" Tick() calls, when none of them raises an irq
 
 	enum eTimerName
 	{
@@ -42,6 +44,8 @@ private:
 
 		void	Reset();
 		bool	Tick(uint32_t hostReplayRate);
+		int		SamplesBeforeIrq(uint32_t hostReplayRate, int maxCount) const;
+		void	Advance(uint32_t hostReplayRate, int count);
 		void	SetER(bool _enable);
 		void	SetDR(uint8_t data);
 		void	SetCR(uint8_t data) { controlRegister = data; }
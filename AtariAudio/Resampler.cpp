@@ -0,0 +1,150 @@
+/*--------------------------------------------------------------------
+	Atari Audio Library
+	Small & accurate ATARI-ST audio emulation
+	Arnaud Carré aka Leonard/Oxygene
+	@leonard_coder
+--------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "Resampler.h"
+#include "resampler_tables.h"
+
+static const int kKernelHalfWidth = 8;		// in samples of the lowest rate
+static const int kKernelRes = 64;			// table entries per sample
+
+Resampler::Resampler()
+{
+	m_coefs = NULL;
+	m_history = NULL;
+	m_taps = 0;
+	m_halfTaps = 0;
+	m_historySize = 0;
+	m_inRate = 0;
+	m_outRate = 0;
+	m_inCount = 0;
+	m_timeInt = 0;
+	m_timeFrac = 0;
+}
+
+Resampler::~Resampler()
+{
+	Free();
+}
+
+void	Resampler::Free()
+{
+	free(m_coefs);
+	free(m_history);
+	m_coefs = NULL;
+	m_history = NULL;
+}
+
+bool	Resampler::Reset(uint32_t inRate, uint32_t outRate)
+{
+	if ((0 == inRate) || (0 == outRate))
+		return false;
+
+	// when down sampling, kernel is stretched to cut at output Nyquist freq
+	const uint32_t lowRate = (inRate < outRate) ? inRate : outRate;
+	const int halfTaps = int((uint64_t(kKernelHalfWidth) * inRate + lowRate - 1) / lowRate) + 1;
+	if ((inRate != m_inRate) || (outRate != m_outRate) || (NULL == m_coefs))
+	{
+		Free();
+		m_taps = halfTaps * 2;
+		m_halfTaps = halfTaps;
+		// window of the next output, plus a whole block pushed before it's pulled
+		m_historySize = 1;
+		while (m_historySize < uint32_t(m_taps + kMaxPush))
+			m_historySize <<= 1;
+		m_coefs = (int16_t*)malloc(kPhases * m_taps * sizeof(int16_t));
+		m_history = (int16_t*)malloc(m_historySize * 2 * sizeof(int16_t));
+		if ((NULL == m_coefs) || (NULL == m_history))
+		{
+			Free();
+			return false;
+		}
+
+		// one set of coefficients per sub-sample phase, each normalized to exact unity gain
+		const int64_t den = int64_t(kPhases) * inRate;
+		const int kernelLen = kKernelHalfWidth * kKernelRes * 2;
+		int32_t* raw = (int32_t*)malloc(m_taps * sizeof(int32_t));
+		for (int p = 0; p < kPhases; p++)
+		{
+			int64_t sum = 0;
+			for (int j = 0; j < m_taps; j++)
+			{
+				// distance between input sample and output time, in kernel table units
+				const int64_t num = int64_t((j - halfTaps + 1) * kPhases - p) * lowRate * kKernelRes + int64_t(kKernelHalfWidth) * kKernelRes * den;
+				int32_t v = 0;
+				if (num >= 0)
+				{
+					const int64_t i = num / den;
+					const int64_t rem = num % den;
+					if (i < kernelLen)
+						v = int32_t(s_resamplerKernel[i] + ((s_resamplerKernel[i + 1] - s_resamplerKernel[i]) * rem) / den);
+				}
+				raw[j] = v;
+				sum += v;
+			}
+			int16_t* coefs = m_coefs + p * m_taps;
+			int32_t total = 0;
+			int center = 0;
+			for (int j = 0; j < m_taps; j++)
+			{
+				coefs[j] = int16_t((int64_t(raw[j]) << kCoefBits) / sum);
+				total += coefs[j];
+				if (coefs[j] > coefs[center])
+					center = j;
+			}
+			coefs[center] += int16_t((1 << kCoefBits) - total);
+		}
+		free(raw);
+		m_inRate = inRate;
+		m_outRate = outRate;
+	}
+
+	memset(m_history, 0, m_historySize * 2 * sizeof(int16_t));
+	m_inCount = 0;
+	m_timeInt = 0;
+	m_timeFrac = 0;
+	return true;
+}
+
+void	Resampler::Push(int16_t sample)
+{
+	const uint32_t w = m_inCount & (m_historySize - 1);
+	m_history[w] = sample;
+	m_history[w + m_historySize] = sample;
+	m_inCount++;
+}
+
+void	Resampler::Push(const int16_t* samples, int count, int stride)
+{
+	for (int i = 0; i < count; i++)
+		Push(samples[i * stride]);
+}
+
+int16_t	Resampler::Pull()
+{
+	assert(!NeedInput());
+	const int phase = int((uint64_t(m_timeFrac) * kPhases) / m_outRate);
+	const int16_t* coefs = m_coefs + phase * m_taps;
+	const int16_t* in = m_history + ((m_timeInt - m_halfTaps + 1) & (m_historySize - 1));
+	int32_t acc = 0;
+	for (int i = 0; i < m_taps; i++)
+		acc += coefs[i] * in[i];
+	acc = (acc + (1 << (kCoefBits - 1))) >> kCoefBits;
+	if (acc > 32767)
+		acc = 32767;
+	else if (acc < -32768)
+		acc = -32768;
+
+	m_timeFrac += m_inRate;
+	if (m_timeFrac >= m_outRate)
+	{
+		m_timeInt += m_timeFrac / m_outRate;
+		m_timeFrac %= m_outRate;
+	}
+	return int16_t(acc);
+}
@@ -0,0 +1,49 @@
+/*--------------------------------------------------------------------
+	Atari Audio Library
+	Small & accurate ATARI-ST audio emulation
+	Arnaud Carré aka Leonard/Oxygene
+	@leonard_coder
+--------------------------------------------------------------------*/
+#pragma once
+#include <stdint.h>
+
+/*
+ * Polyphase FIR sample rate converter, any input rate to any output rate (integer only)
+ * Usage: while (NeedInput()) Push(...); then Pull() one output sample
+ * (or push InputNeeded() samples at once, or push a whole block of up to kMaxPush samples
+ * as soon as NeedInput(), then Pull() until NeedInput() again)
+ * Output sample n is aligned on input time n*inRate/outRate (the resampler reads ahead, no delay)
+*/
+class Resampler
+{
+public:
+	static const int kMaxPush = 256;		// samples pushed beyond the first needed one
+
+	Resampler();
+	~Resampler();
+
+	bool	Reset(uint32_t inRate, uint32_t outRate);
+	bool	NeedInput() const { return int32_t(m_inCount - m_timeInt - m_halfTaps - 1) < 0; }
+	int		InputNeeded() const { return NeedInput() ? int(m_timeInt + m_halfTaps + 1 - m_inCount) : 0; }
+	int		InputAhead() const { return int(m_inCount - m_timeInt); }		// pushed samples at or after next output time
+	void	Push(int16_t sample);
+	void	Push(const int16_t* samples, int count, int stride = 1);		// stride to push one channel of interleaved samples
+	int16_t	Pull();
+
+private:
+	static const int kPhases = 256;
+	static const int kCoefBits = 14;
+
+	void		Free();
+
+	int16_t*	m_coefs;			// kPhases * m_taps
+	int16_t*	m_history;			// 2 * m_historySize, each sample is written twice so any window is contiguous
+	int			m_taps;
+	int			m_halfTaps;
+	uint32_t	m_historySize;
+	uint32_t	m_inRate;
+	uint32_t	m_outRate;
+	uint32_t	m_inCount;
+	uint32_t	m_timeInt;			// output time, in input samples
+	uint32_t	m_timeFrac;			// (in 1/outRate input sample)
+};
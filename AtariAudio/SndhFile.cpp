@@ -8,15 +8,27 @@
 #include <string.h>
 #include <assert.h>
 #include "SndhFile.h"
-#include "external/ice_24.h"
+
+#ifndef _MSC_VER
+#define	_strdup	strdup
+#endif
 
 SndhFile::SndhFile()
 {
+	m_image = NULL;
 	m_rawBuffer = NULL;
 	m_Title = NULL;
 	m_Author = NULL;
 	m_sYear = NULL;
 	m_rawSize = 0;
+	m_ymOutputMode = Ym2149c::kOutputOversampled;
+	m_ymPanning = Ym2149c::kPanningMono;
+	m_stemsOutput = false;
+	m_internalRate = 0;
+	m_resampling = false;
+	m_viewInfo = 0;
+	memset(m_chunkView, 0, sizeof(m_chunkView));
+	m_viewStep = 1;
 }
 
 SndhFile::~SndhFile()
@@ -26,11 +38,13 @@ SndhFile::~SndhFile()
 
 void	SndhFile::Unload()
 {
-	free((void*)m_rawBuffer);
+	if (m_image)
+		m_image->Release();
 	free(m_Title);
 	free(m_Author);
 	free(m_sYear);
 	m_bLoaded = false;
+	m_image = NULL;
 	m_rawBuffer = NULL;
 	m_Title = NULL;
 	m_Author = NULL;
@@ -55,28 +69,27 @@ const char* SndhFile::skipNTString(const char* r)
 	return r;
 }
 
-bool	SndhFile::Load(const void* rawSndhFile, int sndhFileSize, uint32_t hostReplayRate)
+bool	SndhFile::Load(const void* rawSndhFile, int sndhFileSize, uint32_t hostReplayRate, bool borrowBuffer)
 {
 
 	Unload();
 	m_hostReplayRate = hostReplayRate;
 	bool ret = false;
-	if (ice_24_header((unsigned char*)rawSndhFile))
+	if ((borrowBuffer) && (sndhFileSize > 0) && (!SndhImage::IsPacked(rawSndhFile, sndhFileSize)))
+	{
+		m_rawBuffer = rawSndhFile;
+		m_rawSize = sndhFileSize;
+	}
+	else
 	{
-		m_rawSize = (int)ice_24_origsize((unsigned char*)rawSndhFile);
-		m_rawBuffer = malloc(m_rawSize);
-		long csize = ice_24_depack((unsigned char*)rawSndhFile, (unsigned char*)m_rawBuffer);
-		if (m_rawSize != csize)
+		m_image = SndhImage::Acquire(rawSndhFile, sndhFileSize, SNDH_UPLOAD_ADDR);
+		if (NULL == m_image)
 		{
 			Unload();
 			return false;
 		}
-	}
-	else
-	{
-		m_rawSize = sndhFileSize;
-		m_rawBuffer = malloc(m_rawSize);
-		memcpy((void*)m_rawBuffer, rawSndhFile, sndhFileSize);
+		m_rawBuffer = m_image->GetData();
+		m_rawSize = m_image->GetSize();
 	}
 
 	for (int i = 0; i < kSubsongCountMax; i++)
@@ -210,28 +223,52 @@ bool	SndhFile::GetSubsongInfo(int subSongId, SubSongInfo& out) const
 	return true;
 }
 
-bool	SndhFile::InitSubSong(int subSongId)
+bool	SndhFile::InitSubSong(int subSongId, const std::atomic<bool>* cancel)
 {
 	bool ret = false;
 	SubSongInfo info;
 	if (!GetSubsongInfo(subSongId, info))
 		return false;
-	m_samplePerTick = m_hostReplayRate / m_playerRate;
+	uint32_t machineRate = m_hostReplayRate;
+	m_resampling = false;
+	if ((m_internalRate) && (m_internalRate != m_hostReplayRate))
+	{
+		m_resampling = true;
+		for (int c = 0; c < GetChannelCount(); c++)
+			m_resampling &= m_resampler[c].Reset(m_internalRate, m_hostReplayRate);
+		if (m_stemsOutput)
+		{
+			for (int s = 0; s < AtariMachine::kStemCount; s++)
+				m_resampling &= m_stemResampler[s].Reset(m_internalRate, m_hostReplayRate);
+		}
+		if (m_resampling)
+			machineRate = m_internalRate;
+	}
+	m_samplePerTick = machineRate / m_playerRate;
 	m_innerSamplePos = 0;
 	m_frame = 0;
 	m_frameCount = info.playerTickCount;
 	m_loopCount = 0;
-	m_atariMachine.Startup(m_hostReplayRate);
-	if (m_atariMachine.Upload(m_rawBuffer, SNDH_UPLOAD_ADDR, m_rawSize))
+	m_viewInfo = 0;
+	memset(m_chunkView, 0, sizeof(m_chunkView));
+	m_atariMachine.Startup(machineRate, m_ymOutputMode, m_ymPanning);
+	m_atariMachine.EnableStems(m_stemsOutput);
+	const bool uploaded = m_image ? m_atariMachine.Upload(*m_image, SNDH_UPLOAD_ADDR) : m_atariMachine.Upload(m_rawBuffer, SNDH_UPLOAD_ADDR, m_rawSize);
+	if (uploaded)
 	{
-		ret = m_atariMachine.Jsr(SNDH_UPLOAD_ADDR, subSongId);
+		ret = m_atariMachine.Jsr(SNDH_UPLOAD_ADDR, subSongId, cancel);
 	}
 	return ret;
 }
 
-int	SndhFile::AudioRender(int16_t* buffer, int count, uint32_t* pSampleViewInfo)
+// samples at machine rate (host rate, or internal rate if resampling)
+void	SndhFile::RenderMachine(int16_t* buffer, int count, uint32_t* pSampleViewInfo, int16_t* const* stems)
 {
-	for (int i = 0; i < count; i++)
+	int16_t* stemPos[AtariMachine::kStemCount];
+	for (int s = 0; s < AtariMachine::kStemCount; s++)
+		stemPos[s] = stems ? stems[s] : NULL;
+
+	while (count > 0)
 	{
 		m_innerSamplePos--;
 		// check if we should call SNDH music driver tick (most of the time 50hz)
@@ -246,10 +283,85 @@ int	SndhFile::AudioRender(int16_t* buffer, int count, uint32_t* pSampleViewInfo)
 			}
 		}
 
-		// compute the Atari machine sample (YM2149 and STE DAC)
-		*buffer++ = m_atariMachine.ComputeNextSample(pSampleViewInfo);
+		// compute the Atari machine samples (YM2149 and STE DAC) until next driver tick
+		const int run = (count < m_innerSamplePos) ? count : m_innerSamplePos;
+		m_innerSamplePos -= run - 1;
+		const int viewCount = m_atariMachine.Render(buffer, run, pSampleViewInfo, stems ? stemPos : NULL);
+		buffer += run * GetChannelCount();
 		if (pSampleViewInfo)
-			pSampleViewInfo++;
+			pSampleViewInfo += viewCount;
+		for (int s = 0; s < AtariMachine::kStemCount; s++)
+		{
+			if (stemPos[s])
+				stemPos[s] += run;
+		}
+		count -= run;
 	}
+}
+
+int	SndhFile::AudioRender(int16_t* buffer, int count, uint32_t* pSampleViewInfo)
+{
+	return Render(buffer, count, pSampleViewInfo, NULL);
+}
+
+int	SndhFile::AudioRenderStems(int16_t* buffer, int count, int16_t* const* stems, uint32_t* pSampleViewInfo)
+{
+	assert(m_stemsOutput);		// should be enabled before InitSubSong
+	return Render(buffer, count, pSampleViewInfo, m_stemsOutput ? stems : NULL);
+}
+
+int	SndhFile::Render(int16_t* buffer, int count, uint32_t* pSampleViewInfo, int16_t* const* stems)
+{
+	if (m_resampling)
+	{
+		// machine renders whole chunks, then every output sample they cover is pulled. Each output sample
+		// gets the visualization data of the machine sample at its time, one entry every m_viewStep samples
+		static const int kChunkSize = Resampler::kMaxPush;
+		int16_t chunk[kChunkSize * 2];
+		int16_t chunkStems[AtariMachine::kStemCount][kChunkSize];
+		int16_t* chunkStemPtr[AtariMachine::kStemCount];
+		for (int s = 0; s < AtariMachine::kStemCount; s++)
+			chunkStemPtr[s] = chunkStems[s];
+
+		// stem resamplers are always fed, to stay in sync
+		const int channels = GetChannelCount();
+		for (int i = 0; i < count; i++)
+		{
+			if (m_resampler[0].NeedInput())
+			{
+				m_viewInfo = m_chunkView[kChunkSize - 1];
+				m_atariMachine.SetViewInfoDecimation(1);
+				RenderMachine(chunk, kChunkSize, pSampleViewInfo ? m_chunkView : NULL, m_stemsOutput ? chunkStemPtr : NULL);
+				for (int c = 0; c < channels; c++)
+					m_resampler[c].Push(chunk + c, kChunkSize, channels);
+				if (m_stemsOutput)
+				{
+					for (int s = 0; s < AtariMachine::kStemCount; s++)
+						m_stemResampler[s].Push(chunkStems[s], kChunkSize);
+				}
+			}
+			if ((pSampleViewInfo) && (0 == (i % m_viewStep)))
+			{
+				// output time can still be in the previous chunk
+				const int pos = kChunkSize - m_resampler[0].InputAhead();
+				*pSampleViewInfo++ = (pos >= 0) ? m_chunkView[pos] : m_viewInfo;
+			}
+			for (int c = 0; c < channels; c++)
+				*buffer++ = m_resampler[c].Pull();
+			if (m_stemsOutput)
+			{
+				for (int s = 0; s < AtariMachine::kStemCount; s++)
+				{
+					const int16_t v = m_stemResampler[s].Pull();
+					if ((stems) && (stems[s]))
+						stems[s][i] = v;
+				}
+			}
+		}
+		return m_loopCount;
+	}
+
+	m_atariMachine.SetViewInfoDecimation(m_viewStep);
+	RenderMachine(buffer, count, pSampleViewInfo, stems);
 	return m_loopCount;
 }
@@ -7,6 +7,8 @@
 #pragma once
 #include <stdint.h>
 #include "AtariMachine.h"
+#include "SndhImage.h"
+#include "Resampler.h"
 
 static	const	int		kSubsongCountMax = 128;
 
@@ -27,19 +29,58 @@ public:
 		const char* year;
 	};
 
-	bool	Load(const void* rawSndhFile, int sndhFileSize, uint32_t hostReplayRate);
+	/*
+	 * Load a raw SNDH file from memory.
+	 * If borrowBuffer is true and the file is not ICE packed, the caller buffer is used in place (no copy)
+	 * and should stay valid until Unload. ICE packed files are always depacked into a shared image
+	*/
+	bool	Load(const void* rawSndhFile, int sndhFileSize, uint32_t hostReplayRate, bool borrowBuffer = false);
 	void	Unload();
 	bool	IsLoaded() const { return m_bLoaded; }
 	
 	int		GetSubsongCount() const;
 	int		GetDefaultSubsong() const { return m_defaultSubSong; }
 	bool	GetSubsongInfo(int subSongId, SubSongInfo& out) const;
-	bool	InitSubSong(int subSongId);
+	bool	InitSubSong(int subSongId, const std::atomic<bool>* cancel = NULL);		// driver init stops (and fails) as soon as *cancel is true
+
+	/*
+	 * YM output stage used by next InitSubSong. kOutputBandLimited is cheaper and alias free,
+	 * best at high host replay rates (96Khz or more). Default is kOutputOversampled
+	*/
+	void	SetYmOutputMode(Ym2149c::OutputMode mode) { m_ymOutputMode = mode; }
+
+	/*
+	 * Internal emulation rate used by next InitSubSong (0 means host replay rate, the default)
+	 * With a fixed internal rate (like kAtariTimebaseRate) YM, STE DAC, MFP timers and driver ticks timing doesn't
+	 * depend on host replay rate anymore, and a polyphase resampler converts to the host replay rate
+	 * Cost follows the internal rate: kAtariTimebaseRate is about twice as expensive as the default, at any host rate
+	*/
+	void	SetInternalRate(uint32_t internalRate) { m_internalRate = internalRate; }
+
+	/*
+	 * Output channels used by next InitSubSong. kPanningMono (default) renders mono samples
+	 * Any other panning renders interleaved stereo samples (left first): STE DMA stereo is kept,
+	 * and YM voices are panned
+	*/
+	void	SetStereoPanning(Ym2149c::StereoPanning ymPanning) { m_ymPanning = ymPanning; }
+	int		GetChannelCount() const { return (Ym2149c::kPanningMono == m_ymPanning) ? 1 : 2; }
+
+	/*
+	 * Stems rendering used by next InitSubSong (default off). Needed by AudioRenderStems
+	*/
+	void	SetStemsOutput(bool enable) { m_stemsOutput = enable; }
+
+	/*
+	 * Visualization data decimation (default 1). pSampleViewInfo receives one entry every "step" samples
+	 * so (count+step-1)/step entries per AudioRender call. Display only needs a few hundred entries per frame
+	*/
+	void	SetViewInfoDecimation(int step) { m_viewStep = (step > 0) ? step : 1; }
 
 	/*
 	 * Main audio rendering function.
-	 * Compute the next "count" samples into "buffer" (mono, signed, 16bits samples)
-	 * pSampleViewInfo is an optional buffer of "count" uint32_t for gadget visualization purpose
+	 * Compute the next "count" samples into "buffer" (signed, 16bits samples)
+	 * In stereo, "buffer" receives count*2 interleaved values (see SetStereoPanning)
+	 * pSampleViewInfo is an optional buffer of "count" uint32_t for gadget visualization purpose (see SetViewInfoDecimation)
 	 * The 32bits contains four 8bits signed values that are respectivly from low byte to high byte:
 	 * YM voices A,B,C and STE DAC
 	 * Note: Always use "buffer" as audio source. Do *not* mix yourself the SampleViewInfo data
@@ -47,10 +88,20 @@ public:
 	*/
 	int		AudioRender(int16_t* buffer, int count, uint32_t* pSampleViewInfo = NULL);
 
+	/*
+	 * Same as AudioRender, and fills full precision stems in the same pass: "stems" is an array of
+	 * AtariMachine::kStemCount buffers (YM voice A, B, C and STE DAC), each of "count" mono samples.
+	 * Any NULL stem buffer is skipped. Stems are not panned, and each YM voice is dc adjusted on its own,
+	 * so the stems sum is very close to the mono mix (but not bit exact, mix is saturated)
+	*/
+	int		AudioRenderStems(int16_t* buffer, int count, int16_t* const* stems, uint32_t* pSampleViewInfo = NULL);
+
 	const void*	GetRawData() const { return m_rawBuffer; }
 	const int	GetRawDataSize() const { return m_rawSize; }
 
 private:
+	int				Render(int16_t* buffer, int count, uint32_t* pSampleViewInfo, int16_t* const* stems);
+	void			RenderMachine(int16_t* buffer, int count, uint32_t* pSampleViewInfo, int16_t* const* stems);
 	uint16_t		Read16(const char*);
 	const char*	skipNTString(const char* r);
 
@@ -58,6 +109,7 @@ private:
 	char*	m_Title;
 	char*	m_Author;
 	char*	m_sYear;
+	SndhImage*	m_image;			// decoded file, shared with any other SndhFile playing the same file (NULL if borrowed)
 	const void*	m_rawBuffer;
 	int		m_rawSize;
 
@@ -72,6 +124,16 @@ private:
 	int		m_frameCount;
 	int		m_loopCount;
 	uint32_t m_hostReplayRate;
+	Ym2149c::OutputMode m_ymOutputMode;
+	Ym2149c::StereoPanning m_ymPanning;
+	bool	m_stemsOutput;
+	uint32_t m_internalRate;
+	bool	m_resampling;
+	uint32_t m_viewInfo;
+	uint32_t m_chunkView[Resampler::kMaxPush];		// visualization data of each machine sample of the last resampled chunk
+	int		m_viewStep;
+	Resampler m_resampler[2];
+	Resampler m_stemResampler[AtariMachine::kStemCount];
 
 	AtariMachine m_atariMachine;
 };
@@ -0,0 +1,193 @@
+/*--------------------------------------------------------------------
+	Atari Audio Library
+	Small & accurate ATARI-ST audio emulation
+	Arnaud Carré aka Leonard/Oxygene
+	@leonard_coder
+--------------------------------------------------------------------*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		// memfd_create
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <mutex>
+#include "SndhImage.h"
+#include "external/ice_24.h"
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static std::mutex	sImageLock;
+static SndhImage*	sImageList = NULL;		// all images currently in use
+
+SndhImage::SndhImage()
+{
+	m_data = NULL;
+	m_size = 0;
+	m_packedData = NULL;
+	m_packedSize = 0;
+	m_hash = 0;
+	m_refCount = 0;
+	m_mapHandle = -1;
+	m_mapOffset = 0;
+	m_mapSize = 0;
+	m_next = NULL;
+}
+
+SndhImage::~SndhImage()
+{
+	free(m_packedData);
+#if defined(__linux__)
+	if (m_mapHandle >= 0)
+	{
+		munmap(m_data - m_mapOffset, m_mapSize);
+		close(m_mapHandle);
+		return;
+	}
+#endif
+	free(m_data);
+}
+
+// FNV-1a 64bits
+uint64_t	SndhImage::ContentHash(const void* data, int size)
+{
+	const uint8_t* r = (const uint8_t*)data;
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (int i = 0; i < size; i++)
+	{
+		h ^= r[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+bool	SndhImage::IsPacked(const void* rawSndhFile, int sndhFileSize)
+{
+	return (sndhFileSize >= 12) && ice_24_header((unsigned char*)rawSndhFile);
+}
+
+bool	SndhImage::Create(const void* rawSndhFile, int sndhFileSize, uint32_t uploadAddr)
+{
+	const bool packed = IsPacked(rawSndhFile, sndhFileSize);
+	m_size = packed ? (int)ice_24_origsize((unsigned char*)rawSndhFile) : sndhFileSize;
+	m_packedSize = sndhFileSize;
+	if (m_size <= 0)
+		return false;
+
+#if defined(__linux__)
+	// image is stored in shared memory with same alignment as in Atari RAM, so it can be page mapped
+	m_mapOffset = uploadAddr & (kMapAlign - 1);
+	m_mapSize = (m_mapOffset + m_size + kMapAlign - 1) & ~(kMapAlign - 1);
+	m_mapHandle = memfd_create("sndh", MFD_CLOEXEC);
+	if (m_mapHandle >= 0)
+	{
+		void* p = MAP_FAILED;
+		if (0 == ftruncate(m_mapHandle, m_mapSize))
+			p = mmap(NULL, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_mapHandle, 0);
+		if (MAP_FAILED == p)
+		{
+			close(m_mapHandle);
+			m_mapHandle = -1;
+		}
+		else
+			m_data = (uint8_t*)p + m_mapOffset;
+	}
+#endif
+	if (NULL == m_data)
+	{
+		m_mapOffset = 0;
+		m_mapSize = 0;
+		m_data = (uint8_t*)malloc(m_size);
+		if (NULL == m_data)
+			return false;
+	}
+
+	if (packed)
+	{
+		long csize = ice_24_depack((unsigned char*)rawSndhFile, m_data);
+		if (m_size != csize)
+			return false;
+		m_packedData = (uint8_t*)malloc(sndhFileSize);
+		if (NULL == m_packedData)
+			return false;
+		memcpy(m_packedData, rawSndhFile, sndhFileSize);
+	}
+	else
+	{
+		memcpy(m_data, rawSndhFile, sndhFileSize);
+	}
+#if defined(__linux__)
+	if (m_mapHandle >= 0)
+		mprotect(m_data - m_mapOffset, m_mapSize, PROT_READ);
+#endif
+	return true;
+}
+
+bool	SndhImage::IsSameFile(const void* rawSndhFile, int sndhFileSize, uint64_t hash) const
+{
+	if ((m_hash != hash) || (m_packedSize != sndhFileSize))
+		return false;
+	return 0 == memcmp(m_packedData ? m_packedData : m_data, rawSndhFile, sndhFileSize);
+}
+
+SndhImage*	SndhImage::Acquire(const void* rawSndhFile, int sndhFileSize, uint32_t uploadAddr)
+{
+	if ((NULL == rawSndhFile) || (sndhFileSize <= 0))
+		return NULL;
+
+	const uint64_t hash = ContentHash(rawSndhFile, sndhFileSize);
+	{
+		std::lock_guard<std::mutex> lock(sImageLock);
+		for (SndhImage* img = sImageList; img; img = img->m_next)
+		{
+			if (img->IsSameFile(rawSndhFile, sndhFileSize, hash))
+			{
+				img->m_refCount++;
+				return img;
+			}
+		}
+	}
+
+	// depack out of the lock, so several threads could load different files at the same time
+	SndhImage* img = new SndhImage;
+	img->m_hash = hash;
+	if (!img->Create(rawSndhFile, sndhFileSize, uploadAddr))
+	{
+		delete img;
+		return NULL;
+	}
+
+	std::lock_guard<std::mutex> lock(sImageLock);
+	for (SndhImage* other = sImageList; other; other = other->m_next)
+	{
+		if (other->IsSameFile(rawSndhFile, sndhFileSize, hash))
+		{
+			// another thread just loaded the same file
+			other->m_refCount++;
+			delete img;
+			return other;
+		}
+	}
+	img->m_refCount = 1;
+	img->m_next = sImageList;
+	sImageList = img;
+	return img;
+}
+
+void	SndhImage::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(sImageLock);
+		assert(m_refCount > 0);
+		m_refCount--;
+		if (m_refCount > 0)
+			return;
+
+		SndhImage** pp = &sImageList;
+		while (*pp != this)
+			pp = &(*pp)->m_next;
+		*pp = m_next;
+	}
+	delete this;
+}
@@ -0,0 +1,53 @@
+/*--------------------------------------------------------------------
+	Atari Audio Library
+	Small & accurate ATARI-ST audio emulation
+	Arnaud Carré aka Leonard/Oxygene
+	@leonard_coder
+--------------------------------------------------------------------*/
+#pragma once
+#include <stdint.h>
+
+/*
+ * Decoded (ICE depacked) SNDH file image. Images are immutable, refcounted and
+ * shared by every SndhFile loading the same file content (looked up by content hash,
+ * then compared byte for byte, as the hash is not collision resistant)
+ * On Linux the image lives in a memfd, so AtariMachine can map it copy-on-write into
+ * its RAM: driver & sample data are shared between instances until a driver writes to them
+*/
+class SndhImage
+{
+public:
+	static	const	uint32_t	kMapAlign = 0x10000;		// image is mapped at (uploadAddr & ~(kMapAlign-1))
+
+	static SndhImage*	Acquire(const void* rawSndhFile, int sndhFileSize, uint32_t uploadAddr);
+	void				Release();
+
+	const void*	GetData() const { return m_data; }
+	int			GetSize() const { return m_size; }
+	uint64_t	GetHash() const { return m_hash; }
+
+	// shared memory handle to map the image into RAM (-1 if not supported on this platform)
+	int			GetMapHandle() const { return m_mapHandle; }
+	uint32_t	GetMapOffset() const { return m_mapOffset; }
+	uint32_t	GetMapSize() const { return m_mapSize; }
+
+	static uint64_t	ContentHash(const void* data, int size);
+	static bool		IsPacked(const void* rawSndhFile, int sndhFileSize);
+
+private:
+	SndhImage();
+	~SndhImage();
+	bool		Create(const void* rawSndhFile, int sndhFileSize, uint32_t uploadAddr);
+	bool		IsSameFile(const void* rawSndhFile, int sndhFileSize, uint64_t hash) const;
+
+	uint8_t*	m_data;
+	int			m_size;
+	uint8_t*	m_packedData;		// copy of the ICE packed file (NULL if not packed: m_data is the file)
+	int			m_packedSize;
+	uint64_t	m_hash;
+	int			m_refCount;
+	int			m_mapHandle;
+	uint32_t	m_mapOffset;
+	uint32_t	m_mapSize;
+	SndhImage*	m_next;
+};
@@ -15,14 +15,28 @@ void	SteDac::Reset(uint32_t hostReplayRate)
 		m_regs[i] = 0;
 	m_hostReplayRate = hostReplayRate;
 	m_samplePtr = 0;
+	m_sampleEndPtr = 0;
 	m_innerClock = 0;
 	m_microwireMask = 0;
 	m_microwireShift = 0;
 	m_microwireData = 0;
 	m_masterVolume = 64;
 	m_currentDacLevel = 0;
+	m_currentStereoLevel[0] = 0;
+	m_currentStereoLevel[1] = 0;
 	m_50Acc = 0;
+	m_50AccStereo[0] = 0;
+	m_50AccStereo[1] = 0;
 	m_50to25 = false;
+	UpdateMode();
+}
+
+void	SteDac::UpdateMode()
+{
+	static	const uint32_t	sDacFreq[4] = { kSTE_DAC_Frq / 8 , kSTE_DAC_Frq / 4 , kSTE_DAC_Frq / 2 , kSTE_DAC_Frq / 1 };
+	m_dacFreq = sDacFreq[m_regs[0x21] & 3];
+	m_stereo = (0 == (m_regs[0x21] & 0x80));
+	m_b50k = (3 == (m_regs[0x21] & 3));
 }
 
 void	SteDac::FetchSamplePtr()
@@ -53,6 +67,8 @@ void	SteDac::Write8(int ad, uint8_t data)
 			if ((data & 3) != (m_regs[0x21]&3))
 			{
 				m_50Acc = 0;
+				m_50AccStereo[0] = 0;
+				m_50AccStereo[1] = 0;
 				m_50to25 = false;
 			}
 			break;
@@ -61,6 +77,8 @@ void	SteDac::Write8(int ad, uint8_t data)
 		}
 
 		m_regs[ad] = data;
+		if (0x21 == ad)
+			UpdateMode();
 	}
 }
 
@@ -133,64 +151,144 @@ int8_t	SteDac::FetchSample(const int8_t* atariRam, uint32_t ramSize, uint32_t at
 }
 
 int16_t	SteDac::ComputeNextSample(const int8_t* atariRam, uint32_t ramSize, Mk68901& mfp)
+{
+	int16_t out;
+	RenderSpan(&out, 1, 1, atariRam, ramSize, mfp);
+	return out;
+}
+
+int	SteDac::RenderSpan(int16_t* out, int count, int channels, const int8_t* atariRam, uint32_t ramSize, Mk68901& mfp)
 {
 	// supports tricky Tao "MS3" driver. Seems to be a 3 or 4 voices synth, without need of mixing code!
 	// the 4 voices are just output in 4 consecutive bytes. Everything is playing at 50Khz, stereo
 	// On real hardware with analog filters & friends, it "sounds" like if you mixed 4 voices at 25Khz
 	//
-	// ComputeNextSample is called at host rate
+	// Output is computed at host rate
 	// but the while loop is running at DAC speed. In 50khz mode, 2 samples are accumulated before 
 	// output. So you get a mixed stream at 25Khz. None of original atari samples are missed, and
 	// Tao MS3 songs are playing ok!
 	// Please note it also works perfectly with Quartet STE code, that is mixing into a 2 bytes 50Khz buffer!! :)
-	static	const uint32_t	sDacFreq[4] = { kSTE_DAC_Frq / 8 , kSTE_DAC_Frq / 4 , kSTE_DAC_Frq / 2 , kSTE_DAC_Frq / 1 };
-	if (m_regs[1] & 1)
+	//
+	// DAC level is held between DMA bytes (zero-order hold), like the real DAC output steps before the analog
+	// filter. That's on purpose: it keeps the DAC character, and output identical to the per sample code.
+	// Band limited DAC output is the fixed internal rate path (SetInternalRate), resampled with the YM
+	if (0 == (m_regs[1] & 1))
+	{
+		m_currentDacLevel = 0;
+		m_currentStereoLevel[0] = 0;
+		m_currentStereoLevel[1] = 0;
+		for (int i = 0; i < count * channels; i++)
+			out[i] = 0;
+		return count;
+	}
+
+	// mode can only change with a register write (68k code), so it's constant for the whole span
+	const int kernel = ((2 == channels) ? 4 : 0) | (m_stereo ? 2 : 0) | (m_b50k ? 1 : 0);
+	switch (kernel)
+	{
+	case 0:	return RenderSpanKernel<false, false, false>(out, count, atariRam, ramSize, mfp);
+	case 1:	return RenderSpanKernel<false, false, true>(out, count, atariRam, ramSize, mfp);
+	case 2:	return RenderSpanKernel<false, true, false>(out, count, atariRam, ramSize, mfp);
+	case 3:	return RenderSpanKernel<false, true, true>(out, count, atariRam, ramSize, mfp);
+	case 4:	return RenderSpanKernel<true, false, false>(out, count, atariRam, ramSize, mfp);
+	case 5:	return RenderSpanKernel<true, false, true>(out, count, atariRam, ramSize, mfp);
+	case 6:	return RenderSpanKernel<true, true, false>(out, count, atariRam, ramSize, mfp);
+	default:	return RenderSpanKernel<true, true, true>(out, count, atariRam, ramSize, mfp);
+	}
+}
+
+template <bool kStereoOut, bool kStereoDma, bool k50k>
+int	SteDac::RenderSpanKernel(int16_t* out, int count, const int8_t* atariRam, uint32_t ramSize, Mk68901& mfp)
+{
+	// DMA window is checked once for the whole span, not for each byte (pointer can't pass the end address
+	// without triggering the end event, except odd size stereo buffer)
+	const int ptrStep = kStereoDma ? 2 : 1;
+	const bool inRam = (m_samplePtr < m_sampleEndPtr) && (m_sampleEndPtr < ramSize) && (0 == ((m_sampleEndPtr - m_samplePtr) & (ptrStep - 1)));
+	const int stereoScale = kStereoDma ? 2 : 1;
+	for (int i = 0; i < count; i++)
 	{
-		m_innerClock += sDacFreq[m_regs[0x21] & 3];
-		const bool stereo = (0 == (m_regs[0x21] & 0x80));
-		const bool b50k = (3 == (m_regs[0x21]&3));
-	
+		bool endEvent = false;
+		m_innerClock += m_dacFreq;
 		while (m_innerClock >= m_hostReplayRate)
 		{
 			if (m_samplePtr == m_sampleEndPtr)
 			{
 				mfp.SetSteDacExternalEvent();
+				endEvent = true;
 				FetchSamplePtr();
 				if ((m_regs[0x1] & (1 << 1)) == 0)
 				{
 					// if no loop mode, switch off replay
 					m_regs[0x1] &= 0xfe;
 					m_currentDacLevel = 0;
+					m_currentStereoLevel[0] = 0;
+					m_currentStereoLevel[1] = 0;
 					break;
 				}
 			}
-			
-			int16_t level = FetchSample(atariRam, ramSize, m_samplePtr);
-			if (stereo)
-				level += FetchSample(atariRam, ramSize, m_samplePtr + 1);
-	
-			if (b50k)
+
+			int16_t left;
+			int16_t right;
+			if ((inRam) && (!endEvent))
+			{
+				left = atariRam[m_samplePtr];
+				right = kStereoDma ? atariRam[m_samplePtr + 1] : left;
+			}
+			else
+			{
+				left = FetchSample(atariRam, ramSize, m_samplePtr);
+				right = kStereoDma ? FetchSample(atariRam, ramSize, m_samplePtr + 1) : left;
+			}
+			const int16_t level = kStereoDma ? (left + right) : left;
+
+			if (k50k)
 			{
 				m_50Acc += level;
+				if (kStereoOut)
+				{
+					m_50AccStereo[0] += left * stereoScale;
+					m_50AccStereo[1] += right * stereoScale;
+				}
 				m_50to25 ^= true;
 				if (!m_50to25)
 				{
 					m_currentDacLevel = (m_50Acc * m_masterVolume)>>1;
 					m_50Acc = 0;
+					if (kStereoOut)
+					{
+						m_currentStereoLevel[0] = (m_50AccStereo[0] * m_masterVolume) >> 1;
+						m_currentStereoLevel[1] = (m_50AccStereo[1] * m_masterVolume) >> 1;
+						m_50AccStereo[0] = 0;
+						m_50AccStereo[1] = 0;
+					}
 				}
 			}
 			else
 			{
 				m_currentDacLevel = level * m_masterVolume;
+				if (kStereoOut)
+				{
+					m_currentStereoLevel[0] = left * stereoScale * m_masterVolume;
+					m_currentStereoLevel[1] = right * stereoScale * m_masterVolume;
+				}
 			}
-	
-			m_samplePtr += stereo?2:1;
+
+			m_samplePtr += ptrStep;
 			m_innerClock -= m_hostReplayRate;
 		}
+		if (kStereoOut)
+		{
+			out[i * 2 + 0] = m_currentStereoLevel[0];
+			out[i * 2 + 1] = m_currentStereoLevel[1];
+		}
+		else
+		{
+			out[i] = m_currentDacLevel;
+		}
+		if (endEvent)
+			return i + 1;
 	}
-	else
-		m_currentDacLevel = 0;
-	return m_currentDacLevel;
+	return count;
 }
 
 // emulate internal rol to please any user 68k code reading & waiting the complete cycle
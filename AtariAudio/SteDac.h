@@ -20,8 +20,16 @@ public:
 
 	int16_t		ComputeNextSample(const int8_t* atariRam, uint32_t ramSize, Mk68901& mfp);
 
+	// Compute up to "count" samples (interleaved left/right if "channels" is 2, to keep STE DMA stereo).
+	// Stops right after a sample where DMA reached the end of the buffer (MFP external event), so caller
+	// could run timers. Returns the number of computed samples
+	int			RenderSpan(int16_t* out, int count, int channels, const int8_t* atariRam, uint32_t ramSize, Mk68901& mfp);
+	bool		IsOn() const { return 0 != (m_regs[1] & 1); }
+
 private:
 	void		FetchSamplePtr();
+	void		UpdateMode();
+	template <bool kStereoOut, bool kStereoDma, bool k50k> int RenderSpanKernel(int16_t* out, int count, const int8_t* atariRam, uint32_t ramSize, Mk68901& mfp);
 	int8_t		FetchSample(const int8_t* atariRam, uint32_t ramSize, uint32_t atariAd);
 	uint16_t	MicrowireTick();
 	void		MicrowireProceed();
@@ -36,5 +44,10 @@ private:
 	int			m_masterVolume;
 	bool m_50to25;
 	int m_50Acc;
+	int m_50AccStereo[2];
 	int16_t m_currentDacLevel;
+	int16_t m_currentStereoLevel[2];	// in stereo, mono DMA replay is full level in both channels
+	uint32_t m_dacFreq;			// mode dependent values, only updated on register write
+	bool	m_stereo;
+	bool	m_b50k;
 };
@@ -378,6 +378,22 @@ unsigned int m68k_disassemble(char* str_buff, unsigned int pc, unsigned int cpu_
  */
 unsigned int m68k_disassemble_raw(char* str_buff, unsigned int pc, const unsigned char* opdata, const unsigned char* argdata, unsigned int cpu_type);
 
+/* Translated block cache (see M68K_BLOCK_CACHE). One cache per emulated
+ * machine, for code running in its RAM, [0, ram_size). Immediate operands in
+ * that range are read from ram directly. The code map has one bit per 16-bit
+ * word of RAM, set for each word holding a cached opcode.
+ */
+typedef struct m68k_block_cache m68k_block_cache;
+
+m68k_block_cache* m68k_block_cache_create(const unsigned char* ram, unsigned int ram_size);
+void m68k_block_cache_destroy(m68k_block_cache* cache);
+void m68k_block_cache_flush(m68k_block_cache* cache);
+void m68k_block_cache_invalidate(m68k_block_cache* cache, unsigned int address);
+const unsigned char* m68k_block_cache_code_map(const m68k_block_cache* cache);
+
+/* Cache used by m68k_execute() on this thread, NULL for none */
+void m68k_set_block_cache(m68k_block_cache* cache);
+
 #ifdef __cplusplus
 	}
 #endif
@@ -74,7 +74,15 @@
  * and m68k_read_pcrelative_xx() for PC-relative addressing.
  * If off, all read requests from the CPU will be redirected to m68k_read_xx()
  */
-#define M68K_SEPARATE_READS         OPT_OFF
+#define M68K_SEPARATE_READS         OPT_ON
+
+/* If ON, m68k_execute() replays straight-line runs of instructions from the
+ * translated block cache set with m68k_set_block_cache() (if any). The host
+ * must call m68k_block_cache_invalidate() when it writes to a word marked in
+ * the cache code map, and m68k_block_cache_flush() when it changes memory
+ * without the CPU write callbacks.
+ */
+#define M68K_BLOCK_CACHE            OPT_ON
 
 /* If ON, the CPU will call m68k_write_32_pd() when it executes move.l with a
  * predecrement destination EA mode instead of m68k_write_32().
@@ -197,6 +205,18 @@
 #define M68K_USE_64_BIT  OPT_ON
 
 
+/* CPU core state storage. Thread local, so several emulated machines could
+ * run at the same time (one per thread)
+ */
+#ifndef M68K_THREAD_LOCAL
+#ifdef _MSC_VER
+#define M68K_THREAD_LOCAL __declspec(thread)
+#else
+#define M68K_THREAD_LOCAL __thread
+#endif
+#endif /* M68K_THREAD_LOCAL */
+
+
 /* Set to your compiler's static inline keyword to enable it, or
  * set it to blank to disable it.
  * If you define INLINE in the makefile, it will override this value.
@@ -38,6 +38,9 @@
 /* ================================ INCLUDES ============================== */
 /* ======================================================================== */
 
+#include <stdlib.h>
+#include <string.h>
+
 extern void m68040_fpu_op0(void);
 extern void m68040_fpu_op1(void);
 extern unsigned char m68ki_cycles[][0x10000];
@@ -52,12 +55,63 @@ extern void m68ki_build_opcode_table(void);
 /* ================================= DATA ================================= */
 /* ======================================================================== */
 
-int  m68ki_initial_cycles;
-int  m68ki_remaining_cycles = 0;                     /* Number of clocks remaining */
-uint m68ki_tracing = 0;
-uint m68ki_address_space;
+M68K_THREAD_LOCAL int  m68ki_initial_cycles;
+M68K_THREAD_LOCAL int  m68ki_remaining_cycles = 0;                     /* Number of clocks remaining */
+M68K_THREAD_LOCAL uint m68ki_tracing = 0;
+M68K_THREAD_LOCAL uint m68ki_address_space;
+
+M68K_THREAD_LOCAL uint gClockCycle = 0;
+
+#if M68K_BLOCK_CACHE
+#if M68K_EMULATE_TRACE || M68K_INSTRUCTION_HOOK || M68K_EMULATE_PREFETCH || M68K_EMULATE_FC || M68K_EMULATE_ADDRESS_ERROR
+#error "M68K_BLOCK_CACHE replays instructions without trace, instruction hook, prefetch, FC or address error emulation"
+#endif
+
+/* A block is a straight-line run of instructions, recorded the first time it
+ * runs: PC, opcode, handler and base cycles of each instruction. Replay skips
+ * the opcode fetch and the jump & cycle table lookups (operands are still read
+ * from memory). Each replayed instruction must be at the PC the previous one
+ * left, so a taken branch or an exception just ends the block.
+ * Blocks never cross a code page. Writing to a word holding a cached opcode
+ * bumps the generation of its page, which drops every block of the page
+ * (self modifying code).
+ */
+#define BLOCK_PAGE_SHIFT		8
+#define BLOCK_SLOTS				1024			/* direct mapped by PC */
+#define BLOCK_MAX_INSTR			16
+#define BLOCK_MAX_INSTR_SIZE	10				/* 68000 instruction, in bytes */
+#define BLOCK_INVALID_PC		0xffffffff
+
+typedef struct
+{
+	void (*handler)(void);
+	uint pc;
+	uint16 opcode;
+	uint16 cycles;
+} m68ki_block_instr;
+
+typedef struct
+{
+	uint pc;
+	uint gen;
+	uint count;
+	m68ki_block_instr instr[BLOCK_MAX_INSTR];
+} m68ki_block;
+
+struct m68k_block_cache
+{
+	const unsigned char* ram;
+	uint ram_size;
+	uint* page_gen;
+	unsigned char* code_map;
+	uint map_lo;					/* code map bytes written since last flush */
+	uint map_hi;
+	int used;
+	m68ki_block blocks[BLOCK_SLOTS];
+};
 
-uint gClockCycle = 0;
+M68K_THREAD_LOCAL m68k_block_cache* m68ki_block_cache = NULL;
+#endif /* M68K_BLOCK_CACHE */
 
 #ifdef M68K_LOG_ENABLE
 const char *const m68ki_cpu_names[] =
@@ -75,15 +129,15 @@ const char *const m68ki_cpu_names[] =
 #endif /* M68K_LOG_ENABLE */
 
 /* The CPU core */
-m68ki_cpu_core m68ki_cpu = {0};
+M68K_THREAD_LOCAL m68ki_cpu_core m68ki_cpu = {0};
 
 #if M68K_EMULATE_ADDRESS_ERROR
-jmp_buf m68ki_aerr_trap;
+M68K_THREAD_LOCAL jmp_buf m68ki_aerr_trap;
 #endif /* M68K_EMULATE_ADDRESS_ERROR */
 
-uint    m68ki_aerr_address;
-uint    m68ki_aerr_write_mode;
-uint    m68ki_aerr_fc;
+M68K_THREAD_LOCAL uint    m68ki_aerr_address;
+M68K_THREAD_LOCAL uint    m68ki_aerr_write_mode;
+M68K_THREAD_LOCAL uint    m68ki_aerr_fc;
 
 /* Used by shift & rotate instructions */
 const uint8 m68ki_shift_8_table[65] =
@@ -516,7 +570,7 @@ static void default_instr_hook_callback(unsigned int pc)
 
 #if M68K_EMULATE_ADDRESS_ERROR
 	#include <setjmp.h>
-	jmp_buf m68ki_aerr_trap;
+	M68K_THREAD_LOCAL jmp_buf m68ki_aerr_trap;
 #endif /* M68K_EMULATE_ADDRESS_ERROR */
 
 
@@ -777,6 +831,162 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 
 /* Execute some instructions until we use up num_cycles clock cycles */
 /* ASG: removed per-instruction interrupt checks */
+#if M68K_BLOCK_CACHE
+m68k_block_cache* m68k_block_cache_create(const unsigned char* ram, unsigned int ram_size)
+{
+	m68k_block_cache* cache = (m68k_block_cache*)calloc(1, sizeof(m68k_block_cache));
+	if(cache == NULL)
+		return NULL;
+	cache->ram = ram;
+	cache->ram_size = ram_size;
+	cache->page_gen = (uint*)calloc((ram_size >> BLOCK_PAGE_SHIFT) + 1, sizeof(uint));
+	cache->code_map = (unsigned char*)calloc((ram_size >> 4) + 1, 1);
+	if((cache->page_gen == NULL) || (cache->code_map == NULL))
+	{
+		m68k_block_cache_destroy(cache);
+		return NULL;
+	}
+	cache->map_lo = ram_size >> 4;
+	cache->used = 1;
+	m68k_block_cache_flush(cache);
+	return cache;
+}
+
+void m68k_block_cache_destroy(m68k_block_cache* cache)
+{
+	if(cache)
+	{
+		free(cache->page_gen);
+		free(cache->code_map);
+		free(cache);
+	}
+}
+
+void m68k_block_cache_flush(m68k_block_cache* cache)
+{
+	int i;
+	if(!cache->used)
+		return;
+	for(i = 0; i < BLOCK_SLOTS; i++)
+		cache->blocks[i].pc = BLOCK_INVALID_PC;
+	if(cache->map_lo <= cache->map_hi)
+		memset(cache->code_map + cache->map_lo, 0, cache->map_hi - cache->map_lo + 1);
+	cache->map_lo = cache->ram_size >> 4;
+	cache->map_hi = 0;
+	cache->used = 0;
+}
+
+void m68k_block_cache_invalidate(m68k_block_cache* cache, unsigned int address)
+{
+	const uint page = address >> BLOCK_PAGE_SHIFT;
+	cache->page_gen[page]++;
+	memset(cache->code_map + (page << (BLOCK_PAGE_SHIFT - 4)), 0, 1 << (BLOCK_PAGE_SHIFT - 4));
+}
+
+const unsigned char* m68k_block_cache_code_map(const m68k_block_cache* cache)
+{
+	return cache->code_map;
+}
+
+void m68k_set_block_cache(m68k_block_cache* cache)
+{
+	m68ki_block_cache = cache;
+	m68ki_cpu.code_ram = cache ? cache->ram : NULL;
+	m68ki_cpu.code_ram_size = cache ? cache->ram_size : 0;
+}
+
+static void m68ki_execute_one(void)
+{
+	uint cycles;
+	REG_PPC = REG_PC;
+	REG_IR = m68ki_read_imm_16();
+	m68ki_instruction_jump_table[REG_IR]();
+	cycles = CYC_INSTRUCTION[REG_IR];
+	USE_CYCLES(cycles);
+	gClockCycle += cycles;
+}
+
+static void m68ki_execute_blocks(m68k_block_cache* cache)
+{
+	cache->used = 1;
+	do
+	{
+		const uint pc = REG_PC;
+		uint page, gen;
+		m68ki_block* block;
+
+		/* code outside RAM (or odd PC) isn't cached */
+		if((pc & 1) || (pc >= cache->ram_size - 1))
+		{
+			m68ki_execute_one();
+			continue;
+		}
+
+		page = pc >> BLOCK_PAGE_SHIFT;
+		gen = cache->page_gen[page];
+		block = cache->blocks + ((pc >> 1) & (BLOCK_SLOTS - 1));
+		if((block->pc == pc) && (block->gen == gen))
+		{
+			const m68ki_block_instr* instr = block->instr;
+			const m68ki_block_instr* end = instr + block->count;
+			for(;;)
+			{
+				REG_PPC = REG_PC;
+				REG_IR = instr->opcode;
+				REG_PC += 2;
+				instr->handler();
+				USE_CYCLES(instr->cycles);
+				gClockCycle += instr->cycles;
+				if((GET_CYCLES() <= 0) || (cache->page_gen[page] != gen))
+					break;
+				if(++instr == end)
+					instr = block->instr;		/* a loop back to the block start keeps running it */
+				if(REG_PC != instr->pc)
+					break;
+			}
+		}
+		else
+		{
+			/* record a new block in this slot, while running it */
+			block->pc = pc;
+			block->gen = gen;
+			block->count = 0;
+			for(;;)
+			{
+				const uint ipc = REG_PC;
+				const uint map = ipc >> 4;
+				m68ki_block_instr* instr = block->instr + block->count++;
+				cache->code_map[map] |= 1 << ((ipc >> 1) & 7);
+				if(map < cache->map_lo)
+					cache->map_lo = map;
+				if(map > cache->map_hi)
+					cache->map_hi = map;
+
+				REG_PPC = ipc;
+				REG_IR = m68ki_read_imm_16();
+				instr->pc = ipc;
+				instr->opcode = REG_IR;
+				instr->handler = m68ki_instruction_jump_table[REG_IR];
+				instr->cycles = CYC_INSTRUCTION[REG_IR];
+				instr->handler();
+				USE_CYCLES(instr->cycles);
+				gClockCycle += instr->cycles;
+
+				/* the block modified its own code */
+				if(cache->page_gen[page] != gen)
+				{
+					block->pc = BLOCK_INVALID_PC;
+					break;
+				}
+				if((block->count == BLOCK_MAX_INSTR) || (GET_CYCLES() <= 0) || (REG_PC <= ipc) ||
+					(REG_PC > ipc + BLOCK_MAX_INSTR_SIZE) || ((REG_PC >> BLOCK_PAGE_SHIFT) != page) || (REG_PC & 1))
+					break;
+			}
+		}
+	} while(GET_CYCLES() > 0);
+}
+#endif /* M68K_BLOCK_CACHE */
+
 int m68k_execute(int num_cycles)
 {
 	/* Set our pool of clock cycles available */
@@ -793,6 +1003,11 @@ int m68k_execute(int num_cycles)
 		m68ki_set_address_error_trap(); /* auto-disable (see m68kcpu.h) */
 
 		/* Main loop.  Keep going until we run out of clock cycles */
+#if M68K_BLOCK_CACHE
+		if(m68ki_block_cache)
+			m68ki_execute_blocks(m68ki_block_cache);
+		else
+#endif /* M68K_BLOCK_CACHE */
 		do
 		{
 			/* Set tracing accodring to T1. (T0 is done inside instruction) */
@@ -569,7 +569,7 @@
 /* Address error */
 #if M68K_EMULATE_ADDRESS_ERROR
 	#include <setjmp.h>
-	extern jmp_buf m68ki_aerr_trap;
+	extern M68K_THREAD_LOCAL jmp_buf m68ki_aerr_trap;
 
 	#define m68ki_set_address_error_trap() \
 		if(setjmp(m68ki_aerr_trap) != 0) \
@@ -934,22 +934,26 @@ typedef struct
 	void (*set_fc_callback)(unsigned int new_fc);     /* Called when the CPU function code changes */
 	void (*instr_hook_callback)(unsigned int pc);     /* Called every instruction cycle prior to execution */
 
+#if M68K_BLOCK_CACHE
+	const unsigned char* code_ram;                    /* RAM of the current block cache: immediates are read from it directly */
+	uint code_ram_size;
+#endif /* M68K_BLOCK_CACHE */
 } m68ki_cpu_core;
 
 
-extern m68ki_cpu_core m68ki_cpu;
-extern sint           m68ki_remaining_cycles;
-extern uint           m68ki_tracing;
+extern M68K_THREAD_LOCAL m68ki_cpu_core m68ki_cpu;
+extern M68K_THREAD_LOCAL sint           m68ki_remaining_cycles;
+extern M68K_THREAD_LOCAL uint           m68ki_tracing;
 extern const uint8    m68ki_shift_8_table[];
 extern const uint16   m68ki_shift_16_table[];
 extern const uint     m68ki_shift_32_table[];
 extern const uint8    m68ki_exception_cycle_table[][256];
-extern uint           m68ki_address_space;
+extern M68K_THREAD_LOCAL uint           m68ki_address_space;
 extern const uint8    m68ki_ea_idx_cycle_table[];
 
-extern uint           m68ki_aerr_address;
-extern uint           m68ki_aerr_write_mode;
-extern uint           m68ki_aerr_fc;
+extern M68K_THREAD_LOCAL uint           m68ki_aerr_address;
+extern M68K_THREAD_LOCAL uint           m68ki_aerr_write_mode;
+extern M68K_THREAD_LOCAL uint           m68ki_aerr_fc;
 
 /* Read data immediately after the program counter */
 INLINE uint m68ki_read_imm_16(void);
@@ -1100,6 +1104,17 @@ INLINE uint m68ki_read_imm_16(void)
 	return result;
 }
 #else
+#if M68K_BLOCK_CACHE
+{
+	const uint address = ADDRESS_68K(REG_PC);
+	if(address + 1 < m68ki_cpu.code_ram_size)
+	{
+		const unsigned char* p = m68ki_cpu.code_ram + address;
+		REG_PC += 2;
+		return (p[0] << 8) | p[1];
+	}
+}
+#endif /* M68K_BLOCK_CACHE */
 	REG_PC += 2;
 	return m68k_read_immediate_16(ADDRESS_68K(REG_PC-2));
 #endif /* M68K_EMULATE_PREFETCH */
@@ -1131,6 +1146,17 @@ INLINE uint m68ki_read_imm_32(void)
 #else
 	m68ki_set_fc(FLAG_S | FUNCTION_CODE_USER_PROGRAM); /* auto-disable (see m68kcpu.h) */
 	m68ki_check_address_error(REG_PC, MODE_READ, FLAG_S | FUNCTION_CODE_USER_PROGRAM); /* auto-disable (see m68kcpu.h) */
+#if M68K_BLOCK_CACHE
+{
+	const uint address = ADDRESS_68K(REG_PC);
+	if(address + 3 < m68ki_cpu.code_ram_size)
+	{
+		const unsigned char* p = m68ki_cpu.code_ram + address;
+		REG_PC += 4;
+		return ((uint)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+}
+#endif /* M68K_BLOCK_CACHE */
 	REG_PC += 4;
 	return m68k_read_immediate_32(ADDRESS_68K(REG_PC-4));
 #endif /* M68K_EMULATE_PREFETCH */
@@ -51,30 +51,48 @@ unsigned long ice24_get_long(unsigned char **p)
   return get24_long(q);
 }
 
-unsigned int ice24_getbits(int len, int *cmdp, int *maskp, unsigned char **p)
+/* bit reader: bits are read MSB first, from bytes read backward.
+ * Up to 8 bits are extracted at once instead of looping bit by bit.
+ * A new byte is only fetched when the current one is empty, because
+ * literal bytes are read from the same backward stream
+ */
+typedef struct
 {
-  int tmp=0;
-  int cmd=*cmdp;
-  int mask=*maskp;
+  unsigned char *src;
+  unsigned int cmd;   /* current byte */
+  int left;           /* bits not read yet in cmd (low bits) */
+} ice24_bitreader;
+
+static const unsigned int ice24_mask[9]={0x00,0x01,0x03,0x07,0x0f,0x1f,0x3f,0x7f,0xff};
+
+static unsigned int ice24_getbit(ice24_bitreader *br)
+{
+  if(br->left==0)
+  {
+    br->cmd=*--br->src;
+    br->left=8;
+  }
+  br->left--;
+  return (br->cmd>>br->left)&1;
+}
+
+static unsigned int ice24_getbits(int len, ice24_bitreader *br)
+{
+  unsigned int res=0;
   while(len>0)
   {
-    tmp+=tmp;
-    mask>>=1;
-    if(mask==0)
-    {
-      *p-=1;
-      cmd=**p;
-      mask=0x80;
-    }
-    if(cmd&mask)
+    int take;
+    if(br->left==0)
     {
-      tmp+=1;
+      br->cmd=*--br->src;
+      br->left=8;
     }
-    len--;
+    take=(len<br->left)?len:br->left;
+    br->left-=take;
+    len-=take;
+    res=(res<<take)|((br->cmd>>br->left)&ice24_mask[take]);
   }
-  *cmdp=cmd;
-  *maskp=mask;
-  return tmp;
+  return res;
 }
 
 int ice_24_header(unsigned char *src)
@@ -95,8 +113,7 @@ long ice_24_origsize(unsigned char *src)
 long ice_24_depack(unsigned char *src, unsigned char *dst)
 { /* Ice! V 2.4 depacker */
   unsigned char *p;
-  int cmd;
-  int mask=0;
+  ice24_bitreader br;
   long orig_size;
   if(!ice_24_header(src))
   { /* No 'Ice!' header */
@@ -104,36 +121,39 @@ long ice_24_depack(unsigned char *src, unsigned char *dst)
   }
   orig_size=ice_24_origsize(src); /* orig size */
   p=dst+orig_size;
-  src+=ice_24_packedsize(src); /* packed size */
-  ice24_getbits(1, &cmd, &mask, &src); /* init cmd */
+  br.src=src+ice_24_packedsize(src); /* packed size */
+  br.cmd=*--br.src; /* init cmd */
+  br.left=8;
   /* Ice has an init problem, the LSB in cmd that is set is _NOT_ valid
    * reaching this bit is a sign to reload the cmd data (4 bytes)
    * as the msb bit is always set there are always 2 bits set in the cmd
    * block
    */
   { /* fix reload */
-    mask=0x80;
-    while(!(cmd&1))
+    while((br.left>0)&&!(br.cmd&1))
     { /* dump all 0 bits */
-      cmd>>=1;
-      mask>>=1;
+      br.cmd>>=1;
+      br.left--;
+    }
+    if(br.left>0)
+    { /* dump one 1 bit */
+      br.cmd>>=1;
+      br.left--;
     }
-    /* dump one 1 bit */
-    cmd>>=1;
   }
   for(;;)
   {
-    if(ice24_getbits(1, &cmd, &mask, &src))
+    if(ice24_getbit(&br))
     { /* literal */
-      const int lenbits[]={1,2,2,3,8,15};
-      const long int maxlen[]={1,3,3,7,255,32768L};
-      const int offset[]={1,2,5,8,15,270};
+      static const int lenbits[]={1,2,2,3,8,15};
+      static const long int maxlen[]={1,3,3,7,255,32768L};
+      static const int offset[]={1,2,5,8,15,270};
       int tablepos=-1;
       long int len;
       do
       {
         tablepos++;
-        len=ice24_getbits(lenbits[tablepos], &cmd, &mask, &src);
+        len=ice24_getbits(lenbits[tablepos], &br);
       }
       while(len==maxlen[tablepos]);
       len+=offset[tablepos];
@@ -143,7 +163,7 @@ long ice_24_depack(unsigned char *src, unsigned char *dst)
       }
       while(len>0)
       {
-        *--p=*--src;
+        *--p=*--br.src;
         len--;
       }
       if(p<=dst)
@@ -154,12 +174,12 @@ long ice_24_depack(unsigned char *src, unsigned char *dst)
     /* no else here, always a sld after a literal */
     { /* sld */
       unsigned char* q;
-      const int extra_bits[]={0,0,1,2,10};
-      const int offset[]={0,1,2,4,8};
+      static const int extra_bits[]={0,0,1,2,10};
+      static const int offset[]={0,1,2,4,8};
       int len;
       int pos=0;
       int tablepos=0;
-      while(ice24_getbits(1, &cmd, &mask, &src))
+      while(ice24_getbit(&br))
       {
         tablepos++;
         if(tablepos==4)
@@ -167,13 +187,13 @@ long ice_24_depack(unsigned char *src, unsigned char *dst)
           break;
         }
       }
-      len=offset[tablepos]+ice24_getbits(extra_bits[tablepos], &cmd, &mask, &src);
+      len=offset[tablepos]+ice24_getbits(extra_bits[tablepos], &br);
       if(len)
       {
-        const int extra_bits[]={8,5,12};
-        const int offset[]={32,0,288};
+        static const int extra_bits[]={8,5,12};
+        static const int offset[]={32,0,288};
         int tablepos=0;
-        while(ice24_getbits(1, &cmd, &mask, &src))
+        while(ice24_getbit(&br))
         {
           tablepos++;
           if(tablepos==2)
@@ -181,7 +201,7 @@ long ice_24_depack(unsigned char *src, unsigned char *dst)
             break;
           }
         }
-        pos=offset[tablepos]+ice24_getbits(extra_bits[tablepos], &cmd, &mask, &src);
+        pos=offset[tablepos]+ice24_getbits(extra_bits[tablepos], &br);
         if(pos!=0)
         {
           pos+=len;
@@ -189,13 +209,13 @@ long ice_24_depack(unsigned char *src, unsigned char *dst)
       }
       else
       {
-        if(ice24_getbits(1, &cmd, &mask, &src))
+        if(ice24_getbit(&br))
         {
-          pos=64+ice24_getbits(9, &cmd, &mask, &src);
+          pos=64+ice24_getbits(9, &br);
         }
         else
         {
-          pos=ice24_getbits(6, &cmd, &mask, &src);
+          pos=ice24_getbits(6, &br);
         }
       }
       len+=2;
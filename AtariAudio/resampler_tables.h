@@ -0,0 +1,78 @@
+/*--------------------------------------------------------------------
+	Atari Audio Library
+	Small & accurate ATARI-ST audio emulation
+	Arnaud Carré aka Leonard/Oxygene
+	@leonard_coder
+--------------------------------------------------------------------*/
+#pragma once
+
+// Resampler low pass kernel: Kaiser (beta=7) windowed sinc, cutoff 0.45, from -8 to +8 samples (of the lowest rate)
+// 64 entries per sample, peak scaled to 32767
+static const int16_t s_resamplerKernel[8*64*2+1] =
+{
+	-5,-5,-5,-5,-5,-4,-4,-4,-3,-3,-2,-2,-1,-1,0,1,
+	1,2,3,4,5,6,7,8,9,11,12,13,15,16,17,19,
+	20,22,23,25,26,28,30,31,33,34,36,37,39,40,42,43,
+	45,46,47,48,49,50,51,52,53,53,54,54,54,54,54,54,
+	53,53,52,51,50,49,47,46,44,42,40,37,34,32,29,25,
+	22,18,14,10,6,2,-3,-8,-13,-18,-23,-29,-34,-40,-46,-52,
+	-58,-64,-71,-77,-83,-90,-96,-103,-109,-116,-122,-128,-135,-141,-147,-153,
+	-158,-164,-169,-175,-179,-184,-189,-193,-197,-200,-203,-206,-208,-210,-212,-213,
+	-214,-214,-213,-213,-211,-209,-207,-204,-201,-196,-192,-186,-181,-174,-167,-159,
+	-151,-142,-133,-123,-112,-101,-89,-77,-64,-50,-36,-22,-7,9,24,41,
+	57,74,92,109,127,145,164,182,201,220,238,257,276,294,313,331,
+	349,367,384,402,418,434,450,465,480,494,507,519,531,542,552,560,
+	568,575,581,586,589,592,593,592,591,588,584,579,572,563,554,542,
+	530,516,500,483,464,444,423,400,376,350,323,294,264,233,201,167,
+	132,96,60,22,-17,-57,-98,-139,-181,-224,-267,-311,-355,-400,-444,-489,
+	-533,-578,-622,-666,-710,-753,-795,-837,-878,-918,-957,-995,-1031,-1067,-1100,-1133,
+	-1163,-1192,-1219,-1243,-1266,-1287,-1305,-1321,-1335,-1346,-1354,-1360,-1363,-1363,-1360,-1355,
+	-1346,-1335,-1320,-1302,-1281,-1257,-1230,-1200,-1166,-1129,-1089,-1046,-1000,-951,-898,-843,
+	-785,-724,-660,-593,-523,-451,-377,-300,-221,-140,-57,29,115,204,294,385,
+	477,570,664,759,854,949,1044,1139,1234,1328,1421,1513,1604,1693,1781,1867,
+	1951,2032,2111,2188,2261,2331,2397,2461,2520,2575,2626,2673,2715,2752,2785,2812,
+	2834,2850,2861,2867,2866,2860,2847,2828,2803,2772,2734,2690,2639,2582,2518,2448,
+	2371,2288,2198,2102,1999,1890,1775,1654,1526,1393,1254,1110,960,805,645,480,
+	311,138,-40,-221,-406,-594,-785,-978,-1173,-1371,-1570,-1770,-1970,-2172,-2373,-2573,
+	-2773,-2972,-3169,-3364,-3556,-3746,-3932,-4114,-4292,-4465,-4632,-4795,-4951,-5100,-5243,-5378,
+	-5505,-5624,-5734,-5835,-5927,-6008,-6079,-6139,-6188,-6226,-6251,-6265,-6266,-6254,-6228,-6190,
+	-6137,-6071,-5990,-5895,-5785,-5660,-5521,-5366,-5196,-5010,-4809,-4593,-4361,-4113,-3850,-3571,
+	-3277,-2967,-2642,-2302,-1947,-1577,-1192,-793,-379,48,489,944,1411,1891,2384,2888,
+	3404,3931,4468,5016,5573,6139,6714,7297,7887,8484,9088,9697,10311,10929,11551,12177,
+	12804,13434,14064,14695,15325,15955,16582,17208,17830,18448,19061,19669,20271,20866,21454,22034,
+	22604,23166,23717,24257,24786,25302,25806,26296,26772,27234,27680,28111,28525,28923,29304,29666,
+	30011,30336,30643,30930,31198,31445,31672,31879,32064,32228,32370,32491,32590,32668,32723,32756,
+	32767,32756,32723,32668,32590,32491,32370,32228,32064,31879,31672,31445,31198,30930,30643,30336,
+	30011,29666,29304,28923,28525,28111,27680,27234,26772,26296,25806,25302,24786,24257,23717,23166,
+	22604,22034,21454,20866,20271,19669,19061,18448,17830,17208,16582,15955,15325,14695,14064,13434,
+	12804,12177,11551,10929,10311,9697,9088,8484,7887,7297,6714,6139,5573,5016,4468,3931,
+	3404,2888,2384,1891,1411,944,489,48,-379,-793,-1192,-1577,-1947,-2302,-2642,-2967,
+	-3277,-3571,-3850,-4113,-4361,-4593,-4809,-5010,-5196,-5366,-5521,-5660,-5785,-5895,-5990,-6071,
+	-6137,-6190,-6228,-6254,-6266,-6265,-6251,-6226,-6188,-6139,-6079,-6008,-5927,-5835,-5734,-5624,
+	-5505,-5378,-5243,-5100,-4951,-4795,-4632,-4465,-4292,-4114,-3932,-3746,-3556,-3364,-3169,-2972,
+	-2773,-2573,-2373,-2172,-1970,-1770,-1570,-1371,-1173,-978,-785,-594,-406,-221,-40,138,
+	311,480,645,805,960,1110,1254,1393,1526,1654,1775,1890,1999,2102,2198,2288,
+	2371,2448,2518,2582,2639,2690,2734,2772,2803,2828,2847,2860,2866,2867,2861,2850,
+	2834,2812,2785,2752,2715,2673,2626,2575,2520,2461,2397,2331,2261,2188,2111,2032,
+	1951,1867,1781,1693,1604,1513,1421,1328,1234,1139,1044,949,854,759,664,570,
+	477,385,294,204,115,29,-57,-140,-221,-300,-377,-451,-523,-593,-660,-724,
+	-785,-843,-898,-951,-1000,-1046,-1089,-1129,-1166,-1200,-1230,-1257,-1281,-1302,-1320,-1335,
+	-1346,-1355,-1360,-1363,-1363,-1360,-1354,-1346,-1335,-1321,-1305,-1287,-1266,-1243,-1219,-1192,
+	-1163,-1133,-1100,-1067,-1031,-995,-957,-918,-878,-837,-795,-753,-710,-666,-622,-578,
+	-533,-489,-444,-400,-355,-311,-267,-224,-181,-139,-98,-57,-17,22,60,96,
+	132,167,201,233,264,294,323,350,376,400,423,444,464,483,500,516,
+	530,542,554,563,572,579,584,588,591,592,593,592,589,586,581,575,
+	568,560,552,542,531,519,507,494,480,465,450,434,418,402,384,367,
+	349,331,313,294,276,257,238,220,201,182,164,145,127,109,92,74,
+	57,41,24,9,-7,-22,-36,-50,-64,-77,-89,-101,-112,-123,-133,-142,
+	-151,-159,-167,-174,-181,-186,-192,-196,-201,-204,-207,-209,-211,-213,-213,-214,
+	-214,-213,-212,-210,-208,-206,-203,-200,-197,-193,-189,-184,-179,-175,-169,-164,
+	-158,-153,-147,-141,-135,-128,-122,-116,-109,-103,-96,-90,-83,-77,-71,-64,
+	-58,-52,-46,-40,-34,-29,-23,-18,-13,-8,-3,2,6,10,14,18,
+	22,25,29,32,34,37,40,42,44,46,47,49,50,51,52,53,
+	53,54,54,54,54,54,54,53,53,52,51,50,49,48,47,46,
+	45,43,42,40,39,37,36,34,33,31,30,28,26,25,23,22,
+	20,19,17,16,15,13,12,11,9,8,7,6,5,4,3,2,
+	1,1,0,-1,-1,-2,-2,-3,-3,-4,-4,-4,-5,-5,-5,-5,
+	-5,
+};
@@ -86,3 +86,73 @@ static const uint32_t	s_ym2149LogLevels[32] =
 	kFullVolume(9741),kFullVolume(11584),kFullVolume(13776),kFullVolume(16383),
 	kFullVolume(19483),kFullVolume(23169),kFullVolume(27553),kFullVolume(32767)
 };
+
+// band limited step kernel (Blackman windowed sinc, cutoff 0.4*host rate) used by YM band limited output mode
+// 64 sub-sample phases of 32 taps, each phase sums exactly to 1<<13 so the integrated output never drifts
+static const int16_t s_ymBlepKernel[64][32] =
+{
+	{ 0,-1,3,-1,-7,24,-43,46,-10,-78,204,-311,310,-83,-585,4627,4629,-585,-83,310,-311,204,-78,-10,46,-43,24,-7,-1,3,-1,0 },
+	{ 0,-1,3,-1,-8,24,-42,43,-6,-83,206,-306,294,-53,-625,4549,4707,-542,-112,326,-315,201,-74,-14,48,-44,24,-7,-2,3,-1,0 },
+	{ 0,-1,2,-1,-8,25,-41,41,-2,-87,207,-301,278,-24,-664,4468,4782,-497,-142,341,-319,198,-69,-18,50,-44,24,-6,-2,3,-1,0 },
+	{ 0,-1,2,0,-8,25,-41,39,2,-92,209,-295,261,4,-701,4385,4859,-450,-172,356,-323,195,-64,-22,52,-45,23,-6,-2,3,-1,0 },
+	{ 0,-1,2,0,-9,25,-40,36,6,-96,210,-289,245,32,-735,4301,4928,-401,-202,371,-326,192,-58,-26,55,-45,23,-5,-3,3,-1,0 },
+	{ 0,-1,2,0,-9,25,-39,34,10,-99,210,-283,228,59,-768,4216,5002,-351,-233,385,-328,188,-53,-31,57,-45,22,-5,-3,3,-1,0 },
+	{ 0,-1,2,0,-10,25,-38,31,14,-103,211,-276,211,86,-798,4129,5069,-298,-263,399,-330,184,-47,-35,59,-46,22,-4,-3,3,-1,0 },
+	{ 0,-1,2,1,-10,25,-37,29,18,-106,211,-269,194,113,-827,4041,5134,-243,-294,412,-332,180,-42,-39,61,-46,21,-3,-4,4,-1,0 },
+	{ 0,-1,2,1,-10,25,-36,26,21,-110,210,-261,176,139,-853,3951,5201,-186,-324,425,-333,175,-36,-43,62,-46,21,-3,-4,4,-1,0 },
+	{ 0,-1,1,1,-10,25,-35,24,25,-113,210,-253,159,164,-878,3861,5263,-127,-355,437,-334,170,-30,-47,64,-46,20,-2,-4,4,-1,0 },
+	{ 0,-1,1,2,-11,25,-34,21,29,-115,209,-245,142,189,-900,3770,5322,-67,-385,449,-334,164,-24,-51,66,-46,20,-2,-5,4,-1,0 },
+	{ 0,-1,1,2,-11,24,-33,19,32,-118,207,-237,125,213,-920,3678,5381,-4,-416,460,-333,159,-18,-56,68,-46,19,-1,-5,4,-1,0 },
+	{ 0,-1,1,2,-11,24,-31,16,35,-120,206,-228,107,236,-939,3585,5437,60,-446,471,-332,152,-11,-60,69,-46,18,0,-5,4,-1,0 },
+	{ 0,-1,1,2,-11,24,-30,14,39,-123,204,-219,90,259,-955,3491,5491,126,-476,481,-331,146,-5,-64,71,-46,17,0,-6,4,-1,0 },
+	{ 0,-1,1,2,-11,24,-29,11,42,-124,202,-210,73,280,-970,3397,5541,194,-506,490,-328,139,2,-68,72,-46,17,1,-6,4,-1,0 },
+	{ 0,-1,1,3,-12,23,-28,9,45,-126,199,-200,56,302,-983,3302,5589,264,-535,499,-326,132,8,-72,73,-45,16,2,-6,4,-1,0 },
+	{ 0,-1,1,3,-12,23,-26,6,48,-128,196,-191,39,322,-993,3206,5634,336,-564,507,-322,125,15,-75,75,-45,15,2,-7,4,-1,0 },
+	{ 0,-1,1,3,-12,23,-25,4,50,-129,193,-181,22,341,-1002,3110,5680,409,-593,514,-319,117,21,-79,76,-44,14,3,-7,4,-1,0 },
+	{ 0,-1,0,3,-12,22,-24,2,53,-130,190,-171,5,360,-1009,3014,5718,484,-621,521,-314,110,28,-83,77,-44,13,4,-7,5,-1,0 },
+	{ 0,-1,0,3,-12,22,-22,-1,56,-131,186,-161,-11,378,-1015,2918,5756,560,-648,527,-309,102,35,-87,77,-43,12,5,-8,5,-1,0 },
+	{ 0,-1,0,4,-12,21,-21,-3,58,-131,183,-150,-27,395,-1018,2821,5789,638,-675,532,-304,93,42,-90,78,-42,11,5,-8,5,-1,0 },
+	{ 0,-1,0,4,-12,21,-19,-6,60,-132,179,-140,-43,411,-1020,2724,5825,717,-702,536,-298,85,48,-94,79,-42,10,6,-8,5,-1,0 },
+	{ 0,-1,0,4,-12,20,-18,-8,63,-132,174,-130,-59,426,-1020,2627,5856,798,-727,540,-292,76,55,-97,79,-41,9,7,-9,5,-1,0 },
+	{ 0,0,0,4,-12,20,-17,-10,65,-132,170,-119,-75,441,-1018,2531,5879,880,-752,543,-284,67,62,-100,80,-40,7,7,-9,5,-1,0 },
+	{ 0,0,0,4,-12,19,-15,-12,67,-132,165,-108,-90,454,-1015,2434,5905,964,-777,545,-277,57,69,-103,80,-39,6,8,-9,5,-1,0 },
+	{ 0,0,0,4,-12,19,-14,-14,69,-131,160,-98,-105,466,-1010,2337,5926,1049,-800,546,-269,48,75,-106,80,-37,5,9,-9,5,-1,0 },
+	{ 0,0,0,4,-12,18,-12,-16,70,-131,155,-87,-119,478,-1004,2241,5945,1135,-822,546,-260,38,82,-109,80,-36,4,10,-10,5,-1,0 },
+	{ 0,0,0,4,-12,17,-11,-18,72,-130,150,-76,-133,489,-996,2145,5962,1222,-844,545,-251,28,89,-112,80,-35,3,10,-10,5,-1,0 },
+	{ 0,0,-1,5,-12,17,-10,-20,73,-129,144,-65,-147,499,-987,2050,5974,1311,-864,544,-241,18,95,-114,80,-34,1,11,-10,5,-1,0 },
+	{ 0,0,-1,5,-11,16,-8,-22,75,-128,138,-55,-160,507,-976,1955,5985,1400,-884,541,-231,8,102,-117,79,-32,0,12,-10,5,-1,0 },
+	{ 0,0,-1,5,-11,15,-7,-24,76,-126,133,-44,-173,515,-964,1861,5991,1490,-902,538,-220,-2,108,-119,79,-31,-1,13,-11,5,-1,0 },
+	{ 0,0,-1,5,-11,15,-5,-26,77,-125,127,-33,-186,522,-950,1767,5995,1582,-919,534,-209,-12,114,-121,78,-29,-3,13,-11,5,-1,0 },
+	{ 0,0,-1,5,-11,14,-4,-28,78,-123,121,-23,-198,528,-935,1674,5998,1674,-935,528,-198,-23,121,-123,78,-28,-4,14,-11,5,-1,0 },
+	{ 0,0,-1,5,-11,13,-3,-29,78,-121,114,-12,-209,534,-919,1582,5995,1767,-950,522,-186,-33,127,-125,77,-26,-5,15,-11,5,-1,0 },
+	{ 0,0,-1,5,-11,13,-1,-31,79,-119,108,-2,-220,538,-902,1490,5991,1861,-964,515,-173,-44,133,-126,76,-24,-7,15,-11,5,-1,0 },
+	{ 0,0,-1,5,-10,12,0,-32,79,-117,102,8,-231,541,-884,1400,5985,1955,-976,507,-160,-55,138,-128,75,-22,-8,16,-11,5,-1,0 },
+	{ 0,0,-1,5,-10,11,1,-34,80,-114,95,18,-241,544,-864,1311,5974,2050,-987,499,-147,-65,144,-129,73,-20,-10,17,-12,5,-1,0 },
+	{ 0,0,-1,5,-10,10,3,-35,80,-112,89,28,-251,545,-844,1222,5962,2145,-996,489,-133,-76,150,-130,72,-18,-11,17,-12,4,0,0 },
+	{ 0,0,-1,5,-10,10,4,-36,80,-109,82,38,-260,546,-822,1135,5945,2241,-1004,478,-119,-87,155,-131,70,-16,-12,18,-12,4,0,0 },
+	{ 0,0,-1,5,-9,9,5,-37,80,-106,75,48,-269,546,-800,1049,5926,2337,-1010,466,-105,-98,160,-131,69,-14,-14,19,-12,4,0,0 },
+	{ 0,0,-1,5,-9,8,6,-39,80,-103,69,57,-277,545,-777,964,5905,2434,-1015,454,-90,-108,165,-132,67,-12,-15,19,-12,4,0,0 },
+	{ 0,0,-1,5,-9,7,7,-40,80,-100,62,67,-284,543,-752,880,5879,2531,-1018,441,-75,-119,170,-132,65,-10,-17,20,-12,4,0,0 },
+	{ 0,0,-1,5,-9,7,9,-41,79,-97,55,76,-292,540,-727,798,5856,2627,-1020,426,-59,-130,174,-132,63,-8,-18,20,-12,4,0,-1 },
+	{ 0,0,-1,5,-8,6,10,-42,79,-94,48,85,-298,536,-702,717,5825,2724,-1020,411,-43,-140,179,-132,60,-6,-19,21,-12,4,0,-1 },
+	{ 0,0,-1,5,-8,5,11,-42,78,-90,42,93,-304,532,-675,638,5789,2821,-1018,395,-27,-150,183,-131,58,-3,-21,21,-12,4,0,-1 },
+	{ 0,0,-1,5,-8,5,12,-43,77,-87,35,102,-309,527,-648,560,5756,2918,-1015,378,-11,-161,186,-131,56,-1,-22,22,-12,3,0,-1 },
+	{ 0,0,-1,5,-7,4,13,-44,77,-83,28,110,-314,521,-621,484,5718,3014,-1009,360,5,-171,190,-130,53,2,-24,22,-12,3,0,-1 },
+	{ 0,0,-1,4,-7,3,14,-44,76,-79,21,117,-319,514,-593,409,5680,3110,-1002,341,22,-181,193,-129,50,4,-25,23,-12,3,1,-1 },
+	{ 0,0,-1,4,-7,2,15,-45,75,-75,15,125,-322,507,-564,336,5634,3206,-993,322,39,-191,196,-128,48,6,-26,23,-12,3,1,-1 },
+	{ 0,0,-1,4,-6,2,16,-45,73,-72,8,132,-326,499,-535,264,5589,3302,-983,302,56,-200,199,-126,45,9,-28,23,-12,3,1,-1 },
+	{ 0,0,-1,4,-6,1,17,-46,72,-68,2,139,-328,490,-506,194,5541,3397,-970,280,73,-210,202,-124,42,11,-29,24,-11,2,1,-1 },
+	{ 0,0,-1,4,-6,0,17,-46,71,-64,-5,146,-331,481,-476,126,5491,3491,-955,259,90,-219,204,-123,39,14,-30,24,-11,2,1,-1 },
+	{ 0,0,-1,4,-5,0,18,-46,69,-60,-11,152,-332,471,-446,60,5437,3585,-939,236,107,-228,206,-120,35,16,-31,24,-11,2,1,-1 },
+	{ 0,0,-1,4,-5,-1,19,-46,68,-56,-18,159,-333,460,-416,-4,5381,3678,-920,213,125,-237,207,-118,32,19,-33,24,-11,2,1,-1 },
+	{ 0,0,-1,4,-5,-2,20,-46,66,-51,-24,164,-334,449,-385,-67,5322,3770,-900,189,142,-245,209,-115,29,21,-34,25,-11,2,1,-1 },
+	{ 0,0,-1,4,-4,-2,20,-46,64,-47,-30,170,-334,437,-355,-127,5263,3861,-878,164,159,-253,210,-113,25,24,-35,25,-10,1,1,-1 },
+	{ 0,0,-1,4,-4,-3,21,-46,62,-43,-36,175,-333,425,-324,-186,5201,3951,-853,139,176,-261,210,-110,21,26,-36,25,-10,1,2,-1 },
+	{ 0,0,-1,4,-4,-3,21,-46,61,-39,-42,180,-332,412,-294,-243,5134,4041,-827,113,194,-269,211,-106,18,29,-37,25,-10,1,2,-1 },
+	{ 0,0,-1,3,-3,-4,22,-46,59,-35,-47,184,-330,399,-263,-298,5069,4129,-798,86,211,-276,211,-103,14,31,-38,25,-10,0,2,-1 },
+	{ 0,0,-1,3,-3,-5,22,-45,57,-31,-53,188,-328,385,-233,-351,5002,4216,-768,59,228,-283,210,-99,10,34,-39,25,-9,0,2,-1 },
+	{ 0,0,-1,3,-3,-5,23,-45,55,-26,-58,192,-326,371,-202,-401,4928,4301,-735,32,245,-289,210,-96,6,36,-40,25,-9,0,2,-1 },
+	{ 0,0,-1,3,-2,-6,23,-45,52,-22,-64,195,-323,356,-172,-450,4859,4385,-701,4,261,-295,209,-92,2,39,-41,25,-8,0,2,-1 },
+	{ 0,0,-1,3,-2,-6,24,-44,50,-18,-69,198,-319,341,-142,-497,4782,4468,-664,-24,278,-301,207,-87,-2,41,-41,25,-8,-1,2,-1 },
+	{ 0,0,-1,3,-2,-7,24,-44,48,-14,-74,201,-315,326,-112,-542,4707,4549,-625,-53,294,-306,206,-83,-6,43,-42,24,-8,-1,3,-1 },
+};
@@ -10,27 +10,44 @@
 #include "ym2149c.h"
 #include "ym2149_tables.h"
 
-static uint32_t sRndSeed = 1;
-uint16_t stdLibRand()
-{
-	sRndSeed = sRndSeed*214013+2531011;
-	return uint16_t((sRndSeed >> 16) & 0x7fff);
-}
+// Tone edge flip-flops power up in an unknown state on the real chip. Emulation always starts with voices A & B
+// high and C low (what the first reset of a process used to draw), so a render never depends on what ran before
+static const uint32_t kPowerOnToneEdges = (0x1f << 0) | (0x1f << 5);
 
-void	Ym2149c::Reset(uint32_t hostReplayRate, uint32_t ymClock)
+void	Ym2149c::Reset(uint32_t hostReplayRate, uint32_t ymClock, OutputMode mode, StereoPanning panning)
 {
 	for (int v = 0; v < 3; v++)
 	{
 		m_toneCounter[v] = 0;
 		m_tonePeriod[v] = 0;
 	}
-	m_toneEdges = (stdLibRand()&((1<<10)|(1<<5)|(1<<0)))*0x1f;		// YM internal edge state are un-predictable
+	m_toneEdges = kPowerOnToneEdges;
 	m_insideTimerIrq = false;
+	for (int v = 0; v < 3; v++)
+		m_edgeNeedReset[v] = false;
 	m_hostReplayRate = hostReplayRate;
 	m_ymClockOneEighth = ymClock/8;
-	m_resamplingDividor = (hostReplayRate << 12) / m_ymClockOneEighth;
+	assert(hostReplayRate <= m_ymClockOneEighth);		// higher rates should use an internal rate & resampling (see SndhFile::SetInternalRate)
 	m_noiseRndRack = 1;
+	m_noiseCounter = 0;
+	m_currentNoiseMask = 0;
 	m_noiseHalf = 0;
+	m_outputMode = mode;
+	m_panning = panning;
+	m_voiceOutput = false;
+
+	// side voices are also heard at half level in the other channel, center voice is full level in both
+	static const uint32_t s_panGains[3][2][3] =
+	{
+		{ { 256,256,256 },{ 256,256,256 } },		// mono
+		{ { 256,256,128 },{ 128,256,256 } },		// ABC
+		{ { 256,128,256 },{ 128,256,256 } },		// ACB
+	};
+	for (int c = 0; c < 2; c++)
+		for (int v = 0; v < 3; v++)
+			m_panGain[c][v] = s_panGains[panning][c][v];
+	m_blepTime = 0;
+	m_blepSyncTime = 0;
 	for (int r=0;r<14;r++)
 		WriteReg(r, (7==r)?0x3f:0);
 	m_selectedReg = 0;
@@ -38,10 +55,38 @@ void	Ym2149c::Reset(uint32_t hostReplayRate, uint32_t ymClock)
 	m_innerCycle = 0;
 	m_envPos = 0;
 	m_currentDebugThreeVoices = 0;
-	m_dcAdjustPos = 0;
-	m_dcAdjustSum = 0;
-	for (int i=0;i<1<<kDcAdjustHistoryBit;i++)
-		m_dcAdjustBuffer[i] = 0;
+	for (int c = 0; c < kChannelMax; c++)
+	{
+		m_dcAdjustPos[c] = 0;
+		m_dcAdjustSum[c] = 0;
+		for (int i=0;i<1<<kDcAdjustHistoryBit;i++)
+			m_dcAdjustBuffer[c][i] = 0;
+	}
+
+	m_blepPhaseMul = (uint64_t(kBlepPhases) << 32) / m_ymClockOneEighth;
+	m_blepTicksPerSample = m_ymClockOneEighth / hostReplayRate;
+	m_blepTicksRemainder = m_ymClockOneEighth % hostReplayRate;
+	for (int c = 0; c < kChannelMax; c++)
+	{
+		for (int i = 0; i < kBlepTaps; i++)
+			m_blepRing[c][i] = 0;
+		m_blepAccum[c] = 0;
+		m_blepLevel[c] = 0;
+	}
+	m_blepPos = 0;
+	m_blepMask = 0;
+	m_blepNextEvent = 0;
+	m_blepDirty = true;
+	if (kOutputBandLimited == mode)
+	{
+		// start with a dc adjuster already settled on the bias, to avoid a click
+		for (int c = 0; c < kChannelMax; c++)
+		{
+			for (int i = 0; i < 1 << kDcAdjustHistoryBit; i++)
+				m_dcAdjustBuffer[c][i] = kBlepBias;
+			m_dcAdjustSum[c] = kBlepBias << kDcAdjustHistoryBit;
+		}
+	}
 }
 
 void	Ym2149c::WritePort(uint8_t port, uint8_t value)
@@ -56,6 +101,9 @@ void	Ym2149c::WriteReg(int reg, uint8_t value)
 {
 	if ((unsigned int)reg < 14)
 	{
+		if (kOutputBandLimited == m_outputMode)
+			SyncBandLimited();
+
 		static const uint8_t regMask[14] = { 0xff,0x0f,0xff,0x0f,0xff,0x0f,0x1f,0x3f,0x1f,0x1f,0x1f,0xff,0xff,0x0f };
 		m_regs[reg] = value & regMask[reg];
 
@@ -119,15 +167,22 @@ uint8_t Ym2149c::ReadPort(uint8_t port) const
 	return ~0;
 }
 
-int16_t	Ym2149c::dcAdjust(uint16_t v)
+int16_t	Ym2149c::dcAdjust(uint16_t v, int channel)
 {
-	m_dcAdjustSum -= m_dcAdjustBuffer[m_dcAdjustPos];
-	m_dcAdjustSum += v;
-	m_dcAdjustBuffer[m_dcAdjustPos] = v;
-	m_dcAdjustPos++;
-	m_dcAdjustPos &= (1 << kDcAdjustHistoryBit) - 1;
-	int32_t ov = int32_t(v) - int32_t(m_dcAdjustSum >> kDcAdjustHistoryBit);
-	// max amplitude is 15bits (not 16) so dc adjuster should never overshoot
+	uint16_t* buffer = m_dcAdjustBuffer[channel];
+	unsigned int& pos = m_dcAdjustPos[channel];
+	uint32_t& sum = m_dcAdjustSum[channel];
+	sum -= buffer[pos];
+	sum += v;
+	buffer[pos] = v;
+	pos++;
+	pos &= (1 << kDcAdjustHistoryBit) - 1;
+	int32_t ov = int32_t(v) - int32_t(sum >> kDcAdjustHistoryBit);
+	// max amplitude is 15bits (not 16) so dc adjuster should never overshoot (but band limited steps could)
+	if (ov > 32767)
+		ov = 32767;
+	else if (ov < -32768)
+		ov = -32768;
 	return int16_t(ov);
 }
 
@@ -174,9 +229,86 @@ uint16_t Ym2149c::Tick()
 	return vmask;
 }
 
+// 5bits volume of each voice (fixed or envelope), before tone & noise masking
+uint32_t Ym2149c::VoiceLevels() const
+{
+	const uint32_t envLevel = m_pCurrentEnv[m_envPos + 64];
+	uint32_t levels;
+	levels  = ((m_regs[8] & 0x10) ? envLevel : (m_regs[8]<<1)) << 0;
+	levels |= ((m_regs[9] & 0x10) ? envLevel : (m_regs[9]<<1)) << 5;
+	levels |= ((m_regs[10] & 0x10) ? envLevel : (m_regs[10]<<1)) << 10;
+	return levels;
+}
+
 // called at host replay rate ( like 48Khz )
 // internally update YM chip state machine at 250Khz and average output for each host sample
-int16_t Ym2149c::ComputeNextSample(uint32_t* pSampleDebugInfo)
+int16_t Ym2149c::ComputeNextSample(uint32_t* pSampleDebugInfo, int16_t* voices)
+{
+	assert(kPanningMono == m_panning);
+	assert((NULL == voices) || (m_voiceOutput));
+	int16_t out;
+	RenderDispatch<true>(&out, 1, pSampleDebugInfo, voices);
+	return out;
+}
+
+void	Ym2149c::ComputeNextStereoSample(int16_t* out, uint32_t* pSampleDebugInfo, int16_t* voices)
+{
+	assert(kPanningMono != m_panning);
+	assert((NULL == voices) || (m_voiceOutput));
+	RenderDispatch<true>(out, 1, pSampleDebugInfo, voices);
+}
+
+void	Ym2149c::RenderSpan(int16_t* out, int count, int16_t* voices)
+{
+	assert((NULL == voices) == (!m_voiceOutput));
+	RenderDispatch<false>(out, count, NULL, voices);
+}
+
+// Pick the kernel specialized for current output mode, panning and voice output. So the per sample code
+// has no mode test left (and no debug info test in the common kView=false case)
+template <bool kView>
+void	Ym2149c::RenderDispatch(int16_t* out, int count, uint32_t* pSampleDebugInfo, int16_t* voices)
+{
+	int16_t unusedVoices[3];
+	if ((m_voiceOutput) && (NULL == voices))
+	{
+		// dc adjusters and rings are always fed once voice output is enabled
+		assert(1 == count);
+		voices = unusedVoices;
+	}
+
+	const int kernel = ((kOutputBandLimited == m_outputMode) ? 4 : 0) | ((kPanningMono != m_panning) ? 2 : 0) | (m_voiceOutput ? 1 : 0);
+	switch (kernel)
+	{
+	case 0:	RenderKernel<false, false, false, kView>(out, count, pSampleDebugInfo, voices);	break;
+	case 1:	RenderKernel<false, false, true, kView>(out, count, pSampleDebugInfo, voices);	break;
+	case 2:	RenderKernel<false, true, false, kView>(out, count, pSampleDebugInfo, voices);	break;
+	case 3:	RenderKernel<false, true, true, kView>(out, count, pSampleDebugInfo, voices);	break;
+	case 4:	RenderKernel<true, false, false, kView>(out, count, pSampleDebugInfo, voices);	break;
+	case 5:	RenderKernel<true, false, true, kView>(out, count, pSampleDebugInfo, voices);	break;
+	case 6:	RenderKernel<true, true, false, kView>(out, count, pSampleDebugInfo, voices);	break;
+	case 7:	RenderKernel<true, true, true, kView>(out, count, pSampleDebugInfo, voices);	break;
+	}
+}
+
+template <bool kBandLimited, bool kStereo, bool kVoices, bool kView>
+void	Ym2149c::RenderKernel(int16_t* out, int count, uint32_t* pSampleDebugInfo, int16_t* voices)
+{
+	const int channels = kStereo ? 2 : 1;
+	for (int i = 0; i < count; i++)
+	{
+		uint32_t* info = (kView && pSampleDebugInfo) ? pSampleDebugInfo + i : NULL;
+		int16_t* voice = kVoices ? voices + i * 3 : NULL;
+		if (kBandLimited)
+			ComputeNextSampleBandLimited<kStereo, kVoices, kView>(out + i * channels, info, voice);
+		else
+			ComputeNextSampleOversampled<kStereo, kVoices, kView>(out + i * channels, info, voice);
+	}
+}
+
+// write one or two channels, depending on panning
+template <bool kStereo, bool kVoices, bool kView>
+void	Ym2149c::ComputeNextSampleOversampled(int16_t* out, uint32_t* pSampleDebugInfo, int16_t* voices)
 {
 	uint16_t highMask = 0;
 	do
@@ -187,11 +319,7 @@ int16_t Ym2149c::ComputeNextSample(uint32_t* pSampleDebugInfo)
 	while (m_innerCycle < m_ymClockOneEighth);
 	m_innerCycle -= m_ymClockOneEighth;
 
-	const uint32_t envLevel = m_pCurrentEnv[m_envPos + 64];
-	uint32_t levels;
-	levels  = ((m_regs[8] & 0x10) ? envLevel : (m_regs[8]<<1)) << 0;
-	levels |= ((m_regs[9] & 0x10) ? envLevel : (m_regs[9]<<1)) << 5;
-	levels |= ((m_regs[10] & 0x10) ? envLevel : (m_regs[10]<<1)) << 10;
+	uint32_t levels = VoiceLevels();
 	levels &= highMask;
 	assert(levels < 0x8000);
 
@@ -206,11 +334,273 @@ int16_t Ym2149c::ComputeNextSample(uint32_t* pSampleDebugInfo)
 	uint32_t levelB = s_ym2149LogLevels[indexB] >> halfShiftB;
 	uint32_t levelC = s_ym2149LogLevels[indexC] >> halfShiftC;
 
-	int16_t out = dcAdjust(levelA + levelB + levelC);
-	if (pSampleDebugInfo)
+	if (!kStereo)
+	{
+		out[0] = dcAdjust(levelA + levelB + levelC);
+	}
+	else
+	{
+		for (int c = 0; c < 2; c++)
+			out[c] = dcAdjust((levelA * m_panGain[c][0] + levelB * m_panGain[c][1] + levelC * m_panGain[c][2]) >> 8, c);
+	}
+	if (kVoices)
+	{
+		voices[0] = dcAdjust(levelA, kVoiceChannel + 0);
+		voices[1] = dcAdjust(levelB, kVoiceChannel + 1);
+		voices[2] = dcAdjust(levelC, kVoiceChannel + 2);
+	}
+#if ATARI_AUDIO_VIEW_INFO
+	if ((kView) && (pSampleDebugInfo))
 		*pSampleDebugInfo = (s_ViewVolTab[indexA] << 0) | (s_ViewVolTab[indexB] << 8) | (s_ViewVolTab[indexC] << 16);
+#endif
+}
 
-	return out;
+// Advance a chip counter by "ticks" YM cycles, return how many times the counter reached its period
+static uint32_t advanceCounter(uint32_t& counter, uint32_t period, uint32_t ticks)
+{
+	if (0 == ticks)
+		return 0;
+	const uint32_t first = (counter + 1 >= period) ? 1 : period - counter;
+	if (ticks < first)
+	{
+		counter += ticks;
+		return 0;
+	}
+	const uint32_t left = ticks - first;
+	if (period <= 1)
+	{
+		counter = 0;
+		return 1 + left;
+	}
+	if (left < period)		// avoid division in most common case
+	{
+		counter = left;
+		return 1;
+	}
+	counter = left % period;
+	return 1 + left / period;
+}
+
+// Voices setup only changes on register write. Compute what band limited mode needs once here
+void	Ym2149c::UpdateBandLimitedSetup()
+{
+	// voice with period 0 or 1 is a square wave above any host Nyquist freq: output it as half level (like oversampled mode)
+	m_blepForcedOn = 0;
+	for (int v = 0; v < 3; v++)
+	{
+		m_blepHalfShift[v] = (m_tonePeriod[v] > 1) ? 0 : 1;
+		if (m_blepHalfShift[v])
+			m_blepForcedOn |= 0x1f << (v * 5);
+	}
+
+	// only state changes of voices with non zero volume could change the output
+	m_blepAudible = 0;
+	for (int v = 0; v < 3; v++)
+	{
+		uint32_t audible = 0;
+		if (m_regs[8 + v] & 0x10)
+			audible = (1 << v) | (1 << 3);
+		else if (m_regs[8 + v])
+			audible = 1 << v;
+		if (audible)
+		{
+			if ((m_toneMask | m_blepForcedOn) & (1 << (v * 5)))
+				audible &= ~(1 << v);
+			if (0 == (m_noiseMask & (1 << (v * 5))))
+				audible |= 1 << 4;
+		}
+		m_blepAudible |= audible;
+	}
+}
+
+// YM cycles count before the next state change that could change the output level
+uint32_t Ym2149c::TicksToNextEvent() const
+{
+	uint32_t ticks = kBlepNoEvent;
+	for (int v = 0; v < 3; v++)
+	{
+		if (m_blepAudible & (1 << v))
+		{
+			const uint32_t t = (m_toneCounter[v] + 1 >= m_tonePeriod[v]) ? 1 : m_tonePeriod[v] - m_toneCounter[v];
+			if (t < ticks)
+				ticks = t;
+		}
+	}
+
+	if (m_blepAudible & (1 << 3))
+	{
+		const uint32_t t = (m_envCounter + 1 >= m_envPeriod) ? 1 : m_envPeriod - m_envCounter;
+		if (t < ticks)
+			ticks = t;
+	}
+
+	if (m_blepAudible & (1 << 4))
+	{
+		// noise counter only runs every odd YM cycle
+		const uint32_t steps = (m_noiseCounter + 1 >= m_noisePeriod) ? 1 : m_noisePeriod - m_noiseCounter;
+		const uint32_t t = steps * 2 - (m_noiseHalf ? 0 : 1);
+		if (t < ticks)
+			ticks = t;
+	}
+	return ticks;
+}
+
+// Same as calling Tick() "ticks" times, but in constant time (except noise generator)
+void	Ym2149c::Advance(uint32_t ticks)
+{
+	for (int v = 0; v < 3; v++)
+	{
+		if (advanceCounter(m_toneCounter[v], m_tonePeriod[v], ticks) & 1)
+			m_toneEdges ^= 0x1f << (v * 5);
+	}
+
+	const uint32_t envSteps = advanceCounter(m_envCounter, m_envPeriod, ticks);
+	if (envSteps)
+	{
+		m_envPos += int(envSteps);
+		if (m_envPos > 0)
+			m_envPos &= 63;
+	}
+
+	const uint32_t noiseTicks = m_noiseHalf ? (ticks >> 1) : ((ticks + 1) >> 1);
+	m_noiseHalf ^= ticks & 1;
+	uint32_t noiseSteps = advanceCounter(m_noiseCounter, m_noisePeriod, noiseTicks);
+	while (noiseSteps--)
+	{
+		m_currentNoiseMask = ((m_noiseRndRack ^ (m_noiseRndRack >> 2)) & 1) ? ~0 : 0;
+		m_noiseRndRack = (m_noiseRndRack >> 1) | ((m_currentNoiseMask & 1) << 16);
+	}
+}
+
+// Add a level step starting at "innerCycle" position in the current host sample
+// Output is delayed by kBlepTaps/2 samples so the step is centered in the kernel
+void	Ym2149c::AddStep(int channel, uint32_t innerCycle, int32_t delta)
+{
+	const int16_t* kernel = s_ymBlepKernel[(uint64_t(innerCycle) * m_blepPhaseMul) >> 32];
+	const int split = kBlepTaps - m_blepPos;
+	int32_t* ring = m_blepRing[channel] + m_blepPos;
+	for (int i = 0; i < split; i++)
+		ring[i] += delta * kernel[i];
+	ring = m_blepRing[channel] - split;
+	for (int i = split; i < kBlepTaps; i++)
+		ring[i] += delta * kernel[i];
+}
+
+// Bring chip counters up to the current time (should be called before any chip state change)
+void	Ym2149c::SyncBandLimited()
+{
+	Advance(m_blepTime - m_blepSyncTime);
+	m_blepSyncTime = m_blepTime;
+	m_blepDirty = true;
+}
+
+// Output level of the current chip state. Add a band limited step if it changed
+template <bool kStereo, bool kVoices>
+uint32_t Ym2149c::UpdateBandLimitedLevel(uint32_t innerCycle)
+{
+	const uint32_t vmask = (m_toneEdges | m_toneMask | m_blepForcedOn) & (m_currentNoiseMask | m_noiseMask);
+	const uint32_t levels = VoiceLevels() & vmask;
+	const uint32_t levelA = s_ym2149LogLevels[(levels >> 0) & 31] >> m_blepHalfShift[0];
+	const uint32_t levelB = s_ym2149LogLevels[(levels >> 5) & 31] >> m_blepHalfShift[1];
+	const uint32_t levelC = s_ym2149LogLevels[(levels >> 10) & 31] >> m_blepHalfShift[2];
+	if (!kStereo)
+	{
+		const uint32_t level = levelA + levelB + levelC;
+		if (level != m_blepLevel[0])
+		{
+			AddStep(0, innerCycle, int32_t(level) - int32_t(m_blepLevel[0]));
+			m_blepLevel[0] = level;
+		}
+	}
+	else
+	{
+		for (int c = 0; c < 2; c++)
+		{
+			const uint32_t level = (levelA * m_panGain[c][0] + levelB * m_panGain[c][1] + levelC * m_panGain[c][2]) >> 8;
+			if (level != m_blepLevel[c])
+			{
+				AddStep(c, innerCycle, int32_t(level) - int32_t(m_blepLevel[c]));
+				m_blepLevel[c] = level;
+			}
+		}
+	}
+	if (kVoices)
+	{
+		const uint32_t voiceLevels[3] = { levelA, levelB, levelC };
+		for (int v = 0; v < 3; v++)
+		{
+			const int c = kVoiceChannel + v;
+			if (voiceLevels[v] != m_blepLevel[c])
+			{
+				AddStep(c, innerCycle, int32_t(voiceLevels[v]) - int32_t(m_blepLevel[c]));
+				m_blepLevel[c] = voiceLevels[v];
+			}
+		}
+	}
+	return vmask;
+}
+
+// Next output sample of a band limited channel: integrates the steps of this sample position, then clears it
+int16_t	Ym2149c::BandLimitedOutput(int channel)
+{
+	m_blepAccum[channel] += m_blepRing[channel][m_blepPos];
+	m_blepRing[channel][m_blepPos] = 0;
+
+	int32_t v = (m_blepAccum[channel] >> kBlepBits) + int32_t(kBlepBias);
+	if (v < 0)
+		v = 0;
+	else if (v > 0xffff)
+		v = 0xffff;
+	return dcAdjust(uint16_t(v), channel);
+}
+
+// Band limited version of ComputeNextSample. The chip is not ticked at 250Khz: counters are only updated
+// at audible state changes (or register write), and each output level change is written as a band limited step
+template <bool kStereo, bool kVoices, bool kView>
+void	Ym2149c::ComputeNextSampleBandLimited(int16_t* out, uint32_t* pSampleDebugInfo, int16_t* voices)
+{
+	uint32_t highMask = m_blepMask;
+	if (m_blepDirty)
+	{
+		// registers changed since previous sample
+		UpdateBandLimitedSetup();
+		m_blepMask = UpdateBandLimitedLevel<kStereo, kVoices>(m_innerCycle);
+		highMask |= m_blepMask;
+		m_blepNextEvent = m_blepSyncTime + TicksToNextEvent();
+		m_blepDirty = false;
+	}
+
+	// YM cycles in this host sample (same count as the oversampled loop, without division)
+	const uint32_t sampleTicks = m_blepTicksPerSample + ((m_innerCycle < m_blepTicksRemainder) ? 1 : 0);
+	const uint32_t sampleEnd = m_blepTime + sampleTicks;
+	while (int32_t(m_blepNextEvent - sampleEnd) < 0)
+	{
+		Advance(m_blepNextEvent - m_blepSyncTime);
+		m_blepSyncTime = m_blepNextEvent;
+		m_blepMask = UpdateBandLimitedLevel<kStereo, kVoices>(m_innerCycle + (m_blepSyncTime - m_blepTime) * m_hostReplayRate);
+		highMask |= m_blepMask;
+		m_blepNextEvent = m_blepSyncTime + TicksToNextEvent();
+	}
+	m_blepTime = sampleEnd;
+	m_innerCycle += sampleTicks * m_hostReplayRate - m_ymClockOneEighth;
+
+	const int channels = kStereo ? 2 : 1;
+	for (int c = 0; c < channels; c++)
+		out[c] = BandLimitedOutput(c);
+	if (kVoices)
+	{
+		for (int v = 0; v < 3; v++)
+			voices[v] = BandLimitedOutput(kVoiceChannel + v);
+	}
+	m_blepPos = (m_blepPos + 1) & (kBlepTaps - 1);
+
+#if ATARI_AUDIO_VIEW_INFO
+	if ((kView) && (pSampleDebugInfo))
+	{
+		const uint32_t levels = VoiceLevels() & highMask;
+		*pSampleDebugInfo = (s_ViewVolTab[(levels >> 0) & 31] << 0) | (s_ViewVolTab[(levels >> 5) & 31] << 8) | (s_ViewVolTab[(levels >> 10) & 31] << 16);
+	}
+#endif
 }
 
 void	Ym2149c::InsideTimerIrq(bool inside)
@@ -218,6 +608,8 @@ void	Ym2149c::InsideTimerIrq(bool inside)
 	if (!inside)
 	{
 		// when exiting timer IRQ code, do any pending edge reset ( "square-sync" modern fx )
+		if ((kOutputBandLimited == m_outputMode) && (m_edgeNeedReset[0] | m_edgeNeedReset[1] | m_edgeNeedReset[2]))
+			SyncBandLimited();
 		for (int v = 0; v < 3; v++)
 		{
 			if (m_edgeNeedReset[v])
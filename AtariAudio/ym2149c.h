@@ -5,30 +5,75 @@
 	@leonard_coder
 --------------------------------------------------------------------*/
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
+// Set to 0 for headless renders: visualization data is never computed (pSampleDebugInfo & pSampleViewInfo are ignored)
+#ifndef ATARI_AUDIO_VIEW_INFO
+#define	ATARI_AUDIO_VIEW_INFO	1
+#endif
+
 class Ym2149c
 {
 public:
 
-	void	Reset(uint32_t hostReplayRate, uint32_t ymClock = 2000000);
+	enum OutputMode
+	{
+		kOutputOversampled,		// tick the chip at 250Khz and average ticks in each host sample
+		kOutputBandLimited,		// only compute chip state changes, and output them as band limited steps (cost scales with edges count, no aliasing)
+	};
+
+	enum StereoPanning
+	{
+		kPanningMono,			// one output channel
+		kPanningABC,			// voice A on the left, B center, C on the right
+		kPanningACB,			// voice A on the left, C center, B on the right
+	};
+
+	void	Reset(uint32_t hostReplayRate, uint32_t ymClock = 2000000, OutputMode mode = kOutputOversampled, StereoPanning panning = kPanningMono);
 	void	WritePort(uint8_t port, uint8_t value);
 	uint8_t ReadPort(uint8_t port) const;
-	int16_t	ComputeNextSample(uint32_t* pSampleDebugInfo = NULL);
+	int16_t	ComputeNextSample(uint32_t* pSampleDebugInfo = NULL, int16_t* voices = NULL);					// mono panning only
+	void	ComputeNextStereoSample(int16_t* out, uint32_t* pSampleDebugInfo = NULL, int16_t* voices = NULL);	// out[0] is left, out[1] is right
+	void	RenderSpan(int16_t* out, int count, int16_t* voices = NULL);	// "count" samples (interleaved if stereo) without debug info. "voices" gets count*3 levels, required if voice output is enabled
+	int		GetChannelCount() const { return (kPanningMono == m_panning) ? 1 : 2; }
+
+	// Once enabled (right after Reset), "voices" parameter could receive the 3 dc adjusted voice levels (A, B, C, not panned)
+	// Costs extra dc adjusters (and band limited steps per voice in kOutputBandLimited mode)
+	void	EnableVoiceOutput(bool enable) { m_voiceOutput = enable; }
+	bool	IsVoiceOutputEnabled() const { return m_voiceOutput; }
 	void	InsideTimerIrq(bool inside);
 
 private:
 	void	WriteReg(int reg, uint8_t value);
 	uint16_t Tick();
+	uint32_t VoiceLevels() const;
+	template <bool kView> void RenderDispatch(int16_t* out, int count, uint32_t* pSampleDebugInfo, int16_t* voices);
+	template <bool kBandLimited, bool kStereo, bool kVoices, bool kView> void RenderKernel(int16_t* out, int count, uint32_t* pSampleDebugInfo, int16_t* voices);
+	template <bool kStereo, bool kVoices, bool kView> void ComputeNextSampleOversampled(int16_t* out, uint32_t* pSampleDebugInfo, int16_t* voices);
+	template <bool kStereo, bool kVoices, bool kView> void ComputeNextSampleBandLimited(int16_t* out, uint32_t* pSampleDebugInfo, int16_t* voices);
+	int16_t	BandLimitedOutput(int channel);
+	void	UpdateBandLimitedSetup();
+	uint32_t TicksToNextEvent() const;
+	void	Advance(uint32_t ticks);
+	void	SyncBandLimited();
+	template <bool kStereo, bool kVoices> uint32_t UpdateBandLimitedLevel(uint32_t innerCycle);
+	void	AddStep(int channel, uint32_t innerCycle, int32_t delta);
 
 	static const uint32_t kDcAdjustHistoryBit = 11;	// 2048 values (~20ms at 44Khz) 
+	static const int kBlepTaps = 32;			// should match s_ymBlepKernel
+	static const int kBlepPhases = 64;
+	static const int kBlepBits = 13;
+	static const uint32_t kBlepBias = 0x2000;		// band limited steps could undershoot zero, dc adjuster removes that bias
+	static const uint32_t kBlepNoEvent = 1 << 30;
+	static const int kVoiceChannel = 2;			// dc adjuster & band limited ring of voice A, B & C (after left & right)
+	static const int kChannelMax = kVoiceChannel + 3;
 
-	int16_t		dcAdjust(uint16_t v);
+	int16_t		dcAdjust(uint16_t v, int channel = 0);
 
 	int			m_selectedReg;
 	const uint8_t* m_pCurrentEnv;
 	uint32_t	m_ymClockOneEighth;
-	uint32_t	m_resamplingDividor;
 	uint32_t	m_hostReplayRate;
 	uint32_t	m_toneCounter[3];
 	uint32_t	m_tonePeriod[3];
@@ -43,9 +88,9 @@ private:
 	uint32_t	m_noiseMask;
 	uint32_t	m_noiseRndRack;
 	uint32_t	m_currentNoiseMask;
-	uint16_t	m_dcAdjustBuffer[1<<kDcAdjustHistoryBit];
-	unsigned int	m_dcAdjustPos;
-	uint32_t	m_dcAdjustSum;
+	uint16_t	m_dcAdjustBuffer[kChannelMax][1<<kDcAdjustHistoryBit];
+	unsigned int	m_dcAdjustPos[kChannelMax];
+	uint32_t	m_dcAdjustSum[kChannelMax];
 	uint8_t		m_regs[14];
 	uint32_t	m_currentLevel;
 	uint32_t	m_innerCycle;
@@ -53,4 +98,24 @@ private:
 	uint32_t	m_currentDebugThreeVoices;
 	bool		m_insideTimerIrq;
 	bool		m_edgeNeedReset[3];
+
+	OutputMode	m_outputMode;
+	StereoPanning	m_panning;
+	uint32_t	m_panGain[2][3];		// voice gain in each output channel (256 is full level)
+	bool		m_voiceOutput;
+	uint64_t	m_blepPhaseMul;
+	uint32_t	m_blepTicksPerSample;
+	uint32_t	m_blepTicksRemainder;
+	uint32_t	m_blepForcedOn;
+	int			m_blepHalfShift[3];
+	uint32_t	m_blepAudible;			// bits 0-2: audible tone edges, bit 3: envelope, bit 4: noise
+	int32_t		m_blepRing[kChannelMax][kBlepTaps];
+	unsigned int	m_blepPos;
+	int32_t		m_blepAccum[kChannelMax];
+	uint32_t	m_blepLevel[kChannelMax];
+	uint32_t	m_blepMask;
+	uint32_t	m_blepTime;				// YM cycles at current host sample start
+	uint32_t	m_blepSyncTime;			// YM cycles already applied to chip counters
+	uint32_t	m_blepNextEvent;		// YM cycles of next audible state change
+	bool		m_blepDirty;
 };
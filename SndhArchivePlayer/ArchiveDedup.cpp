@@ -0,0 +1,408 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ArchiveDedup.h"
+#include "ZipView.h"
+
+static const int kMaxBucketSize = 256;		// chunk shared by more fingerprints carries no information (long steady notes)
+
+struct HashKey
+{
+	uint64_t	hash;
+	int			item;
+};
+
+struct ChunkKey
+{
+	uint32_t	value;
+	int			item;
+};
+
+static int	bitCount(uint64_t v)
+{
+	int n = 0;
+	for (; v; v &= v - 1)
+		n++;
+	return n;
+}
+
+ArchiveDedup::ArchiveDedup()
+{
+	m_zipView = NULL;
+	m_items = NULL;
+	m_itemCount = 0;
+	m_itemOfZip = NULL;
+	m_zipEntryCount = 0;
+	m_exactLeader = NULL;
+	m_leader = NULL;
+	m_groupSize = NULL;
+	m_exactDuplicateCount = 0;
+	m_nearDuplicateCount = 0;
+	m_running = false;
+	m_ready = false;
+	m_cancel = false;
+	m_itemDone = 0;
+}
+
+ArchiveDedup::~ArchiveDedup()
+{
+	Stop();
+}
+
+void	ArchiveDedup::Start(const ZipView* zipView, const int* zipIndices, int count)
+{
+	Stop();
+	if (count <= 0)
+		return;
+
+	m_zipView = zipView;
+	m_zipEntryCount = zipView->GetEntryCount();
+	m_itemOfZip = (int*)malloc(m_zipEntryCount * sizeof(int));
+	for (int i = 0; i < m_zipEntryCount; i++)
+		m_itemOfZip[i] = -1;
+	m_items = (Item*)calloc(count, sizeof(Item));
+	for (int i = 0; i < count; i++)
+	{
+		m_items[i].zipIndex = zipIndices[i];
+		m_itemOfZip[zipIndices[i]] = i;
+	}
+	m_itemCount = count;
+
+	// background work: half of the cores, so playback prefetch & UI stay responsive
+	int workers = JobSystem::GetHardwareWorkerCount() / 2;
+	if (workers < 1)
+		workers = 1;
+	if (workers > kMaxEmulationWorkers)
+		workers = kMaxEmulationWorkers;
+	m_cancel = false;
+	m_itemDone = 0;
+	m_running = true;
+	m_jobs.RunJobs(this, count, sJobFingerprint, NULL, workers);
+}
+
+void	ArchiveDedup::Stop()
+{
+	if (m_running)
+	{
+		m_cancel = true;
+		m_jobs.Join();
+		m_running = false;
+	}
+	Release();
+}
+
+void	ArchiveDedup::Release()
+{
+	for (int i = 0; i < m_itemCount; i++)
+		free(m_items[i].fingerprints);
+	free(m_items);
+	free(m_itemOfZip);
+	free(m_exactLeader);
+	free(m_leader);
+	free(m_groupSize);
+	m_items = NULL;
+	m_itemCount = 0;
+	m_itemOfZip = NULL;
+	m_zipEntryCount = 0;
+	m_exactLeader = NULL;
+	m_leader = NULL;
+	m_groupSize = NULL;
+	m_exactDuplicateCount = 0;
+	m_nearDuplicateCount = 0;
+	m_zipView = NULL;
+	m_ready = false;
+}
+
+bool	ArchiveDedup::Update()
+{
+	if (m_running)
+	{
+		if (m_jobs.Running())
+			return true;
+		m_jobs.Join();
+		m_running = false;
+		if (!m_cancel)
+		{
+			BuildGroups();
+			m_ready = true;
+		}
+	}
+	return false;
+}
+
+int	ArchiveDedup::GetLeader(int zipIndex, bool exactOnly) const
+{
+	if ((!m_ready) || (zipIndex < 0) || (zipIndex >= m_zipEntryCount) || (m_itemOfZip[zipIndex] < 0))
+		return zipIndex;
+	const int item = m_itemOfZip[zipIndex];
+	return exactOnly ? m_exactLeader[item] : m_leader[item];
+}
+
+int	ArchiveDedup::GetGroupSize(int zipIndex) const
+{
+	if ((!m_ready) || (zipIndex < 0) || (zipIndex >= m_zipEntryCount) || (m_itemOfZip[zipIndex] < 0))
+		return 1;
+	return m_groupSize[m_itemOfZip[zipIndex]];
+}
+
+bool	ArchiveDedup::sJobFingerprint(void* user, int itemId, int workerId)
+{
+	ArchiveDedup* _this = (ArchiveDedup*)user;
+	const bool ret = _this->FingerprintItem(itemId, workerId);
+	_this->m_itemDone++;
+	return ret;
+}
+
+bool	ArchiveDedup::FingerprintItem(int itemId, int workerId)
+{
+	if (m_cancel)
+		return false;
+
+	Item& item = m_items[itemId];
+	int size;
+	void* unpack = m_zipView->ExtractAlloc(item.zipIndex, size);
+	if (NULL == unpack)
+		return false;
+
+	SndhFile& sndh = m_sndhPool.Get(workerId);
+	if (sndh.Load(unpack, size, kRenderRate, true))
+	{
+		// raw data is the depacked image if the file was ICE packed
+		item.imageHash = SndhImage::ContentHash(sndh.GetRawData(), sndh.GetRawDataSize());
+		int count = sndh.GetSubsongCount();
+		if (count > kMaxSubsongs)
+			count = kMaxSubsongs;
+		item.fingerprints = (Fingerprint*)malloc((count ? count : 1) * sizeof(Fingerprint));
+		int16_t* buffer = (int16_t*)malloc((kRenderRate * kFrameMs / 1000) * sizeof(int16_t));
+		for (int s = 0; (s < count) && (!m_cancel); s++)
+		{
+			// a subsong failing to start is compared as a silent one
+			if (!RenderFingerprint(sndh, s + 1, buffer, item.fingerprints[s]))
+			{
+				memset(item.fingerprints[s].bits, 0, sizeof(item.fingerprints[s].bits));
+				item.fingerprints[s].silent = true;
+			}
+		}
+		free(buffer);
+		item.subsongCount = count;
+		item.valid = !m_cancel;
+	}
+	sndh.Unload();
+	free(unpack);
+	return item.valid;
+}
+
+// 2 bits per frame: loudness goes up, and spectral tilt (first difference energy vs signal energy) goes up.
+// Like most audio fingerprints, it only compares a frame with the previous one, so the output level doesn't matter
+bool	ArchiveDedup::RenderFingerprint(SndhFile& sndh, int subSongId, int16_t* buffer, Fingerprint& out)
+{
+	sndh.SetStereoPanning(Ym2149c::kPanningMono);
+	if (!sndh.InitSubSong(subSongId))
+		return false;
+
+	const int frameSamples = int(kRenderRate) * kFrameMs / 1000;
+	for (int f = 0; f < kSkipMs / kFrameMs; f++)
+		sndh.AudioRender(buffer, frameSamples);
+
+	memset(out.bits, 0, sizeof(out.bits));
+	int prev = 0;
+	uint64_t prevLevel = 0;
+	uint64_t prevTilt = 0;
+	uint64_t total = 0;
+	for (int f = 0; f <= kFingerprintWords * 32; f++)
+	{
+		sndh.AudioRender(buffer, frameSamples);
+		uint64_t level = 0;
+		uint64_t tilt = 0;
+		for (int i = 0; i < frameSamples; i++)
+		{
+			const int v = buffer[i];
+			level += uint64_t((v < 0) ? -v : v);
+			tilt += uint64_t((v - prev < 0) ? prev - v : v - prev);
+			prev = v;
+		}
+		if (f > 0)
+		{
+			const int bit = (f - 1) * 2;
+			if (level > prevLevel)
+				out.bits[bit >> 6] |= uint64_t(1) << (bit & 63);
+			if (tilt * prevLevel > prevTilt * level)
+				out.bits[bit >> 6] |= uint64_t(2) << (bit & 63);
+		}
+		prevLevel = level;
+		prevTilt = tilt;
+		total += level;
+	}
+
+	// below 1/2048 of full scale on average
+	out.silent = (total < uint64_t(16) * frameSamples * (kFingerprintWords * 32 + 1));
+	if (out.silent)
+		memset(out.bits, 0, sizeof(out.bits));
+	return true;
+}
+
+bool	ArchiveDedup::IsNearDuplicate(const Item& a, const Item& b) const
+{
+	if ((a.subsongCount != b.subsongCount) || (0 == a.subsongCount))
+		return false;
+	for (int s = 0; s < a.subsongCount; s++)
+	{
+		const Fingerprint& fa = a.fingerprints[s];
+		const Fingerprint& fb = b.fingerprints[s];
+		if (fa.silent != fb.silent)
+			return false;
+		int distance = 0;
+		for (int w = 0; w < kFingerprintWords; w++)
+			distance += bitCount(fa.bits[w] ^ fb.bits[w]);
+		if (distance > kMaxDistance)
+			return false;
+	}
+	return true;
+}
+
+const ArchiveDedup::Fingerprint*	ArchiveDedup::FirstAudible(const Item& item)
+{
+	for (int s = 0; s < item.subsongCount; s++)
+	{
+		if (!item.fingerprints[s].silent)
+			return item.fingerprints + s;
+	}
+	return NULL;
+}
+
+int	ArchiveDedup::FindRoot(int* parent, int item) const
+{
+	while (parent[item] != item)
+	{
+		parent[item] = parent[parent[item]];
+		item = parent[item];
+	}
+	return item;
+}
+
+// root is always the item with the lowest zip index, so it's the group leader
+void	ArchiveDedup::Union(int* parent, int a, int b) const
+{
+	a = FindRoot(parent, a);
+	b = FindRoot(parent, b);
+	if (a == b)
+		return;
+	if (m_items[a].zipIndex < m_items[b].zipIndex)
+		parent[b] = a;
+	else
+		parent[a] = b;
+}
+
+int	ArchiveDedup::fHashSort(const void* arg1, const void* arg2)
+{
+	const HashKey* a = (const HashKey*)arg1;
+	const HashKey* b = (const HashKey*)arg2;
+	if (a->hash != b->hash)
+		return (a->hash < b->hash) ? -1 : 1;
+	return a->item - b->item;
+}
+
+int	ArchiveDedup::fChunkSort(const void* arg1, const void* arg2)
+{
+	const ChunkKey* a = (const ChunkKey*)arg1;
+	const ChunkKey* b = (const ChunkKey*)arg2;
+	if (a->value != b->value)
+		return (a->value < b->value) ? -1 : 1;
+	return a->item - b->item;
+}
+
+void	ArchiveDedup::BuildGroups()
+{
+	int* exactParent = (int*)malloc(m_itemCount * sizeof(int));
+	int* parent = (int*)malloc(m_itemCount * sizeof(int));
+	for (int i = 0; i < m_itemCount; i++)
+	{
+		exactParent[i] = i;
+		parent[i] = i;
+	}
+
+	// exact duplicates: same decoded image
+	HashKey* hashes = (HashKey*)malloc(m_itemCount * sizeof(HashKey));
+	int count = 0;
+	for (int i = 0; i < m_itemCount; i++)
+	{
+		if (m_items[i].valid)
+		{
+			hashes[count].hash = m_items[i].imageHash;
+			hashes[count].item = i;
+			count++;
+		}
+	}
+	qsort(hashes, count, sizeof(HashKey), fHashSort);
+	for (int i = 1; i < count; i++)
+	{
+		if (hashes[i].hash == hashes[i - 1].hash)
+		{
+			Union(exactParent, hashes[i - 1].item, hashes[i].item);
+			Union(parent, hashes[i - 1].item, hashes[i].item);
+		}
+	}
+	free(hashes);
+
+	// near duplicates: candidates share one chunk of the first non silent subsong fingerprint, then all subsongs
+	// are compared. Near duplicates have the same silent subsongs, so both use the same subsong as key
+	ChunkKey* keys = (ChunkKey*)malloc(m_itemCount * sizeof(ChunkKey));
+	for (int c = 0; c < kChunkCount; c++)
+	{
+		count = 0;
+		for (int i = 0; i < m_itemCount; i++)
+		{
+			const Fingerprint* key = m_items[i].valid ? FirstAudible(m_items[i]) : NULL;
+			if (key)
+			{
+				keys[count].value = uint32_t(key->bits[c >> 1] >> ((c & 1) * 32));
+				keys[count].item = i;
+				count++;
+			}
+		}
+		qsort(keys, count, sizeof(ChunkKey), fChunkSort);
+		for (int start = 0; start < count; )
+		{
+			int end = start + 1;
+			while ((end < count) && (keys[end].value == keys[start].value))
+				end++;
+			if (end - start <= kMaxBucketSize)
+			{
+				for (int a = start; a < end; a++)
+				{
+					for (int b = a + 1; b < end; b++)
+					{
+						if ((FindRoot(parent, keys[a].item) != FindRoot(parent, keys[b].item)) &&
+							(IsNearDuplicate(m_items[keys[a].item], m_items[keys[b].item])))
+							Union(parent, keys[a].item, keys[b].item);
+					}
+				}
+			}
+			start = end;
+		}
+	}
+	free(keys);
+
+	m_exactLeader = (int*)malloc(m_itemCount * sizeof(int));
+	m_leader = (int*)malloc(m_itemCount * sizeof(int));
+	m_groupSize = (int*)calloc(m_itemCount, sizeof(int));
+	for (int i = 0; i < m_itemCount; i++)
+		m_groupSize[FindRoot(parent, i)]++;
+	m_exactDuplicateCount = 0;
+	m_nearDuplicateCount = 0;
+	for (int i = 0; i < m_itemCount; i++)
+	{
+		const int exactRoot = FindRoot(exactParent, i);
+		const int root = FindRoot(parent, i);
+		m_exactLeader[i] = m_items[exactRoot].zipIndex;
+		m_leader[i] = m_items[root].zipIndex;
+		if (exactRoot != i)
+			m_exactDuplicateCount++;
+		else if (root != i)
+			m_nearDuplicateCount++;
+	}
+	// group size is known by the root only
+	for (int i = 0; i < m_itemCount; i++)
+		m_groupSize[i] = m_groupSize[FindRoot(parent, i)];
+	free(exactParent);
+	free(parent);
+}
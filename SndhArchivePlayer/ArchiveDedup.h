@@ -0,0 +1,87 @@
+#pragma once
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include "../AtariAudio/AtariAudio.h"
+#include "jobSystem.h"
+#include "SndhWorkerPool.h"
+
+class ZipView;
+
+// Find duplicate archive entries in the background, one SndhFile per job worker. Each entry gets the content
+// hash of its decoded (ICE depacked) image, and each subsong a 256 bits audio fingerprint from a few seconds of
+// headless render. Same image hash is an exact duplicate. Same subsong count with all fingerprints close
+// (hamming distance) is a near duplicate (re-rip, patched driver, ...). Candidate pairs come from a multi-index
+// hash: fingerprints are split in 8 chunks, so two close enough fingerprints always share one chunk
+class ArchiveDedup
+{
+public:
+	ArchiveDedup();
+	~ArchiveDedup();
+
+	void	Start(const ZipView* zipView, const int* zipIndices, int count);		// zipView should stay open until Stop
+	void	Stop();
+	bool	Update();				// call every frame, returns true while running. Groups are built once all entries are done
+
+	bool	IsRunning() const { return m_running; }
+	bool	IsReady() const { return m_ready; }
+	int		GetProgress() const { return m_itemCount ? (m_itemDone * 100) / m_itemCount : 0; }
+	int		GetLeader(int zipIndex, bool exactOnly) const;		// first zip entry of the duplicate group (zipIndex itself if unique or unknown)
+	int		GetGroupSize(int zipIndex) const;					// 1 if unique or unknown
+	int		GetExactDuplicateCount() const { return m_exactDuplicateCount; }
+	int		GetNearDuplicateCount() const { return m_nearDuplicateCount; }
+
+private:
+	static const int kMaxSubsongs = 16;				// sound effect collections: only the first subsongs are compared
+	static const uint32_t kRenderRate = 22050;
+	static const int kSkipMs = 1000;					// drivers often start with a few silent or init ticks
+	static const int kFrameMs = 40;
+	static const int kFingerprintWords = 4;			// 2 bits per frame
+	static const int kChunkCount = kFingerprintWords * 2;
+	static const int kMaxDistance = kChunkCount - 1;	// pigeonhole: at most 7 different bits, one 32 bits chunk is equal
+
+	struct Fingerprint
+	{
+		uint64_t	bits[kFingerprintWords];
+		bool		silent;
+	};
+
+	struct Item
+	{
+		int				zipIndex;
+		bool			valid;
+		uint64_t		imageHash;
+		int				subsongCount;		// fingerprinted ones
+		Fingerprint*	fingerprints;
+	};
+
+	static bool	sJobFingerprint(void* user, int itemId, int workerId);
+	bool	FingerprintItem(int itemId, int workerId);
+	static bool	RenderFingerprint(SndhFile& sndh, int subSongId, int16_t* buffer, Fingerprint& out);
+	bool	IsNearDuplicate(const Item& a, const Item& b) const;
+	static const Fingerprint*	FirstAudible(const Item& item);		// NULL if all subsongs are silent
+	void	BuildGroups();
+	int		FindRoot(int* parent, int item) const;
+	void	Union(int* parent, int a, int b) const;
+	void	Release();
+	static int	fHashSort(const void* arg1, const void* arg2);
+	static int	fChunkSort(const void* arg1, const void* arg2);
+
+	const ZipView*	m_zipView;
+	Item*			m_items;
+	int				m_itemCount;
+	int*			m_itemOfZip;		// zip entry -> item, -1 if not part of the run
+	int				m_zipEntryCount;
+	int*			m_exactLeader;		// per item, zipIndex of the group first entry
+	int*			m_leader;
+	int*			m_groupSize;
+	int				m_exactDuplicateCount;
+	int				m_nearDuplicateCount;
+
+	JobSystem		m_jobs;
+	SndhWorkerPool	m_sndhPool;
+	bool			m_running;
+	bool			m_ready;
+	std::atomic<bool>	m_cancel;
+	std::atomic<int>	m_itemDone;
+};
@@ -1,37 +1,57 @@
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "AsyncSndhStream.h"
 #include "imgui.h"
 #include "WavWriter.h"
+#include "FlacWriter.h"
 
-#pragma	comment(lib,"winmm.lib")
+#ifndef _MAX_PATH
+#define	_MAX_PATH	260
+#endif
 
-AsyncSndhStream::AsyncSndhStream()
+static const Ym2149c::StereoPanning kYmPanning = Ym2149c::kPanningABC;
+
+AsyncSndhStream::AsyncSndhStream(AudioSink* sink)
 {
+	m_sink = sink ? sink : AudioSink::Create(AudioSink::kBackendDevice);
 	m_audioBuffer = NULL;
 	m_audioDebugBuffer = NULL;
+	m_channelCount = 1;
 	m_bLoaded = false;
+	m_initFailed = false;
 	m_asyncInfo.thread = NULL;
+	m_asyncInfo.sndh = new SndhFile;
 }
 
 AsyncSndhStream::~AsyncSndhStream()
 {
 	Unload();
+	delete m_asyncInfo.sndh;
+	delete m_sink;
 }
 
 void AsyncSndhStream::Unload()
 {
 	CloseSubsong();
-	m_asyncInfo.sndh.Unload();
+	m_initFailed = false;
+	m_asyncInfo.sndh->Unload();
+	m_sndhFile.Close();
 }
 
 void AsyncSndhStream::CloseSubsong()
 {
 
+	// stop audio callbacks before releasing the buffer
+	if ((m_sink) && (m_audioBuffer))
+		m_sink->Close();
+
 	// kill any async working thread
 	if (m_asyncInfo.thread)
 	{
 		m_asyncInfo.forceQuit = true;
+		m_asyncInfo.wakeup.notify_one();
 		m_asyncInfo.thread->join();
 		delete m_asyncInfo.thread;
 		m_asyncInfo.thread = NULL;
@@ -39,10 +59,6 @@ void AsyncSndhStream::CloseSubsong()
 
 	if (m_audioBuffer)
 	{
-		waveOutUnprepareHeader(m_waveOutHandle, &m_waveHeader, sizeof(WAVEHDR));
-		waveOutReset(m_waveOutHandle);
-		waveOutClose(m_waveOutHandle);
-
 		free(m_audioBuffer);
 		free(m_audioDebugBuffer);
 		m_audioBuffer = NULL;
@@ -54,7 +70,22 @@ bool AsyncSndhStream::LoadSndh(const void* sndhFile, int fileSize, uint32_t repl
 {
 	Unload();
 	m_replayRate = replayRate;
-	m_bLoaded = m_asyncInfo.sndh.Load(sndhFile, fileSize, replayRate);
+	m_bLoaded = m_asyncInfo.sndh->Load(sndhFile, fileSize, replayRate);
+	return m_bLoaded;
+}
+
+bool AsyncSndhStream::LoadSndhFile(const char* sFilename, uint32_t replayRate)
+{
+	Unload();
+	m_replayRate = replayRate;
+	m_bLoaded = false;
+	if (m_sndhFile.Open(sFilename))
+	{
+		// the mapped file is kept alive until Unload, so SndhFile can borrow it
+		m_bLoaded = m_asyncInfo.sndh->Load(m_sndhFile.GetData(), int(m_sndhFile.GetSize()), replayRate, true);
+		if (!m_bLoaded)
+			m_sndhFile.Close();
+	}
 	return m_bLoaded;
 }
 
@@ -65,39 +96,169 @@ void	AsyncSndhStream::sAsyncSndhWorkerThread(void* a)
 	_this->AsyncWorkerFunction();
 }
 
+void	AsyncSndhStream::sAudioCallback(void* user, int16_t* buffer, int frameCount)
+{
+	AsyncSndhStream* _this = (AsyncSndhStream*)user;
+	_this->AudioCallback(buffer, frameCount);
+}
+
+// called from the sink thread: read the ring, silence if the worker is late
+void AsyncSndhStream::AudioCallback(int16_t* buffer, int frameCount)
+{
+	SpscRing& ring = m_asyncInfo.ring;
+
+	// after a seek, drop samples written before the worker switched to the new position
+	const uint32_t seekDone = m_asyncInfo.seekDone;
+	const bool seeking = (seekDone != m_asyncInfo.seekAck);
+	if (seeking)
+	{
+		ring.Flush();
+		m_playPos = m_asyncInfo.seekDonePos.load();
+		m_asyncInfo.seekAck = seekDone;
+		m_asyncInfo.wakeup.notify_one();
+	}
+
+	const int fillLevel = ring.GetFillLevel();
+	m_fillHistogram[(fillLevel * kFillHistogramBins) / (ring.GetCapacity() + 1)]++;
+
+	const int count = ring.Read(buffer, frameCount);
+	if (count < frameCount)
+	{
+		memset(buffer + count * m_channelCount, 0, (frameCount - count) * m_channelCount * sizeof(int16_t));
+		// empty ring before the first samples, right after a seek or at the end of the music isn't a starvation
+		if ((m_asyncInfo.started) && (!seeking) && (m_playPos + count < m_audioBufferLen))
+		{
+			m_underrunCount++;
+			m_underrunFrames += frameCount - count;
+		}
+	}
+	m_playPos += count;
+	m_sentFrames += frameCount;
+
+	if (fillLevel - count < ring.GetCapacity() / 2)
+		m_asyncInfo.wakeup.notify_one();
+}
+
+// sample currently heard: play position minus what is still queued in the sink
+uint32_t AsyncSndhStream::GetHeardPos() const
+{
+	const uint64_t queued = m_sentFrames - m_sink->GetPlayedFrames();
+	const uint32_t pos = m_playPos;
+	return (queued < pos) ? pos - uint32_t(queued) : 0;
+}
+
+void AsyncSndhStream::RenderChunk(uint32_t frameCount)
+{
+	const uint32_t fillPos = m_asyncInfo.fillPos;
+	if (fillPos + frameCount > m_audioBufferLen)
+		frameCount = m_audioBufferLen - fillPos;
+
+	m_asyncInfo.sndh->AudioRender(m_audioBuffer + fillPos * m_channelCount, frameCount, m_audioDebugBuffer + fillPos / kViewInfoDecimation);
+	m_asyncInfo.fillPos = fillPos + frameCount;
+
+	m_asyncInfo.progress = ((fillPos + frameCount) * 100) / m_audioBufferLen;
+}
+
+// true if ring is under the low watermark and worker could write in it
+bool AsyncSndhStream::WorkerHasRingWork(uint32_t seekRequest) const
+{
+	return (m_asyncInfo.seekAck == seekRequest) &&
+		(m_asyncInfo.publishPos < m_audioBufferLen) &&
+		(m_asyncInfo.ring.GetFillLevel() < m_asyncInfo.ring.GetCapacity() / 2);
+}
+
 void AsyncSndhStream::AsyncWorkerFunction()
 {
+	// chunks start on a debug view entry
+	const uint32_t renderChunk = ((m_replayRate * kRenderChunkMs) / 1000) & ~(kViewInfoDecimation - 1);
+	SpscRing& ring = m_asyncInfo.ring;
+	uint32_t seekRequest = m_asyncInfo.seekRequest;
+
+	// driver init could emulate up to one second, it's done here so UI thread never waits for it.
+	// Audio sink is already running, replay starts as soon as the first chunk is in the ring. On failure
+	// the sink plays silence until the UI thread sees the flag (CheckInitFailure). CloseSubsong cancels
+	// a running init (forceQuit is checked every emulated frame), so it doesn't wait for it either
+	if ((!m_asyncInfo.initDone) && (!InitSubsong(*m_asyncInfo.sndh, m_asyncInfo.subSongId, &m_asyncInfo.forceQuit)))
+	{
+		m_asyncInfo.initFailed = true;
+		return;
+	}
 
-	while (m_asyncInfo.fillPos < m_audioBufferLen)
+	while (!m_asyncInfo.forceQuit)
 	{
-		if (m_asyncInfo.forceQuit)
-			break;
+		if (m_asyncInfo.seekRequest != seekRequest)
+		{
+			seekRequest = m_asyncInfo.seekRequest;
+			m_asyncInfo.publishPos = m_asyncInfo.seekPos;
+			m_asyncInfo.seekDonePos = m_asyncInfo.publishPos;
+			m_asyncInfo.seekDone = seekRequest;
+		}
 
-		uint32_t todo = m_replayRate;
-		if (m_asyncInfo.fillPos + todo > m_audioBufferLen)
-			todo = m_audioBufferLen - m_asyncInfo.fillPos;
+		// first keep the ring full, so audio callback never starves
+		const bool ringReady = (m_asyncInfo.seekAck == seekRequest);
+		if ((ringReady) && (m_asyncInfo.publishPos < m_audioBufferLen) && (uint32_t(ring.GetFreeSpace()) >= renderChunk))
+		{
+			if (m_asyncInfo.publishPos >= m_asyncInfo.fillPos)
+				RenderChunk(renderChunk);
+			const uint32_t ready = m_asyncInfo.fillPos - m_asyncInfo.publishPos;
+			m_asyncInfo.publishPos += ring.Write(m_audioBuffer + m_asyncInfo.publishPos * m_channelCount, int(ready));
+			m_asyncInfo.started = true;
+			continue;
+		}
 
-		m_asyncInfo.sndh.AudioRender(m_audioBuffer + m_asyncInfo.fillPos, todo, m_audioDebugBuffer + m_asyncInfo.fillPos);
-		m_asyncInfo.fillPos += todo;
+		// then render the rest of the music (needed by seek & WAV save)
+		if (m_asyncInfo.fillPos < m_audioBufferLen)
+		{
+			RenderChunk(renderChunk);
+			continue;
+		}
 
-		m_asyncInfo.progress = (m_asyncInfo.fillPos * 100) / m_audioBufferLen;
+		// nothing to do until the ring is under the low watermark (timeout in case of missed wakeup)
+		std::unique_lock<std::mutex> lock(m_asyncInfo.wakeupMutex);
+		m_asyncInfo.wakeup.wait_for(lock, std::chrono::milliseconds(kRenderChunkMs), [&] {
+			return m_asyncInfo.forceQuit || (m_asyncInfo.seekRequest != seekRequest) || WorkerHasRingWork(seekRequest); });
 	}
 }
 
+// output settings of any SndhFile played by the stream, then driver init
+bool AsyncSndhStream::InitSubsong(SndhFile& sndh, int subSongId, const std::atomic<bool>* cancel)
+{
+	sndh.SetStereoPanning(kYmPanning);
+	sndh.SetViewInfoDecimation(kViewInfoDecimation);
+	return sndh.InitSubSong(subSongId, cancel);
+}
+
 bool AsyncSndhStream::StartSubsong(int subSongId, int durationByDefaultInSec)
 {
+	return Start(subSongId, durationByDefaultInSec, false, NULL, NULL, 0);
+}
 
-	if (!m_bLoaded)
+bool AsyncSndhStream::StartPrerendered(SndhFile* sndh, uint32_t replayRate, int subSongId, const int16_t* audio, const uint32_t* viewInfo, uint32_t frameCount, int durationByDefaultInSec)
+{
+	Unload();
+	delete m_asyncInfo.sndh;
+	m_asyncInfo.sndh = sndh;
+	m_replayRate = replayRate;
+	m_bLoaded = sndh->IsLoaded();
+	assert(0 == (frameCount % kViewInfoDecimation));		// next render call should start on a debug view entry
+	return Start(subSongId, durationByDefaultInSec, true, audio, viewInfo, frameCount);
+}
+
+bool AsyncSndhStream::Start(int subSongId, int durationByDefaultInSec, bool initDone, const int16_t* audio, const uint32_t* viewInfo, uint32_t frameCount)
+{
+
+	if ((!m_bLoaded) || (NULL == m_sink))
 		return false;
 
 	CloseSubsong();
 
 	SndhFile::SubSongInfo info;
-	if (!m_asyncInfo.sndh.GetSubsongInfo(subSongId, info))
+	if (!m_asyncInfo.sndh->GetSubsongInfo(subSongId, info))
 		return false;
 
-	if (!m_asyncInfo.sndh.InitSubSong(subSongId))
-		return false;
+	m_asyncInfo.sndh->SetStereoPanning(kYmPanning);
+	m_asyncInfo.sndh->SetViewInfoDecimation(kViewInfoDecimation);
+	m_channelCount = m_asyncInfo.sndh->GetChannelCount();
 
 	assert(m_replayRate > 0);
 	assert(info.playerTickRate > 0);
@@ -111,66 +272,99 @@ bool AsyncSndhStream::StartSubsong(int subSongId, int durationByDefaultInSec)
 		return false;
 	
 	// keep reasonable buffer len
-	assert(uint64_t(m_lenInSec)*uint64_t(m_replayRate)*sizeof(int16_t) < 0x7fffffff);
+	assert(uint64_t(m_lenInSec)*uint64_t(m_replayRate)*m_channelCount*sizeof(int16_t) < 0x7fffffff);
 	
 	m_audioBufferLen = m_lenInSec * m_replayRate;
 
-	WAVEFORMATEX	pcmwf;
-	pcmwf.wFormatTag = WAVE_FORMAT_PCM;
-	pcmwf.nChannels = 1;
-	pcmwf.wBitsPerSample = 16;
-	pcmwf.nBlockAlign = pcmwf.nChannels * pcmwf.wBitsPerSample / 8;
-	pcmwf.nSamplesPerSec = m_replayRate;
-	pcmwf.nAvgBytesPerSec = pcmwf.nSamplesPerSec * pcmwf.nBlockAlign;
-	pcmwf.cbSize = 0;
-
-	MMRESULT hr = waveOutOpen(&m_waveOutHandle, WAVE_MAPPER, &pcmwf, 0, 0, 0);
-	if (hr != MMSYSERR_NOERROR)
-		return false;
-
 	assert(NULL == m_audioBuffer);
 	assert(NULL == m_audioDebugBuffer);
-	m_audioBuffer = (int16_t*)malloc(m_audioBufferLen*sizeof(int16_t));
-	m_audioDebugBuffer = (uint32_t*)malloc(m_audioBufferLen*sizeof(uint32_t));
-
-	m_waveHeader.dwFlags = 0; // WHDR_BEGINLOOP | WHDR_ENDLOOP;
-	m_waveHeader.lpData = (LPSTR)m_audioBuffer;
-	m_waveHeader.dwBufferLength = m_audioBufferLen * sizeof(int16_t);
-	m_waveHeader.dwBytesRecorded = 0;
-	m_waveHeader.dwUser = 0;
-	m_waveHeader.dwLoops = -1;
-	waveOutPrepareHeader(m_waveOutHandle, &m_waveHeader, sizeof(WAVEHDR));
-
-	// Generate first second of music
-	m_asyncInfo.sndh.AudioRender(m_audioBuffer, m_replayRate, m_audioDebugBuffer);
+	m_audioBuffer = (int16_t*)malloc(m_audioBufferLen*m_channelCount*sizeof(int16_t));
+	// render chunks start on a debug view entry, only the last one can end in the middle of a decimation
+	// step (replay rate not a kViewInfoDecimation multiple): it still gets its partial entry
+	m_audioDebugBuffer = (uint32_t*)malloc(((m_audioBufferLen + kViewInfoDecimation - 1) / kViewInfoDecimation)*sizeof(uint32_t));
+
+	// nothing is rendered here: subsong init & first samples are computed by the worker
+	m_asyncInfo.subSongId = subSongId;
+	m_asyncInfo.initDone = initDone;
+	m_asyncInfo.started = false;
+	m_asyncInfo.initFailed = false;
+	m_initFailed = false;
+	m_asyncInfo.fillPos = 0;
+	m_asyncInfo.progress = 0;
+	m_asyncInfo.ring.Init((m_replayRate * kRingMs) / 1000, m_channelCount);
+	m_asyncInfo.publishPos = 0;
+
+	// except for a prerendered start: first samples go to the ring right now (worker isn't running yet)
+	if (frameCount > m_audioBufferLen)
+		frameCount = m_audioBufferLen & ~(kViewInfoDecimation - 1);
+	if (frameCount > 0)
+	{
+		memcpy(m_audioBuffer, audio, frameCount * m_channelCount * sizeof(int16_t));
+		memcpy(m_audioDebugBuffer, viewInfo, (frameCount / kViewInfoDecimation) * sizeof(uint32_t));
+		m_asyncInfo.fillPos = frameCount;
+		m_asyncInfo.progress = (frameCount * 100) / m_audioBufferLen;
+		m_asyncInfo.publishPos = m_asyncInfo.ring.Write(m_audioBuffer, int(frameCount));
+		m_asyncInfo.started = true;
+	}
+	m_asyncInfo.seekRequest = 0;
+	m_asyncInfo.seekDone = 0;
+	m_asyncInfo.seekAck = 0;
+	m_underrunCount = 0;
+	m_underrunFrames = 0;
+	for (int i = 0; i < kFillHistogramBins; i++)
+		m_fillHistogram[i] = 0;
 
 	// launch worker thread to generate
 	m_asyncInfo.forceQuit = false;
-	m_asyncInfo.fillPos = m_replayRate;
 	m_paused = false;
 	m_saved = false;
+	m_savedFlac = false;
 	m_asyncInfo.thread = new std::thread(sAsyncSndhWorkerThread, (void*)this);
 
-	// start the replay
-	playOffsetInSec = 0;
-	waveOutWrite(m_waveOutHandle, &m_waveHeader, sizeof(WAVEHDR));
+	// start the replay, the sink pulls samples from the callback
+	m_playPos = 0;
+	m_sentFrames = 0;
+	if (!m_sink->Open(m_replayRate, m_channelCount, sAudioCallback, this))
+	{
+		CloseSubsong();
+		return false;
+	}
 
 	return true;
 }
 
+void AsyncSndhStream::GetStreamStats(StreamStats& out) const
+{
+	out.underrunCount = m_underrunCount;
+	out.underrunFrames = m_underrunFrames;
+	for (int i = 0; i < kFillHistogramBins; i++)
+		out.fillHistogram[i] = m_fillHistogram[i];
+	out.ringCapacityMs = 0;
+	out.ringFillMs = 0;
+	out.renderAheadMs = 0;
+	if (m_audioBuffer)
+	{
+		const uint32_t fillPos = m_asyncInfo.fillPos;
+		const uint32_t playPos = m_playPos;
+		out.ringCapacityMs = int((uint64_t(m_asyncInfo.ring.GetCapacity()) * 1000) / m_replayRate);
+		out.ringFillMs = int((uint64_t(m_asyncInfo.ring.GetFillLevel()) * 1000) / m_replayRate);
+		out.renderAheadMs = (fillPos > playPos) ? int((uint64_t(fillPos - playPos) * 1000) / m_replayRate) : 0;
+	}
+}
+
 int AsyncSndhStream::GetSubsongCount() const
 {
-	return m_asyncInfo.sndh.GetSubsongCount();
+	return m_asyncInfo.sndh->GetSubsongCount();
 }
 
 int AsyncSndhStream::GetDefaultSubsong() const
 {
-	return m_asyncInfo.sndh.GetDefaultSubsong();
+	return m_asyncInfo.sndh->GetDefaultSubsong();
 }
 
 bool AsyncSndhStream::GetSubsongInfo(int subSongId, SndhFile::SubSongInfo& out) const
 {
-	return m_asyncInfo.sndh.GetSubsongInfo(subSongId, out);
+	return m_asyncInfo.sndh->GetSubsongInfo(subSongId, out);
 }
 
 int AsyncSndhStream::GetReplayPosInSec() const
@@ -178,14 +372,7 @@ int AsyncSndhStream::GetReplayPosInSec() const
 	if (NULL == m_audioBuffer)
 		return 0;
 
-	MMTIME mmt;
-	mmt.wType = TIME_SAMPLES;
-	if (MMSYSERR_NOERROR != waveOutGetPosition(m_waveOutHandle, &mmt, sizeof(MMTIME)))
-		return 0;
-
-	const uint32_t posInSample = mmt.u.sample;
-	const uint32_t posInSec = posInSample / m_replayRate;
-	return int(posInSec) + playOffsetInSec;
+	return int(GetHeardPos() / m_replayRate);
 }
 
 void AsyncSndhStream::SetReplayPosInSec(int pos)
@@ -200,25 +387,15 @@ void AsyncSndhStream::SetReplayPosInSec(int pos)
 	if (spos >= m_audioBufferLen)
 		return;
 
-	// Stupid Microsoft WaveOut API doesn't have "SetPosition"!!! So stop replay, create a new block and start it
-	waveOutUnprepareHeader(m_waveOutHandle, &m_waveHeader, sizeof(WAVEHDR));
-	waveOutReset(m_waveOutHandle);
-
-	playOffsetInSec = pos;
-
-	m_waveHeader.dwFlags = 0; // WHDR_BEGINLOOP | WHDR_ENDLOOP;
-	m_waveHeader.lpData = (LPSTR)(m_audioBuffer + spos);
-	m_waveHeader.dwBufferLength = (m_audioBufferLen - spos)*sizeof(int16_t);
-	m_waveHeader.dwBytesRecorded = 0;
-	m_waveHeader.dwUser = 0;
-	m_waveHeader.dwLoops = -1;
-	waveOutPrepareHeader(m_waveOutHandle, &m_waveHeader, sizeof(WAVEHDR));
-
-	// start replay
-	waveOutWrite(m_waveOutHandle, &m_waveHeader, sizeof(WAVEHDR));
-
-	m_paused = false;
-
+	// samples already queued in the sink are still played, that's only a few ms
+	m_asyncInfo.seekPos = spos;
+	m_asyncInfo.seekRequest++;
+	m_asyncInfo.wakeup.notify_one();
+	if (m_paused)
+	{
+		m_sink->Pause(false);
+		m_paused = false;
+	}
 }
 
 const int16_t* AsyncSndhStream::GetDisplaySampleData(int sampleCount, uint32_t** ppDebugView) const
@@ -226,23 +403,33 @@ const int16_t* AsyncSndhStream::GetDisplaySampleData(int sampleCount, uint32_t**
 	if (NULL == m_audioBuffer)
 		return NULL;
 
-	MMTIME mmt;
-	mmt.wType = TIME_SAMPLES;
-	if (MMSYSERR_NOERROR != waveOutGetPosition(m_waveOutHandle, &mmt, sizeof(MMTIME)))
-		return NULL;
-
-	const uint32_t posInSample = mmt.u.sample + playOffsetInSec * m_replayRate;
-	if (posInSample + sampleCount > m_audioBufferLen)
+	const uint32_t posInSample = GetHeardPos();
+	if (posInSample + sampleCount > m_asyncInfo.fillPos)
 		return NULL;
 
 	if (ppDebugView)
-		*ppDebugView = m_audioDebugBuffer + posInSample;
+		*ppDebugView = m_audioDebugBuffer + posInSample / kViewInfoDecimation;
 
-	return m_audioBuffer + posInSample;
+	return m_audioBuffer + posInSample * m_channelCount;
+}
+
+bool AsyncSndhStream::CheckInitFailure()
+{
+	if ((m_asyncInfo.thread) && (m_asyncInfo.initFailed))
+	{
+		CloseSubsong();
+		m_initFailed = true;
+	}
+	return m_initFailed;
 }
 
 void	AsyncSndhStream::DrawGui(const char* musicName)
 {
+	if (m_initFailed)
+	{
+		ImGui::TextUnformatted("Sub-tune init failed");
+		return;
+	}
 
 	bool change = false;
 
@@ -260,35 +447,60 @@ void	AsyncSndhStream::DrawGui(const char* musicName)
 
 	ImGui::BeginDisabled(m_asyncInfo.fillPos < m_audioBufferLen);
 	char sLen[64];
-	sprintf_s(sLen, "%d:%02d", m_lenInSec / 60, m_lenInSec % 60);
+	snprintf(sLen, sizeof(sLen), "%d:%02d", m_lenInSec / 60, m_lenInSec % 60);
 	static int pos;
 	pos = GetReplayPosInSec();
 	char sPos[64];
-	sprintf_s(sPos, "%d:%02d", pos / 60, pos % 60);
+	snprintf(sPos, sizeof(sPos), "%d:%02d", pos / 60, pos % 60);
 	if (ImGui::SliderInt(sLen, &pos, 0, m_lenInSec, sPos))
 	{
 		SetReplayPosInSec(pos);
 	}
+	if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled))
+	{
+		StreamStats stats;
+		GetStreamStats(stats);
+		ImGui::SetTooltip("Ring %d/%d ms, rendered %d ms ahead\n%d underruns (%d ms of silence)",
+			stats.ringFillMs, stats.ringCapacityMs, stats.renderAheadMs,
+			stats.underrunCount, int((uint64_t(stats.underrunFrames) * 1000) / m_replayRate));
+	}
 
 	if (musicName)
 	{
 		char sFilename[_MAX_PATH];
-		sprintf_s(sFilename, "%s.wav", musicName);
-		char dispName[_MAX_PATH];
-		uint32_t sizeInMiB = (m_audioBufferLen * sizeof(int16_t) + (1 << 20) - 1) >> 20;
+		snprintf(sFilename, sizeof(sFilename), "%s.wav", musicName);
+		char dispName[_MAX_PATH + 64];
+		uint32_t sizeInMiB = (m_audioBufferLen * m_channelCount * sizeof(int16_t) + (1 << 20) - 1) >> 20;
 		if ( m_saved )
-			sprintf_s(dispName, "\"%s\" saved", sFilename);
+			snprintf(dispName, sizeof(dispName), "\"%s\" saved", sFilename);
 		else
-			sprintf_s(dispName, "Save \"%s\" (%d MiB)", sFilename, sizeInMiB);
+			snprintf(dispName, sizeof(dispName), "Save \"%s\" (%d MiB)", sFilename, sizeInMiB);
 		ImGui::BeginDisabled(m_saved);
 		if (ImGui::Button(dispName))
 		{
 			WavWriter wv;
-			if (wv.Open(sFilename, m_replayRate, 1))
+			if (wv.Open(sFilename, m_replayRate, m_channelCount))
 			{
 				wv.AddAudioData(m_audioBuffer, m_audioBufferLen);
-				wv.Close();
-				m_saved = true;
+				m_saved = wv.Close();
+			}
+		}
+		ImGui::EndDisabled();
+
+		snprintf(sFilename, sizeof(sFilename), "%s.flac", musicName);
+		if (m_savedFlac)
+			snprintf(dispName, sizeof(dispName), "\"%s\" saved", sFilename);
+		else
+			snprintf(dispName, sizeof(dispName), "Save \"%s\"", sFilename);
+		ImGui::SameLine();
+		ImGui::BeginDisabled(m_savedFlac);
+		if (ImGui::Button(dispName))
+		{
+			FlacWriter fw;
+			if (fw.Open(sFilename, m_replayRate, m_channelCount))
+			{
+				fw.AddAudioData(m_audioBuffer, m_audioBufferLen);
+				m_savedFlac = fw.Close();
 			}
 		}
 		ImGui::EndDisabled();
@@ -299,8 +511,8 @@ void	AsyncSndhStream::DrawGui(const char* musicName)
 
 const void* AsyncSndhStream::GetRawData(int& fileSize) const
 {
-	fileSize = m_asyncInfo.sndh.GetRawDataSize();
-	return m_asyncInfo.sndh.GetRawData();
+	fileSize = m_asyncInfo.sndh->GetRawDataSize();
+	return m_asyncInfo.sndh->GetRawData();
 }
 
 void AsyncSndhStream::Pause(bool pause)
@@ -308,9 +520,6 @@ void AsyncSndhStream::Pause(bool pause)
 	if (NULL == m_audioBuffer)
 		return;
 
-	if ( pause )
-		waveOutPause(m_waveOutHandle);
-	else
-		waveOutRestart(m_waveOutHandle);
+	m_sink->Pause(pause);
 }
 
@@ -1,38 +1,73 @@
 #pragma once
 #include <stdint.h>
-#include <windows.h>
-#include <mmsystem.h>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "../AtariAudio/AtariAudio.h"
+#include "MappedFile.h"
+#include "AudioSink.h"
+#include "SpscRing.h"
 
 class AsyncSndhStream
 {
 public:
 
 	~AsyncSndhStream();
-	AsyncSndhStream();
+	AsyncSndhStream(AudioSink* sink = NULL);		// takes sink ownership, default is the sound card
 
 	bool LoadSndh(const void* sndhFile, int fileSize, uint32_t replayRate);
+	bool LoadSndhFile(const char* sFilename, uint32_t replayRate);		// memory map the file, no copy if not packed
 	void Unload();
 	bool StartSubsong(int subSongId, int durationByDefaultInSec);
+
+	// play a subsong already initialized (and maybe partly rendered) by InitSubsong on another thread, so no
+	// emulation is needed before the first audio callback. Takes "sndh" ownership, frameCount is a kViewInfoDecimation multiple
+	bool StartPrerendered(SndhFile* sndh, uint32_t replayRate, int subSongId, const int16_t* audio, const uint32_t* viewInfo, uint32_t frameCount, int durationByDefaultInSec);
+	static bool InitSubsong(SndhFile& sndh, int subSongId, const std::atomic<bool>* cancel = NULL);		// stream output settings & driver init
 	void Pause(bool pause);
+	bool CheckInitFailure();		// call regularly from the UI thread: true (and the sink is stopped) if the worker couldn't init the subsong
 
 	int GetReplayPosInSec() const;
-	const int16_t* GetDisplaySampleData(int sampleCount, uint32_t** ppDebugView = NULL) const;
+	static constexpr int kViewInfoDecimation = 4;		// one debug view entry every 4 samples is enough for display
+
+	const int16_t* GetDisplaySampleData(int sampleCount, uint32_t** ppDebugView = NULL) const;		// interleaved if stereo, debug view is decimated
+	int		GetChannelCount() const { return m_channelCount; }
 	int		GetSubsongCount() const;
 	int		GetDefaultSubsong() const;
 	bool	GetSubsongInfo(int subSongId, SndhFile::SubSongInfo& out) const;
 	const void* GetRawData(int& fileSize) const;
 
+	// streaming telemetry, mostly updated by the audio callback
+	static constexpr int kFillHistogramBins = 8;
+	struct StreamStats
+	{
+		uint32_t	underrunCount;			// audio callbacks served with missing samples (silence inserted)
+		uint32_t	underrunFrames;			// silent frames inserted
+		uint32_t	fillHistogram[kFillHistogramBins];	// ring fill level at each callback, bin i is [i/8,(i+1)/8[ of capacity
+		int			ringCapacityMs;
+		int			ringFillMs;
+		int			renderAheadMs;			// rendered audio ahead of play position
+	};
+	void	GetStreamStats(StreamStats& out) const;
+
 	void	DrawGui(const char* musicName);
 
 	static void sAsyncSndhWorkerThread(void* a);
+	static void sAudioCallback(void* user, int16_t* buffer, int frameCount);
 
 private:
+	bool Start(int subSongId, int durationByDefaultInSec, bool initDone, const int16_t* audio, const uint32_t* viewInfo, uint32_t frameCount);
 	void SetReplayPosInSec(int pos);
 	void CloseSubsong();
 	void AsyncWorkerFunction();
+	void AudioCallback(int16_t* buffer, int frameCount);
+	void RenderChunk(uint32_t frameCount);
+	bool WorkerHasRingWork(uint32_t seekRequest) const;
+	uint32_t GetHeardPos() const;
+
+	static constexpr int kRingMs = 200;			// samples rendered ahead of audio callback
+	static constexpr int kRenderChunkMs = 20;	// worker checks the ring between each chunk
 
 	struct AsyncInfo
 	{
@@ -40,20 +75,46 @@ private:
 		std::thread*	thread;
 		std::atomic<bool> forceQuit;
 		std::atomic<int> progress;
-		SndhFile sndh;
+		SndhFile*	sndh;
+		int			subSongId;
+		bool		initDone;			// driver init already done by a prefetcher
+		std::atomic<bool>	started;		// driver init is done and first samples are in the ring
+		std::atomic<bool>	initFailed;		// worker stopped before rendering anything
+
+		// worker writes in the ring from "publishPos", audio callback reads. Worker sleeps until the
+		// ring is under the low watermark (half capacity), or the rest of the music is rendered in the background
+		SpscRing	ring;
+		uint32_t	publishPos;					// worker only
+		std::mutex	wakeupMutex;
+		std::condition_variable	wakeup;
+
+		// seek: UI posts a request, worker stops writing old samples and tells the new position,
+		// then callback drops the ring content and acknowledges (so the worker can write again)
+		std::atomic<uint32_t>	seekPos;
+		std::atomic<uint32_t>	seekRequest;
+		std::atomic<uint32_t>	seekDonePos;
+		std::atomic<uint32_t>	seekDone;
+		std::atomic<uint32_t>	seekAck;
 	};
 
 	bool m_bLoaded;
 	int m_lenInSec;
-	int playOffsetInSec;
-	HWAVEOUT	m_waveOutHandle;
-	WAVEHDR		m_waveHeader;
+	AudioSink*	m_sink;
+	std::atomic<uint32_t>	m_playPos;		// next sample sent to the sink (written by audio callback only)
+	std::atomic<uint64_t>	m_sentFrames;	// frames sent to the sink since it was opened (silence included)
 	int16_t*	m_audioBuffer;
 	uint32_t*	m_audioDebugBuffer;
-	uint32_t 	m_audioBufferLen;
+	uint32_t 	m_audioBufferLen;		// in samples (one sample is m_channelCount int16_t)
+	int			m_channelCount;
 	uint32_t	m_replayRate;
 	bool		m_paused;
 	bool		m_saved;
+	bool		m_savedFlac;
+	bool		m_initFailed;
+	MappedFile	m_sndhFile;
+	std::atomic<uint32_t>	m_underrunCount;
+	std::atomic<uint32_t>	m_underrunFrames;
+	std::atomic<uint32_t>	m_fillHistogram[kFillHistogramBins];
 
 	AsyncInfo m_asyncInfo;
 };
@@ -0,0 +1,520 @@
+#define	_CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#include <io.h>
+#include <fcntl.h>
+#pragma	comment(lib,"winmm.lib")
+#define	popen	_popen
+#define	pclose	_pclose
+static const char* kPipeMode = "wb";
+#else
+static const char* kPipeMode = "w";
+#endif
+#if defined(__linux__) && !defined(AUDIOSINK_NO_ALSA)
+#include <alsa/asoundlib.h>
+#endif
+#include "AudioSink.h"
+#include "WavWriter.h"
+#include "FlacWriter.h"
+
+// Sink running its own thread: pull a buffer from the callback, write it, and wait for the next one.
+// "Clocked" sinks (no device behind them) sleep one buffer duration between writes, to behave like a sound card
+class ThreadedSink : public AudioSink
+{
+public:
+	ThreadedSink(bool clocked)
+	{
+		m_clocked = clocked;
+		m_buffer = NULL;
+		m_thread = NULL;
+		m_outputFailed = false;
+	}
+
+	virtual ~ThreadedSink()
+	{
+		Close();
+	}
+
+	virtual bool	Open(uint32_t replayRate, int channelCount, RenderCallback callback, void* user, int bufferFrames, int bufferCount)
+	{
+		Close();
+		assert(replayRate > 0);
+		assert(bufferFrames > 0);
+		m_replayRate = replayRate;
+		m_channelCount = channelCount;
+		m_bufferFrames = bufferFrames;
+		m_callback = callback;
+		m_user = user;
+		if (!OpenOutput(bufferCount))
+			return false;
+		m_buffer = (int16_t*)malloc(bufferFrames * channelCount * sizeof(int16_t));
+		m_writtenFrames = 0;
+		m_delayFrames = 0;
+		m_outputFailed = false;
+		m_paused = false;
+		m_quit = false;
+		m_thread = new std::thread(sThreadFunction, (void*)this);
+		return true;
+	}
+
+	virtual bool	Close()
+	{
+		if (m_thread)
+		{
+			m_quit = true;
+			m_thread->join();
+			delete m_thread;
+			m_thread = NULL;
+			if (!CloseOutput())
+				m_outputFailed = true;
+			free(m_buffer);
+			m_buffer = NULL;
+		}
+		return !m_outputFailed;
+	}
+
+	virtual void	Pause(bool pause)
+	{
+		m_paused = pause;
+	}
+
+	virtual uint64_t	GetPlayedFrames() const
+	{
+		const uint64_t written = m_writtenFrames;
+		const uint64_t delay = m_delayFrames;
+		return (written > delay) ? written - delay : 0;
+	}
+
+protected:
+	virtual bool	OpenOutput(int bufferCount) = 0;
+	virtual bool	WriteOutput(const int16_t* data, int frameCount) = 0;
+	virtual bool	CloseOutput() = 0;		// false if the output couldn't be completed (file write error)
+	virtual uint64_t OutputDelay() { return 0; }		// frames written but not heard yet (device queue)
+
+	uint32_t	m_replayRate;
+	int			m_channelCount;
+	int			m_bufferFrames;
+
+private:
+	static void	sThreadFunction(void* a)
+	{
+		((ThreadedSink*)a)->ThreadFunction();
+	}
+
+	void	ThreadFunction()
+	{
+		const std::chrono::microseconds period(uint64_t(m_bufferFrames) * 1000000 / m_replayRate);
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+		while (!m_quit)
+		{
+			if (m_paused)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				deadline = std::chrono::steady_clock::now();
+				continue;
+			}
+
+			m_callback(m_user, m_buffer, m_bufferFrames);
+			if (!WriteOutput(m_buffer, m_bufferFrames))
+			{
+				m_outputFailed = true;
+				break;
+			}
+			m_writtenFrames += m_bufferFrames;
+			m_delayFrames = OutputDelay();
+
+			if (m_clocked)
+			{
+				deadline += period;
+				std::this_thread::sleep_until(deadline);
+			}
+		}
+	}
+
+	bool			m_clocked;
+	RenderCallback	m_callback;
+	void*			m_user;
+	int16_t*		m_buffer;
+	std::thread*	m_thread;
+	bool			m_outputFailed;		// written by the sink thread, read after join
+	std::atomic<bool>		m_quit;
+	std::atomic<bool>		m_paused;
+	std::atomic<uint64_t>	m_writtenFrames;
+	std::atomic<uint64_t>	m_delayFrames;
+};
+
+class NullSink : public ThreadedSink
+{
+public:
+	NullSink() : ThreadedSink(true) {}
+	virtual ~NullSink() { Close(); }
+
+protected:
+	virtual bool	OpenOutput(int /*bufferCount*/) { return true; }
+	virtual bool	WriteOutput(const int16_t* /*data*/, int /*frameCount*/) { return true; }
+	virtual bool	CloseOutput() { return true; }
+};
+
+class WavSink : public ThreadedSink
+{
+public:
+	WavSink(const char* sFilename) : ThreadedSink(true)
+	{
+		m_sFilename = sFilename ? sFilename : "out.wav";
+	}
+	virtual ~WavSink() { Close(); }
+
+protected:
+	virtual bool	OpenOutput(int /*bufferCount*/)
+	{
+		return m_writer.Open(m_sFilename, m_replayRate, m_channelCount);
+	}
+	virtual bool	WriteOutput(const int16_t* data, int frameCount)
+	{
+		m_writer.AddAudioData(data, frameCount);
+		return true;
+	}
+	virtual bool	CloseOutput()
+	{
+		return m_writer.Close();
+	}
+
+private:
+	const char*	m_sFilename;
+	WavWriter	m_writer;
+};
+
+class FlacSink : public ThreadedSink
+{
+public:
+	FlacSink(const char* sFilename) : ThreadedSink(true)
+	{
+		m_sFilename = sFilename ? sFilename : "out.flac";
+	}
+	virtual ~FlacSink() { Close(); }
+
+protected:
+	virtual bool	OpenOutput(int /*bufferCount*/)
+	{
+		return m_writer.Open(m_sFilename, m_replayRate, m_channelCount);
+	}
+	virtual bool	WriteOutput(const int16_t* data, int frameCount)
+	{
+		m_writer.AddAudioData(data, frameCount);
+		return true;
+	}
+	virtual bool	CloseOutput()
+	{
+		return m_writer.Close();
+	}
+
+private:
+	const char*	m_sFilename;
+	FlacWriter	m_writer;
+};
+
+class RawSink : public ThreadedSink
+{
+public:
+	RawSink(const char* target) : ThreadedSink(true)
+	{
+		m_target = target;
+		m_h = NULL;
+		m_pipe = false;
+	}
+	virtual ~RawSink() { Close(); }
+
+protected:
+	virtual bool	OpenOutput(int /*bufferCount*/)
+	{
+		m_pipe = false;
+		if ((NULL == m_target) || (0 == strcmp(m_target, "-")))
+		{
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			m_h = stdout;
+		}
+		else if ('|' == m_target[0])
+		{
+			m_h = popen(m_target + 1, kPipeMode);
+			m_pipe = true;
+		}
+		else
+		{
+			m_h = fopen(m_target, "wb");
+		}
+		return m_h != NULL;
+	}
+	virtual bool	WriteOutput(const int16_t* data, int frameCount)
+	{
+		return size_t(frameCount) == fwrite(data, sizeof(int16_t) * m_channelCount, frameCount, m_h);
+	}
+	virtual bool	CloseOutput()
+	{
+		int err = 0;
+		if (m_h == stdout)
+			err = fflush(m_h);
+		else if (m_pipe)
+			err = pclose(m_h);
+		else if (m_h)
+			err = fclose(m_h);
+		m_h = NULL;
+		return 0 == err;
+	}
+
+private:
+	const char*	m_target;
+	FILE*		m_h;
+	bool		m_pipe;
+};
+
+#if defined(__linux__) && !defined(AUDIOSINK_NO_ALSA)
+// ALSA blocking writes: the device clocks the thread
+class AlsaSink : public ThreadedSink
+{
+public:
+	AlsaSink(const char* device) : ThreadedSink(false)
+	{
+		m_device = device ? device : "default";
+		m_pcm = NULL;
+	}
+	virtual ~AlsaSink() { Close(); }
+
+protected:
+	virtual bool	OpenOutput(int bufferCount)
+	{
+		if (snd_pcm_open(&m_pcm, m_device, SND_PCM_STREAM_PLAYBACK, 0) < 0)
+		{
+			m_pcm = NULL;
+			return false;
+		}
+		const unsigned int latencyUs = unsigned(uint64_t(m_bufferFrames) * bufferCount * 1000000 / m_replayRate);
+		if (snd_pcm_set_params(m_pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED, m_channelCount, m_replayRate, 1, latencyUs) < 0)
+		{
+			snd_pcm_close(m_pcm);
+			m_pcm = NULL;
+			return false;
+		}
+		return true;
+	}
+	virtual bool	WriteOutput(const int16_t* data, int frameCount)
+	{
+		while (frameCount > 0)
+		{
+			snd_pcm_sframes_t written = snd_pcm_writei(m_pcm, data, frameCount);
+			if (written < 0)
+			{
+				// underrun (or resume after pause): recover and write again
+				if (snd_pcm_recover(m_pcm, int(written), 1) < 0)
+					return false;
+				continue;
+			}
+			data += written * m_channelCount;
+			frameCount -= int(written);
+		}
+		return true;
+	}
+	virtual bool	CloseOutput()
+	{
+		if (m_pcm)
+		{
+			snd_pcm_drop(m_pcm);
+			snd_pcm_close(m_pcm);
+			m_pcm = NULL;
+		}
+		return true;
+	}
+	virtual uint64_t OutputDelay()
+	{
+		snd_pcm_sframes_t delay = 0;
+		if ((snd_pcm_delay(m_pcm, &delay) < 0) || (delay < 0))
+			return 0;
+		return uint64_t(delay);
+	}
+
+private:
+	const char*	m_device;
+	snd_pcm_t*	m_pcm;
+};
+#endif
+
+#ifdef _WIN32
+// waveOut with a few small queued buffers. A thread refills each buffer as soon as the driver returns it
+class WaveOutSink : public AudioSink
+{
+public:
+	WaveOutSink()
+	{
+		m_waveOutHandle = NULL;
+		m_event = NULL;
+		m_buffer = NULL;
+		m_thread = NULL;
+		m_bufferCount = 0;
+	}
+
+	virtual ~WaveOutSink()
+	{
+		Close();
+	}
+
+	virtual bool	Open(uint32_t replayRate, int channelCount, RenderCallback callback, void* user, int bufferFrames, int bufferCount)
+	{
+		Close();
+		assert((bufferCount > 1) && (bufferCount <= kMaxBufferCount));
+
+		WAVEFORMATEX	pcmwf;
+		pcmwf.wFormatTag = WAVE_FORMAT_PCM;
+		pcmwf.nChannels = WORD(channelCount);
+		pcmwf.wBitsPerSample = 16;
+		pcmwf.nBlockAlign = pcmwf.nChannels * pcmwf.wBitsPerSample / 8;
+		pcmwf.nSamplesPerSec = replayRate;
+		pcmwf.nAvgBytesPerSec = pcmwf.nSamplesPerSec * pcmwf.nBlockAlign;
+		pcmwf.cbSize = 0;
+
+		m_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		MMRESULT hr = waveOutOpen(&m_waveOutHandle, WAVE_MAPPER, &pcmwf, (DWORD_PTR)m_event, 0, CALLBACK_EVENT);
+		if (hr != MMSYSERR_NOERROR)
+		{
+			CloseHandle(m_event);
+			m_event = NULL;
+			m_waveOutHandle = NULL;
+			return false;
+		}
+
+		m_callback = callback;
+		m_user = user;
+		m_bufferFrames = bufferFrames;
+		m_channelCount = channelCount;
+		m_bufferCount = bufferCount;
+		m_buffer = (int16_t*)malloc(bufferFrames * channelCount * bufferCount * sizeof(int16_t));
+		for (int i = 0; i < bufferCount; i++)
+		{
+			WAVEHDR& header = m_headers[i];
+			memset(&header, 0, sizeof(WAVEHDR));
+			header.lpData = (LPSTR)(m_buffer + i * bufferFrames * channelCount);
+			header.dwBufferLength = bufferFrames * channelCount * sizeof(int16_t);
+			waveOutPrepareHeader(m_waveOutHandle, &header, sizeof(WAVEHDR));
+			Fill(header);
+		}
+
+		m_quit = false;
+		m_thread = new std::thread(sThreadFunction, (void*)this);
+		return true;
+	}
+
+	virtual bool	Close()
+	{
+		if (m_waveOutHandle)
+		{
+			m_quit = true;
+			SetEvent(m_event);
+			m_thread->join();
+			delete m_thread;
+			m_thread = NULL;
+
+			waveOutReset(m_waveOutHandle);
+			for (int i = 0; i < m_bufferCount; i++)
+				waveOutUnprepareHeader(m_waveOutHandle, &m_headers[i], sizeof(WAVEHDR));
+			waveOutClose(m_waveOutHandle);
+			CloseHandle(m_event);
+			free(m_buffer);
+			m_waveOutHandle = NULL;
+			m_event = NULL;
+			m_buffer = NULL;
+			m_bufferCount = 0;
+		}
+		return true;
+	}
+
+	virtual void	Pause(bool pause)
+	{
+		if (m_waveOutHandle)
+		{
+			if (pause)
+				waveOutPause(m_waveOutHandle);
+			else
+				waveOutRestart(m_waveOutHandle);
+		}
+	}
+
+	virtual uint64_t	GetPlayedFrames() const
+	{
+		MMTIME mmt;
+		mmt.wType = TIME_SAMPLES;
+		if ((NULL == m_waveOutHandle) || (MMSYSERR_NOERROR != waveOutGetPosition(m_waveOutHandle, &mmt, sizeof(MMTIME))))
+			return 0;
+		return mmt.u.sample;
+	}
+
+private:
+	static void	sThreadFunction(void* a)
+	{
+		((WaveOutSink*)a)->ThreadFunction();
+	}
+
+	void	ThreadFunction()
+	{
+		while (!m_quit)
+		{
+			WaitForSingleObject(m_event, INFINITE);
+			for (int i = 0; (i < m_bufferCount) && (!m_quit); i++)
+			{
+				if (m_headers[i].dwFlags & WHDR_DONE)
+					Fill(m_headers[i]);
+			}
+		}
+	}
+
+	void	Fill(WAVEHDR& header)
+	{
+		m_callback(m_user, (int16_t*)header.lpData, m_bufferFrames);
+		waveOutWrite(m_waveOutHandle, &header, sizeof(WAVEHDR));
+	}
+
+	HWAVEOUT		m_waveOutHandle;
+	HANDLE			m_event;
+	WAVEHDR			m_headers[kMaxBufferCount];
+	int				m_bufferCount;
+	int				m_bufferFrames;
+	int				m_channelCount;
+	int16_t*		m_buffer;
+	RenderCallback	m_callback;
+	void*			m_user;
+	std::thread*	m_thread;
+	std::atomic<bool>	m_quit;
+};
+#endif
+
+AudioSink*	AudioSink::Create(Backend backend, const char* target)
+{
+	switch (backend)
+	{
+	case kBackendDevice:
+#ifdef _WIN32
+		return new WaveOutSink();
+#elif defined(__linux__) && !defined(AUDIOSINK_NO_ALSA)
+		return new AlsaSink(target);
+#else
+		return NULL;
+#endif
+	case kBackendNull:
+		return new NullSink();
+	case kBackendWav:
+		return new WavSink(target);
+	case kBackendRaw:
+		return new RawSink(target);
+	case kBackendFlac:
+		return new FlacSink(target);
+	default:
+		return NULL;
+	}
+}
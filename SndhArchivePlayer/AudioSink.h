@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+// Audio output using a pull model: the sink owns a few small buffers. Each time one of them must be refilled,
+// it calls the render callback from its own thread. Latency is about bufferCount * bufferFrames
+class AudioSink
+{
+public:
+	enum Backend
+	{
+		kBackendDevice,		// sound card: waveOut on Windows, ALSA on Linux ("target" is the ALSA device name, none if built with AUDIOSINK_NO_ALSA)
+		kBackendNull,		// audio is discarded, but the callback is clocked like a real device (benchmark)
+		kBackendWav,		// "target" .wav file, clocked like a device
+		kBackendRaw,		// raw interleaved 16 bits PCM to stdout ("-" or NULL target), a pipe ("|command") or a file
+		kBackendFlac,		// "target" .flac file, clocked like a device
+	};
+
+	// called by the sink thread, must always write frameCount frames (interleaved if stereo) and never block
+	typedef void (*RenderCallback)(void* user, int16_t* buffer, int frameCount);
+
+	static const int kDefaultBufferFrames = 512;
+	static const int kDefaultBufferCount = 3;
+	static const int kMaxBufferCount = 8;
+
+	static AudioSink*	Create(Backend backend, const char* target = NULL);		// NULL if backend isn't available on this platform
+
+	virtual ~AudioSink() {}
+	virtual bool		Open(uint32_t replayRate, int channelCount, RenderCallback callback, void* user, int bufferFrames = kDefaultBufferFrames, int bufferCount = kDefaultBufferCount) = 0;
+	virtual bool		Close() = 0;		// false if the output couldn't be fully written (file sinks)
+	virtual void		Pause(bool pause) = 0;
+	virtual uint64_t	GetPlayedFrames() const = 0;		// frames actually heard since Open (excludes frames still queued in buffers)
+};
@@ -0,0 +1,524 @@
+#define	_CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+#include "BatchRender.h"
+#include "FlacWriter.h"
+
+const char* BatchRender::kManifestName = "manifest.txt";
+static const Ym2149c::StereoPanning kYmPanning = Ym2149c::kPanningABC;
+
+static bool	makeDirectory(const char* sPath)
+{
+#ifdef _WIN32
+	return (CreateDirectoryA(sPath, NULL)) || (ERROR_ALREADY_EXISTS == GetLastError());
+#else
+	struct stat st;
+	return (0 == mkdir(sPath, 0755)) || ((0 == stat(sPath, &st)) && S_ISDIR(st.st_mode));
+#endif
+}
+
+// create each missing directory of a file path, starting after "skip" chars (already existing root)
+static bool	makeParentDirectories(char* sPath, int skip)
+{
+	for (char* p = sPath + skip; *p; p++)
+	{
+		if ('/' == *p)
+		{
+			*p = 0;
+			const bool ok = makeDirectory(sPath);
+			*p = '/';
+			if (!ok)
+				return false;
+		}
+	}
+	return true;
+}
+
+// atomic: readers see either the old or the new file, never a missing one
+static bool	replaceFile(const char* sSrc, const char* sDst)
+{
+#ifdef _WIN32
+	return 0 != MoveFileExA(sSrc, sDst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	return 0 == rename(sSrc, sDst);
+#endif
+}
+
+// output name keeps the archive directory structure ("dir/name.sndh" gives "dir/name_<subsong>.flac"), so two
+// entries never share an output. Entries escaping the output directory are rejected
+static bool	outputBaseName(const char* entryName, char* out, int size)
+{
+	while (('/' == *entryName) || ('\\' == *entryName))
+		entryName++;
+	if (snprintf(out, size, "%s", entryName) >= size)
+		return false;
+	for (char* p = out; *p; p++)
+	{
+		if ('\\' == *p)
+			*p = '/';
+		else if (':' == *p)
+			*p = '_';
+	}
+	for (const char* p = out; p; p = strchr(p, '/'))
+	{
+		if ('/' == *p)
+			p++;
+		if ((0 == strncmp(p, "..", 2)) && (('/' == p[2]) || (0 == p[2])))
+			return false;
+	}
+
+	// only the usual extension is dropped: "name.snd" & "name.sndh" stay different
+	char* ext = strrchr(out, '.');
+	if ((ext) && (NULL == strchr(ext, '/')) && (5 == strlen(ext)))
+	{
+		char lower[6];
+		for (int i = 0; i < 6; i++)
+			lower[i] = char(tolower((unsigned char)ext[i]));
+		if (0 == strcmp(lower, ".sndh"))
+			*ext = 0;
+	}
+	return (out[0] != 0);
+}
+
+static bool	fileExists(const char* sFilename)
+{
+	FILE* h = fopen(sFilename, "rb");
+	if (h)
+		fclose(h);
+	return (h != NULL);
+}
+
+BatchRender::BatchRender()
+{
+	m_zipIndices = NULL;
+	m_entryCount = 0;
+	m_aliases = NULL;
+	m_aliasCount = 0;
+	m_workersCount = 0;
+	m_active = false;
+	m_cancel = false;
+	m_entryDone = 0;
+	m_renderedCount = 0;
+	m_skippedCount = 0;
+	m_failedCount = 0;
+	m_aliasDoneCount = 0;
+	m_manifest = NULL;
+	m_manifestSize = 0;
+	m_hManifest = NULL;
+}
+
+BatchRender::~BatchRender()
+{
+	Cancel();
+	Update();
+}
+
+bool	BatchRender::Start(const char* sZipFilename, const int* zipIndices, const int* leaders, int count, const char* sOutputDir, uint32_t replayRate, int durationByDefaultInSec)
+{
+	if ((m_active) || (count <= 0))
+		return false;
+
+	if (!makeDirectory(sOutputDir))
+	{
+		printf("ERROR: Unable to create directory \"%s\"\n", sOutputDir);
+		return false;
+	}
+
+	// longest path written here is the manifest temp file
+	char sManifest[sizeof(m_sOutputDir) + 32];
+	char sTmp[sizeof(m_sOutputDir) + 32];
+	if (snprintf(m_sOutputDir, sizeof(m_sOutputDir), "%s", sOutputDir) >= int(sizeof(m_sOutputDir)))
+	{
+		printf("ERROR: Output directory path too long \"%s\"\n", sOutputDir);
+		return false;
+	}
+	snprintf(sManifest, sizeof(sManifest), "%s/%s", m_sOutputDir, kManifestName);
+	snprintf(sTmp, sizeof(sTmp), "%s/%s.tmp", m_sOutputDir, kManifestName);
+	m_replayRate = replayRate;
+	m_durationByDefaultInSec = durationByDefaultInSec;
+
+	// previous runs, and manifest re-written without duplicates or truncated last line
+	LoadManifest();
+	FILE* h = fopen(sTmp, "wb");
+	if (NULL == h)
+	{
+		Release();
+		return false;
+	}
+	for (int i = 0; i < m_manifestSize; i++)
+	{
+		const ManifestItem& item = m_manifest[i];
+		if (item.leader)
+			fprintf(h, "= %016llx %s\t%s\n", (unsigned long long)item.hash, item.name, item.leader);
+		else
+			fprintf(h, "%016llx %d %d %d %s\n", (unsigned long long)item.hash, item.version, item.replayRate, item.subsong, item.name);
+	}
+	if ((0 != fclose(h)) || (!replaceFile(sTmp, sManifest)))
+	{
+		printf("ERROR: Unable to write \"%s\"\n", sManifest);
+		remove(sTmp);
+		Release();
+		return false;
+	}
+	m_hManifest = fopen(sManifest, "ab");
+	if (NULL == m_hManifest)
+	{
+		Release();
+		return false;
+	}
+
+	if (!m_zipView.Open(sZipFilename))
+	{
+		Release();
+		return false;
+	}
+	m_workersCount = JobSystem::GetHardwareWorkerCount();
+	if (m_workersCount > kMaxEmulationWorkers)
+		m_workersCount = kMaxEmulationWorkers;
+
+	// an entry is an alias only if its leader is rendered in this batch
+	int* sorted = (int*)malloc(count * sizeof(int));
+	memcpy(sorted, zipIndices, count * sizeof(int));
+	qsort(sorted, count, sizeof(int), fIntSort);
+	m_zipIndices = (int*)malloc(count * sizeof(int));
+	m_aliases = (Alias*)malloc(count * sizeof(Alias));
+	m_entryCount = 0;
+	m_aliasCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const int leader = leaders ? leaders[i] : zipIndices[i];
+		if ((leader != zipIndices[i]) && (bsearch(&leader, sorted, count, sizeof(int), fIntSort)))
+		{
+			m_aliases[m_aliasCount].zipIndex = zipIndices[i];
+			m_aliases[m_aliasCount].leader = leader;
+			m_aliasCount++;
+		}
+		else
+			m_zipIndices[m_entryCount++] = zipIndices[i];
+	}
+	free(sorted);
+	qsort(m_aliases, m_aliasCount, sizeof(Alias), fAliasSort);
+	m_cancel = false;
+	m_entryDone = 0;
+	m_renderedCount = 0;
+	m_skippedCount = 0;
+	m_failedCount = 0;
+	m_aliasDoneCount = 0;
+	m_active = true;
+	m_jobs.RunJobs(this, m_entryCount, sJobRenderEntry, NULL, m_workersCount);
+	return true;
+}
+
+void	BatchRender::Cancel()
+{
+	m_cancel = true;
+}
+
+bool	BatchRender::Update()
+{
+	if (m_active)
+	{
+		if ((m_jobs.Running()) && (!m_cancel))
+			return true;
+
+		// finished or cancelled: workers stop at next render chunk
+		m_jobs.Join();
+		Release();
+		m_active = false;
+	}
+	return false;
+}
+
+void	BatchRender::Release()
+{
+	m_sndhPool.UnloadAll();
+	m_workersCount = 0;
+	m_zipView.Close();
+	if (m_hManifest)
+	{
+		fclose(m_hManifest);
+		m_hManifest = NULL;
+	}
+	for (int i = 0; i < m_manifestSize; i++)
+	{
+		free(m_manifest[i].name);
+		free(m_manifest[i].leader);
+	}
+	free(m_manifest);
+	m_manifest = NULL;
+	m_manifestSize = 0;
+	free(m_zipIndices);
+	m_zipIndices = NULL;
+	free(m_aliases);
+	m_aliases = NULL;
+	m_aliasCount = 0;
+}
+
+int BatchRender::fManifestSort(const void* arg1, const void* arg2)
+{
+	const ManifestItem* a = (const ManifestItem*)arg1;
+	const ManifestItem* b = (const ManifestItem*)arg2;
+	int r = strcmp(a->name, b->name);
+	if (0 == r)
+		r = a->subsong - b->subsong;
+	if (0 == r)
+		r = a->line - b->line;
+	return r;
+}
+
+int BatchRender::fIntSort(const void* arg1, const void* arg2)
+{
+	const int a = *(const int*)arg1;
+	const int b = *(const int*)arg2;
+	return (a > b) - (a < b);
+}
+
+int BatchRender::fAliasSort(const void* arg1, const void* arg2)
+{
+	const Alias* a = (const Alias*)arg1;
+	const Alias* b = (const Alias*)arg2;
+	return (a->leader > b->leader) - (a->leader < b->leader);
+}
+
+void	BatchRender::LoadManifest()
+{
+	m_manifest = NULL;
+	m_manifestSize = 0;
+	char sManifest[sizeof(m_sOutputDir) + 32];
+	snprintf(sManifest, sizeof(sManifest), "%s/%s", m_sOutputDir, kManifestName);
+	FILE* h = fopen(sManifest, "rb");
+	if (NULL == h)
+		return;
+
+	int capacity = 0;
+	int line = 0;
+	char sLine[512];
+	while (fgets(sLine, sizeof(sLine), h))
+	{
+		// a line without end of line was being written when the previous run stopped
+		char* eol = strchr(sLine, '\n');
+		if (NULL == eol)
+			continue;
+		*eol = 0;
+		unsigned long long hash;
+		int version, replayRate, subsong, nameStart = 0;
+		char* leader = NULL;
+		if ((0 == strncmp(sLine, "= ", 2)) && (1 == sscanf(sLine, "= %llx %n", &hash, &nameStart)) && (nameStart > 0))
+		{
+			// alias line: "= <hash> <name>\t<leader name>"
+			leader = strchr(sLine + nameStart, '\t');
+			if ((NULL == leader) || (leader == sLine + nameStart) || (0 == leader[1]))
+				continue;
+			*leader++ = 0;
+			version = 0;
+			replayRate = 0;
+			subsong = 0;
+		}
+		else if ((4 != sscanf(sLine, "%llx %d %d %d %n", &hash, &version, &replayRate, &subsong, &nameStart)) || (nameStart <= 0) || (0 == sLine[nameStart]))
+			continue;
+
+		if (m_manifestSize == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 1024;
+			m_manifest = (ManifestItem*)realloc(m_manifest, capacity * sizeof(ManifestItem));
+		}
+		ManifestItem& item = m_manifest[m_manifestSize++];
+		item.name = _strdup(sLine + nameStart);
+		item.leader = leader ? _strdup(leader) : NULL;
+		item.subsong = subsong;
+		item.hash = hash;
+		item.version = version;
+		item.replayRate = replayRate;
+		item.line = line++;
+	}
+	fclose(h);
+
+	// sort by name & subsong (0 for an alias), only the last line of each pair is kept
+	qsort(m_manifest, m_manifestSize, sizeof(ManifestItem), fManifestSort);
+	int w = 0;
+	for (int r = 0; r < m_manifestSize; r++)
+	{
+		const bool last = (r + 1 == m_manifestSize) ||
+			(strcmp(m_manifest[r].name, m_manifest[r + 1].name) != 0) ||
+			(m_manifest[r].subsong != m_manifest[r + 1].subsong);
+		if (last)
+			m_manifest[w++] = m_manifest[r];
+		else
+		{
+			free(m_manifest[r].name);
+			free(m_manifest[r].leader);
+		}
+	}
+	m_manifestSize = w;
+}
+
+bool	BatchRender::IsUpToDate(const char* entryName, int subsong, uint64_t hash) const
+{
+	int lo = 0;
+	int hi = m_manifestSize - 1;
+	while (lo <= hi)
+	{
+		const int mid = (lo + hi) / 2;
+		const ManifestItem& item = m_manifest[mid];
+		int r = strcmp(entryName, item.name);
+		if (0 == r)
+			r = subsong - item.subsong;
+		if (0 == r)
+			return (item.hash == hash) && (ATARI_AUDIO_EMULATION_VERSION == item.version) && (int(m_replayRate) == item.replayRate);
+		if (r < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return false;
+}
+
+void	BatchRender::AppendManifest(const char* entryName, int subsong, uint64_t hash)
+{
+	std::lock_guard<std::mutex> lock(m_manifestLock);
+	fprintf(m_hManifest, "%016llx %d %d %d %s\n", (unsigned long long)hash, ATARI_AUDIO_EMULATION_VERSION, int(m_replayRate), subsong, entryName);
+	fflush(m_hManifest);
+}
+
+void	BatchRender::AppendAliases(int leaderZipIndex, const char* leaderName, uint64_t hash)
+{
+	int lo = 0;
+	int hi = m_aliasCount;
+	while (lo < hi)
+	{
+		const int mid = (lo + hi) / 2;
+		if (m_aliases[mid].leader < leaderZipIndex)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (int i = lo; (i < m_aliasCount) && (m_aliases[i].leader == leaderZipIndex); i++)
+	{
+		char aliasName[260];
+		m_zipView.GetEntryName(m_aliases[i].zipIndex, aliasName, sizeof(aliasName));
+		std::lock_guard<std::mutex> lock(m_manifestLock);
+		fprintf(m_hManifest, "= %016llx %s\t%s\n", (unsigned long long)hash, aliasName, leaderName);
+		fflush(m_hManifest);
+		m_aliasDoneCount++;
+	}
+}
+
+bool	BatchRender::sJobRenderEntry(void* user, int itemId, int workerId)
+{
+	BatchRender* _this = (BatchRender*)user;
+	const bool ret = _this->RenderEntry(itemId, workerId);
+	_this->m_entryDone++;
+	return ret;
+}
+
+bool	BatchRender::RenderEntry(int itemId, int workerId)
+{
+	if (m_cancel)
+		return false;
+
+	const int zipIndex = m_zipIndices[itemId];
+	int size;
+	void* unpack = m_zipView.ExtractAlloc(zipIndex, size);
+	if (NULL == unpack)
+	{
+		m_failedCount++;
+		return false;
+	}
+	char entryName[260];
+	m_zipView.GetEntryName(zipIndex, entryName, sizeof(entryName));
+
+	bool ret = false;
+	SndhFile& sndh = m_sndhPool.Get(workerId);
+	char baseName[260];
+	if ((outputBaseName(entryName, baseName, sizeof(baseName))) && (sndh.Load(unpack, size, m_replayRate)))
+	{
+		const uint64_t hash = SndhImage::ContentHash(unpack, size);
+		const int subsongCount = sndh.GetSubsongCount();
+		ret = true;
+		for (int s = 1; (s <= subsongCount) && (!m_cancel); s++)
+		{
+			char sOutFilename[sizeof(m_sOutputDir) + sizeof(baseName) + 16];
+			if ((snprintf(sOutFilename, sizeof(sOutFilename), "%s/%s_%02d.flac", m_sOutputDir, baseName, s) >= int(sizeof(sOutFilename))) ||
+				(!makeParentDirectories(sOutFilename, int(strlen(m_sOutputDir)) + 1)))
+			{
+				m_failedCount++;
+				ret = false;
+				break;
+			}
+			if ((IsUpToDate(entryName, s, hash)) && (fileExists(sOutFilename)))
+			{
+				m_skippedCount++;
+				continue;
+			}
+			if (RenderSubsong(sndh, s, sOutFilename, hash, entryName))
+				m_renderedCount++;
+			else if (!m_cancel)
+			{
+				m_failedCount++;
+				ret = false;
+			}
+		}
+
+		// exact duplicates are recorded only when all the files they stand for are there
+		if ((ret) && (!m_cancel))
+			AppendAliases(zipIndex, entryName, hash);
+	}
+	else
+	{
+		m_failedCount++;
+	}
+	sndh.Unload();
+	free(unpack);
+	return ret;
+}
+
+bool	BatchRender::RenderSubsong(SndhFile& sndh, int subsong, const char* sOutFilename, uint64_t hash, const char* entryName)
+{
+	SndhFile::SubSongInfo info;
+	if (!sndh.GetSubsongInfo(subsong, info))
+		return false;
+
+	int lenInSec = m_durationByDefaultInSec;
+	if ((info.playerTickCount > 0) && (info.playerTickRate > 0))
+		lenInSec = info.playerTickCount / info.playerTickRate;
+	if (lenInSec < 1)
+		return false;
+
+	sndh.SetStereoPanning(kYmPanning);
+	if (!sndh.InitSubSong(subsong))
+		return false;
+
+	const int channelCount = sndh.GetChannelCount();
+	FlacWriter flac;
+	if (!flac.Open(sOutFilename, m_replayRate, channelCount, 1))
+		return false;
+
+	int16_t buffer[kRenderChunk * 2];
+	uint32_t remaining = uint32_t(lenInSec) * m_replayRate;
+	while ((remaining > 0) && (!m_cancel))
+	{
+		const int count = (remaining < uint32_t(kRenderChunk)) ? int(remaining) : kRenderChunk;
+		sndh.AudioRender(buffer, count);
+		flac.AddAudioData(buffer, count);
+		remaining -= count;
+	}
+
+	// checkpoint only complete files, a cancelled one is removed and rendered again next time
+	bool ret = flac.Close();
+	if ((ret) && (0 == remaining))
+		AppendManifest(entryName, subsong, hash);
+	else
+	{
+		remove(sOutFilename);
+		ret = false;
+	}
+	return ret;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "../AtariAudio/AtariAudio.h"
+#include "jobSystem.h"
+#include "SndhWorkerPool.h"
+#include "ZipView.h"
+
+// Render every subsong of a list of SNDH archive entries to FLAC files, one SndhFile per job worker.
+// Each finished file is appended to "manifest.txt" in the output directory (source content hash, emulation
+// version, replay rate). Next run skips subsongs already listed with the same values, so an interrupted
+// or cancelled batch resumes where it stopped, and only files changed since are rendered again.
+// Exact duplicates of another listed entry aren't rendered: once their leader is done, an alias line
+// "= <hash> <name>\t<leader name>" is appended instead, so the manifest still covers every entry
+class BatchRender
+{
+public:
+	BatchRender();
+	~BatchRender();
+
+	// leaders (optional): per entry, zip index of the entry it's an exact duplicate of (itself if unique)
+	bool	Start(const char* sZipFilename, const int* zipIndices, const int* leaders, int count, const char* sOutputDir, uint32_t replayRate, int durationByDefaultInSec);
+	void	Cancel();
+	bool	IsRunning() const { return m_active; }
+	bool	Update();				// call regularly from the UI thread, returns true while the batch is running
+
+	int		GetProgress() const { return m_entryCount ? (m_entryDone * 100) / m_entryCount : 0; }
+	int		GetRenderedCount() const { return m_renderedCount; }
+	int		GetSkippedCount() const { return m_skippedCount; }
+	int		GetFailedCount() const { return m_failedCount; }
+	int		GetAliasCount() const { return m_aliasDoneCount; }
+
+private:
+	static const int kRenderChunk = 4096;
+	static const char* kManifestName;
+
+	struct ManifestItem
+	{
+		char*		name;
+		char*		leader;			// alias line (subsong 0), NULL for a rendered file
+		int			subsong;
+		uint64_t	hash;
+		int			version;
+		int			replayRate;
+		int			line;			// later lines override earlier ones
+	};
+
+	struct Alias
+	{
+		int		zipIndex;
+		int		leader;
+	};
+
+	static bool	sJobRenderEntry(void* user, int itemId, int workerId);
+	bool	RenderEntry(int itemId, int workerId);
+	bool	RenderSubsong(SndhFile& sndh, int subsong, const char* sOutFilename, uint64_t hash, const char* entryName);
+	void	LoadManifest();
+	bool	IsUpToDate(const char* entryName, int subsong, uint64_t hash) const;
+	void	AppendManifest(const char* entryName, int subsong, uint64_t hash);
+	void	AppendAliases(int leaderZipIndex, const char* leaderName, uint64_t hash);
+	void	Release();
+	static int	fManifestSort(const void* arg1, const void* arg2);
+	static int	fIntSort(const void* arg1, const void* arg2);
+	static int	fAliasSort(const void* arg1, const void* arg2);
+
+	char			m_sOutputDir[260];
+	uint32_t		m_replayRate;
+	int				m_durationByDefaultInSec;
+	int*			m_zipIndices;
+	int				m_entryCount;
+	Alias*			m_aliases;			// sorted by leader
+	int				m_aliasCount;
+
+	JobSystem		m_jobs;
+	int				m_workersCount;
+	ZipView			m_zipView;
+	SndhWorkerPool	m_sndhPool;
+	bool			m_active;
+	std::atomic<bool>	m_cancel;
+	std::atomic<int>	m_entryDone;
+	std::atomic<int>	m_renderedCount;
+	std::atomic<int>	m_skippedCount;
+	std::atomic<int>	m_failedCount;
+	std::atomic<int>	m_aliasDoneCount;
+
+	// manifest is read only during the batch, new lines are appended (and flushed) as soon as a file is done
+	ManifestItem*	m_manifest;
+	int				m_manifestSize;
+	FILE*			m_hManifest;
+	std::mutex		m_manifestLock;
+};
@@ -0,0 +1,695 @@
+#define	_CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "FlacWriter.h"
+
+// MSB first bit writer into a growable buffer
+class BitWriter
+{
+public:
+	BitWriter(uint8_t*& data, int& size, int& capacity) : m_data(data), m_size(size), m_capacity(capacity)
+	{
+		m_size = 0;
+		m_acc = 0;
+		m_bits = 0;
+	}
+
+	void	Put(uint32_t v, int n)
+	{
+		assert(n <= 32);
+		if (n < 32)
+			v &= (1u << n) - 1;
+		m_acc = (m_acc << n) | v;
+		m_bits += n;
+		while (m_bits >= 8)
+		{
+			m_bits -= 8;
+			Byte(uint8_t(m_acc >> m_bits));
+		}
+	}
+
+	void	PutSigned(int32_t v, int n)
+	{
+		Put(uint32_t(v), n);
+	}
+
+	// unary quotient (zeros ended by a one) then "k" low bits
+	void	PutRice(uint32_t u, int k)
+	{
+		uint32_t q = u >> k;
+		while (q >= 32)
+		{
+			Put(0, 32);
+			q -= 32;
+		}
+		if (q + 1 + k <= 32)
+		{
+			Put((1u << k) | (u & ((1u << k) - 1)), q + 1 + k);
+		}
+		else
+		{
+			Put(1, q + 1);
+			Put(u, k);
+		}
+	}
+
+	void	Align()
+	{
+		if (m_bits > 0)
+			Put(0, 8 - m_bits);
+	}
+
+	const uint8_t*	GetData() const { return m_data; }
+	int		GetSize() const { return m_size; }
+
+private:
+	void	Byte(uint8_t b)
+	{
+		if (m_size == m_capacity)
+		{
+			m_capacity = m_capacity ? m_capacity * 2 : 4096;
+			m_data = (uint8_t*)realloc(m_data, m_capacity);
+		}
+		m_data[m_size++] = b;
+	}
+
+	uint8_t*&	m_data;
+	int&		m_size;
+	int&		m_capacity;
+	uint64_t	m_acc;
+	int			m_bits;
+};
+
+static uint8_t	crc8(const uint8_t* data, int size)
+{
+	uint8_t crc = 0;
+	for (int i = 0; i < size; i++)
+	{
+		crc ^= data[i];
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 0x80) ? uint8_t((crc << 1) ^ 0x07) : uint8_t(crc << 1);
+	}
+	return crc;
+}
+
+static uint16_t	crc16(const uint8_t* data, int size)
+{
+	uint16_t crc = 0;
+	for (int i = 0; i < size; i++)
+	{
+		crc ^= uint16_t(data[i]) << 8;
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x8005) : uint16_t(crc << 1);
+	}
+	return crc;
+}
+
+static inline uint32_t	zigzag(int32_t v)
+{
+	return (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+}
+
+// Rice partitioning of a residual. Partition sums are computed at max order, then merged for lower orders
+struct RiceSetup
+{
+	int		partitionOrder;
+	int		params[1 << 8];
+};
+
+static int	riceParam(uint64_t sum, int count)
+{
+	int k = 0;
+	while ((k < 14) && ((uint64_t(count) << (k + 1)) < sum))
+		k++;
+	return k;
+}
+
+// returns estimated residual bits (coding method and partition order fields included)
+static uint32_t	chooseRice(const int32_t* residual, int blockSize, int predictorOrder, int maxPartitionOrder, RiceSetup& out)
+{
+	// highest order such as each partition is bigger than predictor order
+	int maxOrder = 0;
+	while ((maxOrder < maxPartitionOrder) && (0 == (blockSize & ((2 << maxOrder) - 1))) && ((blockSize >> (maxOrder + 1)) > predictorOrder))
+		maxOrder++;
+
+	uint64_t sums[1 << 8];
+	const int partCount = 1 << maxOrder;
+	const int partSize = blockSize >> maxOrder;
+	int pos = 0;
+	for (int p = 0; p < partCount; p++)
+	{
+		const int count = (0 == p) ? partSize - predictorOrder : partSize;
+		uint64_t sum = 0;
+		for (int i = 0; i < count; i++)
+			sum += zigzag(residual[pos + i]);
+		sums[p] = sum;
+		pos += count;
+	}
+
+	uint32_t bestBits = ~0u;
+	for (int order = maxOrder; order >= 0; order--)
+	{
+		const int count = 1 << order;
+		const int size = blockSize >> order;
+		uint32_t bits = 2 + 4;
+		int params[1 << 8];
+		for (int p = 0; p < count; p++)
+		{
+			const int n = (0 == p) ? size - predictorOrder : size;
+			const int k = riceParam(sums[p], n);
+			params[p] = k;
+			bits += 4 + n * (k + 1) + uint32_t(sums[p] >> k);
+		}
+		if (bits < bestBits)
+		{
+			bestBits = bits;
+			out.partitionOrder = order;
+			memcpy(out.params, params, count * sizeof(int));
+		}
+		// merge partitions for the next lower order
+		for (int p = 0; p < count / 2; p++)
+			sums[p] = sums[p * 2] + sums[p * 2 + 1];
+	}
+	return bestBits;
+}
+
+static void	writeResidual(BitWriter& bw, const int32_t* residual, int blockSize, int predictorOrder, const RiceSetup& rice)
+{
+	bw.Put(0, 2);			// 4 bits rice parameters
+	bw.Put(rice.partitionOrder, 4);
+	const int count = 1 << rice.partitionOrder;
+	const int size = blockSize >> rice.partitionOrder;
+	for (int p = 0; p < count; p++)
+	{
+		const int n = (0 == p) ? size - predictorOrder : size;
+		const int k = rice.params[p];
+		bw.Put(k, 4);
+		for (int i = 0; i < n; i++)
+			bw.PutRice(zigzag(residual[i]), k);
+		residual += n;
+	}
+}
+
+static void	fixedResidual(const int32_t* x, int n, int order, int32_t* residual)
+{
+	for (int i = order; i < n; i++)
+	{
+		int32_t r;
+		switch (order)
+		{
+		case 0:	r = x[i];	break;
+		case 1:	r = x[i] - x[i - 1];	break;
+		case 2:	r = x[i] - 2 * x[i - 1] + x[i - 2];	break;
+		case 3:	r = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];	break;
+		default:	r = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];	break;
+		}
+		residual[i - order] = r;
+	}
+}
+
+// best fixed predictor order, from the sum of absolute residuals of each order
+static int	bestFixedOrder(const int32_t* x, int n, uint64_t* pBestSum = NULL)
+{
+	uint64_t sum[5] = { 0, 0, 0, 0, 0 };
+	for (int i = 4; i < n; i++)
+	{
+		const int32_t e0 = x[i];
+		const int32_t e1 = e0 - x[i - 1];
+		const int32_t e2 = e1 - (x[i - 1] - x[i - 2]);
+		const int32_t e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+		const int32_t e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+		sum[0] += uint32_t(abs(e0));
+		sum[1] += uint32_t(abs(e1));
+		sum[2] += uint32_t(abs(e2));
+		sum[3] += uint32_t(abs(e3));
+		sum[4] += uint32_t(abs(e4));
+	}
+	int best = 0;
+	for (int o = 1; o <= 4; o++)
+	{
+		if (sum[o] < sum[best])
+			best = o;
+	}
+	if (pBestSum)
+		*pBestSum = sum[best];
+	return best;
+}
+
+// LPC coefficients of each order (1 to maxOrder) from windowed autocorrelation (Levinson-Durbin)
+static int	computeLpc(const int32_t* x, int n, int maxOrder, double lpc[][16])
+{
+	static const int kMaxN = 4096;
+	assert(n <= kMaxN);
+	double w[kMaxN];
+	// tukey(0.5) window
+	const int taper = n / 4;
+	for (int i = 0; i < n; i++)
+	{
+		double g = 1.0;
+		if (i < taper)
+			g = 0.5 - 0.5 * cos(3.14159265358979 * i / taper);
+		else if (i >= n - taper)
+			g = 0.5 - 0.5 * cos(3.14159265358979 * (n - 1 - i) / taper);
+		w[i] = x[i] * g;
+	}
+
+	double r[16];
+	for (int lag = 0; lag <= maxOrder; lag++)
+	{
+		double s = 0.0;
+		for (int i = lag; i < n; i++)
+			s += w[i] * w[i - lag];
+		r[lag] = s;
+	}
+	if (r[0] <= 0.0)
+		return 0;
+
+	double a[16] = { 0 };
+	double err = r[0];
+	int order = 0;
+	for (int m = 1; m <= maxOrder; m++)
+	{
+		double k = r[m];
+		for (int j = 1; j < m; j++)
+			k -= a[j] * r[m - j];
+		k /= err;
+		double prev[16];
+		memcpy(prev, a, sizeof(a));
+		a[m] = k;
+		for (int j = 1; j < m; j++)
+			a[j] = prev[j] - k * prev[m - j];
+		err *= (1.0 - k * k);
+		for (int j = 0; j < m; j++)
+			lpc[m - 1][j] = a[j + 1];
+		order = m;
+		if (err <= 0.0)
+			break;
+	}
+	return order;
+}
+
+static bool	quantizeLpc(const double* lpc, int order, int precision, int32_t* qlp, int& shift)
+{
+	double cmax = 0.0;
+	for (int i = 0; i < order; i++)
+	{
+		if (fabs(lpc[i]) > cmax)
+			cmax = fabs(lpc[i]);
+	}
+	if (cmax <= 0.0)
+		return false;
+
+	int log2cmax;
+	frexp(cmax, &log2cmax);
+	log2cmax--;
+	precision--;			// sign bit
+	shift = precision - log2cmax - 1;
+	if (shift > 15)
+		shift = 15;
+	if (shift < 0)
+		return false;
+
+	const int32_t qmax = (1 << precision) - 1;
+	const int32_t qmin = -(1 << precision);
+	double error = 0.0;
+	for (int i = 0; i < order; i++)
+	{
+		error += lpc[i] * double(1 << shift);
+		int32_t q = int32_t(floor(error + 0.5));
+		if (q > qmax)
+			q = qmax;
+		else if (q < qmin)
+			q = qmin;
+		error -= q;
+		qlp[i] = q;
+	}
+	return true;
+}
+
+static void	lpcResidual(const int32_t* x, int n, const int32_t* qlp, int order, int shift, int32_t* residual)
+{
+	for (int i = order; i < n; i++)
+	{
+		int64_t sum = 0;
+		for (int j = 0; j < order; j++)
+			sum += int64_t(qlp[j]) * x[i - j - 1];
+		residual[i - order] = x[i] - int32_t(sum >> shift);
+	}
+}
+
+static void	writeSubframeHeader(BitWriter& bw, uint32_t type)
+{
+	bw.Put(0, 1);
+	bw.Put(type, 6);
+	bw.Put(0, 1);		// no wasted bits
+}
+
+// Encode one channel with the smallest of constant, verbatim, fixed or LPC subframe
+static void	encodeSubframe(BitWriter& bw, const int32_t* x, int n, int bps, int maxLpcOrder, int lpcPrecision, int maxPartitionOrder)
+{
+	bool constant = true;
+	for (int i = 1; (i < n) && (constant); i++)
+		constant = (x[i] == x[0]);
+	if (constant)
+	{
+		writeSubframeHeader(bw, 0);
+		bw.PutSigned(x[0], bps);
+		return;
+	}
+
+	int32_t residual[4096];
+	int32_t candidate[4096];
+	RiceSetup rice;
+	RiceSetup candidateRice;
+
+	// fixed predictor
+	int fixedOrder = bestFixedOrder(x, n);
+	if (fixedOrder >= n)
+		fixedOrder = 0;
+	fixedResidual(x, n, fixedOrder, residual);
+	uint32_t bestBits = 8 + fixedOrder * bps + chooseRice(residual, n, fixedOrder, maxPartitionOrder, rice);
+	int bestType = 0x08 | fixedOrder;
+	int bestOrder = fixedOrder;
+	int32_t bestQlp[32];
+	int bestShift = 0;
+
+	// LPC predictors (each order is tried)
+	double lpc[16][16];
+	const int lpcOrders = (n > maxLpcOrder * 2) ? computeLpc(x, n, maxLpcOrder, lpc) : 0;
+	for (int order = 1; order <= lpcOrders; order++)
+	{
+		int32_t qlp[32];
+		int shift;
+		if (!quantizeLpc(lpc[order - 1], order, lpcPrecision, qlp, shift))
+			continue;
+		lpcResidual(x, n, qlp, order, shift, candidate);
+		const uint32_t bits = 8 + order * bps + 4 + 5 + order * lpcPrecision + chooseRice(candidate, n, order, maxPartitionOrder, candidateRice);
+		if (bits < bestBits)
+		{
+			bestBits = bits;
+			bestType = 0x20 | (order - 1);
+			bestOrder = order;
+			memcpy(bestQlp, qlp, order * sizeof(int32_t));
+			bestShift = shift;
+			memcpy(residual, candidate, (n - order) * sizeof(int32_t));
+			rice = candidateRice;
+		}
+	}
+
+	if (bestBits >= uint32_t(8 + n * bps))
+	{
+		writeSubframeHeader(bw, 1);
+		for (int i = 0; i < n; i++)
+			bw.PutSigned(x[i], bps);
+		return;
+	}
+
+	writeSubframeHeader(bw, bestType);
+	for (int i = 0; i < bestOrder; i++)
+		bw.PutSigned(x[i], bps);
+	if (bestType & 0x20)
+	{
+		bw.Put(lpcPrecision - 1, 4);
+		bw.PutSigned(bestShift, 5);
+		for (int i = 0; i < bestOrder; i++)
+			bw.PutSigned(bestQlp[i], lpcPrecision);
+	}
+	writeResidual(bw, residual, n, bestOrder, rice);
+}
+
+static void	putUtf8(BitWriter& bw, uint32_t v)
+{
+	if (v < 0x80)
+	{
+		bw.Put(v, 8);
+		return;
+	}
+	int extra = 1;
+	while ((extra < 6) && (v >= (1u << (6 + extra * 5))))
+		extra++;
+	bw.Put((0xff00 >> (extra + 1)) | (v >> (6 * extra)), 8);
+	for (int i = extra - 1; i >= 0; i--)
+		bw.Put(0x80 | ((v >> (6 * i)) & 0x3f), 8);
+}
+
+FlacWriter::FlacWriter()
+{
+	m_h = NULL;
+	m_batches[0] = NULL;
+	m_batches[1] = NULL;
+}
+
+FlacWriter::~FlacWriter()
+{
+	if (m_h)
+		Close();
+}
+
+bool	FlacWriter::Open(const char* sFilename, int samplingRate, int channelCount /* = 2 */, int workersCount /* = 0 */)
+{
+	assert((channelCount >= 1) && (channelCount <= 2));
+	m_h = fopen(sFilename, "wb");
+	if (NULL == m_h)
+	{
+		printf("ERROR: Unable to write file \"%s\"\n", sFilename);
+		return false;
+	}
+	m_samplingRate = samplingRate;
+	m_channelCount = channelCount;
+	m_workersCount = workersCount;
+	m_sampleCount = 0;
+	m_frameNumber = 0;
+	m_minFrameSize = ~0u;
+	m_maxFrameSize = 0;
+	m_ioError = false;
+	for (int b = 0; b < 2; b++)
+	{
+		m_batches[b] = (Frame*)malloc(kBatchFrames * sizeof(Frame));
+		for (int f = 0; f < kBatchFrames; f++)
+		{
+			m_batches[b][f].data = NULL;
+			m_batches[b][f].size = 0;
+			m_batches[b][f].capacity = 0;
+			m_batches[b][f].sampleCount = 0;
+		}
+		m_batchFill[b] = 0;
+	}
+	m_currentBatch = 0;
+	m_encodingBatch = -1;
+
+	// stream info is written again at Close, with sample count & frame sizes
+	WriteStreamInfo();
+	return true;
+}
+
+void	FlacWriter::WriteStreamInfo()
+{
+	uint8_t* data = NULL;
+	int size, capacity = 0;
+	{
+		BitWriter bw(data, size, capacity);
+		bw.Put(0x664c6143, 32);			// "fLaC"
+		bw.Put(1, 1);					// last metadata block
+		bw.Put(0, 7);					// STREAMINFO
+		bw.Put(34, 24);
+		bw.Put(kBlockSize, 16);
+		bw.Put(kBlockSize, 16);
+		bw.Put((m_maxFrameSize > 0) ? m_minFrameSize : 0, 24);
+		bw.Put(m_maxFrameSize, 24);
+		bw.Put(m_samplingRate, 20);
+		bw.Put(m_channelCount - 1, 3);
+		bw.Put(16 - 1, 5);
+		bw.Put(uint32_t(m_sampleCount >> 32), 4);
+		bw.Put(uint32_t(m_sampleCount), 32);
+		for (int i = 0; i < 4; i++)
+			bw.Put(0, 32);				// no MD5 signature
+		assert(kStreamInfoSize == bw.GetSize());
+	}
+	if (size_t(size) != fwrite(data, 1, size, m_h))
+		m_ioError = true;
+	free(data);
+}
+
+void	FlacWriter::AddAudioData(const int16_t* data, int sampleCount)
+{
+	if (NULL == m_h)
+		return;
+
+	m_sampleCount += sampleCount;
+	while (sampleCount > 0)
+	{
+		Frame& frame = m_batches[m_currentBatch][m_batchFill[m_currentBatch]];
+		int count = kBlockSize - frame.sampleCount;
+		if (count > sampleCount)
+			count = sampleCount;
+		memcpy(frame.samples + frame.sampleCount * m_channelCount, data, count * m_channelCount * sizeof(int16_t));
+		frame.sampleCount += count;
+		data += count * m_channelCount;
+		sampleCount -= count;
+		if (kBlockSize == frame.sampleCount)
+		{
+			frame.frameNumber = m_frameNumber++;
+			if (++m_batchFill[m_currentBatch] == kBatchFrames)
+				SubmitBatch();
+		}
+	}
+}
+
+bool	FlacWriter::sEncodeFrameJob(void* userContext, int index, int /*workerId*/)
+{
+	FlacWriter* _this = (FlacWriter*)userContext;
+	_this->EncodeFrame(_this->m_batches[_this->m_encodingBatch][index]);
+	return true;
+}
+
+// wait for the previous batch and write it, then start encoding of the current one
+void	FlacWriter::SubmitBatch()
+{
+	WriteEncodedBatch();
+	if (m_batchFill[m_currentBatch] > 0)
+	{
+		m_encodingBatch = m_currentBatch;
+		m_jobs.RunJobs(this, m_batchFill[m_currentBatch], sEncodeFrameJob, NULL, m_workersCount);
+		m_currentBatch ^= 1;
+		assert(0 == m_batchFill[m_currentBatch]);
+	}
+}
+
+void	FlacWriter::WriteEncodedBatch()
+{
+	if (m_encodingBatch >= 0)
+	{
+		m_jobs.Join();
+		Frame* frames = m_batches[m_encodingBatch];
+		for (int f = 0; f < m_batchFill[m_encodingBatch]; f++)
+		{
+			Frame& frame = frames[f];
+			if (size_t(frame.size) != fwrite(frame.data, 1, frame.size, m_h))
+				m_ioError = true;
+			if (uint32_t(frame.size) < m_minFrameSize)
+				m_minFrameSize = frame.size;
+			if (uint32_t(frame.size) > m_maxFrameSize)
+				m_maxFrameSize = frame.size;
+			frame.sampleCount = 0;
+		}
+		m_batchFill[m_encodingBatch] = 0;
+		m_encodingBatch = -1;
+	}
+}
+
+void	FlacWriter::EncodeFrame(Frame& frame) const
+{
+	const int n = frame.sampleCount;
+	int32_t signal[4][kBlockSize];		// left (or mono), right, mid, side
+	for (int i = 0; i < n; i++)
+	{
+		const int32_t left = frame.samples[i * m_channelCount];
+		signal[0][i] = left;
+		if (2 == m_channelCount)
+		{
+			const int32_t right = frame.samples[i * 2 + 1];
+			signal[1][i] = right;
+			signal[2][i] = (left + right) >> 1;
+			signal[3][i] = left - right;
+		}
+	}
+
+	// stereo decorrelation: pick the channel pair with the smallest fixed predictor estimation
+	int assignment = 0;
+	const int32_t* channels[2] = { signal[0], signal[1] };
+	int bps[2] = { 16, 16 };
+	if (2 == m_channelCount)
+	{
+		uint64_t cost[4];
+		for (int c = 0; c < 4; c++)
+			bestFixedOrder(signal[c], n, &cost[c]);
+		enum { kIndependent = 1, kLeftSide = 8, kRightSide = 9, kMidSide = 10 };
+		uint64_t best = cost[0] + cost[1];
+		assignment = kIndependent;
+		if (cost[0] + cost[3] < best)
+		{
+			best = cost[0] + cost[3];
+			assignment = kLeftSide;
+		}
+		if (cost[1] + cost[3] < best)
+		{
+			best = cost[1] + cost[3];
+			assignment = kRightSide;
+		}
+		if (cost[2] + cost[3] < best)
+			assignment = kMidSide;
+
+		switch (assignment)
+		{
+		case kLeftSide:		channels[1] = signal[3];	bps[1] = 17;	break;
+		case kRightSide:	channels[0] = signal[3];	bps[0] = 17;	channels[1] = signal[1];	break;
+		case kMidSide:		channels[0] = signal[2];	channels[1] = signal[3];	bps[1] = 17;	break;
+		default:	break;
+		}
+	}
+
+	BitWriter bw(frame.data, frame.size, frame.capacity);
+	bw.Put(0x3ffe, 14);				// sync code
+	bw.Put(0, 1);
+	bw.Put(0, 1);					// fixed block size
+	bw.Put((kBlockSize == n) ? 12 : 7, 4);
+	int rateCode = 0;				// from STREAMINFO
+	switch (m_samplingRate)
+	{
+	case 22050:	rateCode = 8;	break;
+	case 44100:	rateCode = 9;	break;
+	case 48000:	rateCode = 10;	break;
+	case 96000:	rateCode = 11;	break;
+	default:	break;
+	}
+	bw.Put(rateCode, 4);
+	bw.Put(assignment, 4);
+	bw.Put(4, 3);					// 16 bits per sample
+	bw.Put(0, 1);
+	putUtf8(bw, frame.frameNumber);
+	if (kBlockSize != n)
+		bw.Put(n - 1, 16);
+	bw.Put(crc8(bw.GetData(), bw.GetSize()), 8);
+
+	for (int c = 0; c < m_channelCount; c++)
+		encodeSubframe(bw, channels[c], n, bps[c], kMaxLpcOrder, kLpcPrecision, kMaxPartitionOrder);
+
+	bw.Align();
+	bw.Put(crc16(bw.GetData(), bw.GetSize()), 16);
+}
+
+bool	FlacWriter::Close()
+{
+	bool ret = false;
+	if (m_h)
+	{
+		// last partial frame
+		Frame& last = m_batches[m_currentBatch][m_batchFill[m_currentBatch]];
+		if (last.sampleCount > 0)
+		{
+			last.frameNumber = m_frameNumber++;
+			m_batchFill[m_currentBatch]++;
+		}
+		SubmitBatch();
+		WriteEncodedBatch();
+
+		fseek(m_h, 0, SEEK_SET);
+		WriteStreamInfo();
+		if (0 != fclose(m_h))
+			m_ioError = true;
+		m_h = NULL;
+
+		for (int b = 0; b < 2; b++)
+		{
+			for (int f = 0; f < kBatchFrames; f++)
+				free(m_batches[b][f].data);
+			free(m_batches[b]);
+			m_batches[b] = NULL;
+		}
+		ret = !m_ioError;
+	}
+	return ret;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include "jobSystem.h"
+
+// Lossless FLAC file writer (16 bits, mono or stereo). Fixed & LPC predictors, Rice coded residual.
+// Frames are buffered by batches, and each batch is encoded by the job system while the next one is filled
+class FlacWriter
+{
+public:
+
+	FlacWriter();
+	~FlacWriter();
+
+	bool	Open(const char* sFilename, int samplingRate, int channelCount = 2, int workersCount = 0);	// 0 workers means one per hardware thread
+	void	AddAudioData(const int16_t* data, int sampleCount);		// sampleCount frames, interleaved if stereo
+	bool	Close();												// false if any disk write failed
+
+private:
+	static const int kBlockSize = 4096;
+	static const int kBatchFrames = 64;
+	static const int kMaxLpcOrder = 12;
+	static const int kLpcPrecision = 15;
+	static const int kMaxPartitionOrder = 8;
+	static const int kStreamInfoSize = 4 + 4 + 34;
+
+	struct Frame
+	{
+		int16_t		samples[kBlockSize * 2];		// interleaved input
+		int			sampleCount;
+		uint32_t	frameNumber;
+		uint8_t*	data;							// encoded frame
+		int			size;
+		int			capacity;
+	};
+
+	static bool	sEncodeFrameJob(void* userContext, int index, int workerId);
+	void	EncodeFrame(Frame& frame) const;
+	void	SubmitBatch();
+	void	WriteEncodedBatch();
+	void	WriteStreamInfo();
+
+	FILE*		m_h;
+	int			m_samplingRate;
+	int			m_channelCount;
+	int			m_workersCount;
+	uint64_t	m_sampleCount;
+	uint32_t	m_frameNumber;
+	uint32_t	m_minFrameSize;
+	uint32_t	m_maxFrameSize;
+	bool		m_ioError;
+
+	// one batch is filled by the caller while the other one is encoded
+	Frame*		m_batches[2];
+	int			m_batchFill[2];			// frames in batch (last one could be partial)
+	int			m_currentBatch;
+	int			m_encodingBatch;		// -1 if none
+	JobSystem	m_jobs;
+};
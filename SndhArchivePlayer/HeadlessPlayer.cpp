@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+#include "AsyncSndhStream.h"
+
+// Command line player without UI: streams a subsong through AsyncSndhStream to the selected sink, and reports
+// startup time and ring telemetry. Used to run and measure the streaming path on hosts without the Windows UI.
+// All text goes to stderr, so the raw sink can write PCM to stdout
+
+static const char* kBackendNames[] = { "device", "null", "wav", "raw", "flac" };
+
+static void	Usage()
+{
+	fprintf(stderr,	"usage: sndhplay <file.sndh> [options]\n"
+					"  -o <sink>      device, null, wav, raw or flac (default device)\n"
+					"  -t <target>    sink target: ALSA device name, output file, \"-\" or \"|command\" for raw\n"
+					"  -s <subsong>   subsong to play (default subsong of the file)\n"
+					"  -d <seconds>   play duration (default subsong length, or 180 if unknown)\n"
+					"  -r <rate>      replay rate (default 44100)\n");
+}
+
+static bool	ParseBackend(const char* name, AudioSink::Backend& out)
+{
+	for (int i = 0; i < int(sizeof(kBackendNames) / sizeof(kBackendNames[0])); i++)
+	{
+		if (0 == strcmp(name, kBackendNames[i]))
+		{
+			out = AudioSink::Backend(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* sFilename = NULL;
+	const char* sTarget = NULL;
+	AudioSink::Backend backend = AudioSink::kBackendDevice;
+	int subSongId = 0;
+	int durationInSec = 0;
+	uint32_t replayRate = 44100;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const bool hasValue = (i + 1 < argc);
+		if ((0 == strcmp(argv[i], "-o")) && (hasValue))
+		{
+			if (!ParseBackend(argv[++i], backend))
+			{
+				fprintf(stderr, "Unknown sink \"%s\"\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "-t")) && (hasValue))
+			sTarget = argv[++i];
+		else if ((0 == strcmp(argv[i], "-s")) && (hasValue))
+			subSongId = atoi(argv[++i]);
+		else if ((0 == strcmp(argv[i], "-d")) && (hasValue))
+			durationInSec = atoi(argv[++i]);
+		else if ((0 == strcmp(argv[i], "-r")) && (hasValue))
+			replayRate = uint32_t(atoi(argv[++i]));
+		else if ((argv[i][0] != '-') && (NULL == sFilename))
+			sFilename = argv[i];
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+	if ((NULL == sFilename) || (replayRate < 8000) || (replayRate > 192000))
+	{
+		Usage();
+		return 1;
+	}
+
+	AudioSink* sink = AudioSink::Create(backend, sTarget);
+	if (NULL == sink)
+	{
+		fprintf(stderr, "Sink \"%s\" isn't available in this build\n", kBackendNames[backend]);
+		return 1;
+	}
+
+	AsyncSndhStream stream(sink);
+	if (!stream.LoadSndhFile(sFilename, replayRate))
+	{
+		fprintf(stderr, "Unable to load \"%s\"\n", sFilename);
+		return 1;
+	}
+
+	if (subSongId <= 0)
+		subSongId = stream.GetDefaultSubsong();
+	SndhFile::SubSongInfo info;
+	if (!stream.GetSubsongInfo(subSongId, info))
+	{
+		fprintf(stderr, "No subsong %d (%d subsongs)\n", subSongId, stream.GetSubsongCount());
+		return 1;
+	}
+	if (durationInSec <= 0)
+		durationInSec = ((info.playerTickCount > 0) && (info.playerTickRate > 0)) ? info.playerTickCount / info.playerTickRate : 180;
+
+	fprintf(stderr, "\"%s\" by %s, subsong %d/%d, %d sec at %d Hz to %s sink\n", info.musicName ? info.musicName : "?",
+		info.musicAuthor ? info.musicAuthor : "?", subSongId, info.subsongCount, durationInSec, replayRate, kBackendNames[backend]);
+
+	const auto t0 = std::chrono::steady_clock::now();
+	if (!stream.StartSubsong(subSongId, durationInSec))
+	{
+		fprintf(stderr, "Unable to start subsong %d\n", subSongId);
+		return 1;
+	}
+	const auto t1 = std::chrono::steady_clock::now();
+	fprintf(stderr, "Started in %.2f ms\n", std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+	// the music may be shorter than the given duration, so stop when the play position doesn't move anymore
+	AsyncSndhStream::StreamStats stats;
+	int lastPos = -1;
+	int stalled = 0;
+	while (stalled < 3)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		if (stream.CheckInitFailure())
+		{
+			fprintf(stderr, "Subsong %d init failed\n", subSongId);
+			return 1;
+		}
+		const int pos = stream.GetReplayPosInSec();
+		stream.GetStreamStats(stats);
+		fprintf(stderr, "%d:%02d  ring %3d/%d ms, %5d ms ahead, %u underruns\n", pos / 60, pos % 60,
+			stats.ringFillMs, stats.ringCapacityMs, stats.renderAheadMs, stats.underrunCount);
+		stalled = (pos == lastPos) ? stalled + 1 : 0;
+		lastPos = pos;
+		if (pos >= durationInSec)
+			break;
+	}
+
+	stream.GetStreamStats(stats);
+	fprintf(stderr, "%u underruns (%d ms of silence)\nRing fill histogram:", stats.underrunCount, int((uint64_t(stats.underrunFrames) * 1000) / replayRate));
+	for (int i = 0; i < AsyncSndhStream::kFillHistogramBins; i++)
+		fprintf(stderr, " %u", stats.fillHistogram[i]);
+	fprintf(stderr, "\n");
+
+	// stream doesn't own the sink output result: close it here, so a file sink write error is reported
+	const bool outputOk = sink->Close();
+	stream.Unload();
+	if (!outputOk)
+	{
+		fprintf(stderr, "Output \"%s\" write failed\n", sTarget ? sTarget : "-");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,84 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "MappedFile.h"
+
+MappedFile::MappedFile()
+{
+	m_data = NULL;
+	m_size = 0;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool	MappedFile::Open(const char* sFilename)
+{
+	Close();
+#ifdef _WIN32
+	m_hFile = CreateFileA(sFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == m_hFile)
+		return false;
+	LARGE_INTEGER size;
+	if ((GetFileSizeEx(m_hFile, &size)) && (size.QuadPart > 0))
+	{
+		m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hMapping)
+		{
+			m_data = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+			m_size = size_t(size.QuadPart);
+		}
+	}
+#else
+	int fd = open(sFilename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if ((0 == fstat(fd, &st)) && (st.st_size > 0))
+	{
+		void* p = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			m_data = p;
+			m_size = size_t(st.st_size);
+		}
+	}
+	close(fd);		// mapping stays valid
+#endif
+	if (NULL == m_data)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void	MappedFile::Close()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_data)
+		munmap((void*)m_data, m_size);
+#endif
+	m_data = NULL;
+	m_size = 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Read only memory mapped file (whole file is mapped, pages are loaded by the OS on first access)
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool	Open(const char* sFilename);
+	void	Close();
+	bool	IsOpen() const { return m_data != NULL; }
+
+	const void*	GetData() const { return m_data; }
+	size_t		GetSize() const { return m_size; }
+
+private:
+	const void*	m_data;
+	size_t		m_size;
+#ifdef _WIN32
+	void*		m_hFile;
+	void*		m_hMapping;
+#endif
+};
@@ -1,16 +1,40 @@
+#include <windows.h>
+#include <ctype.h>
 #include "SndhArchivePlayer.h"
 #include "SndhArchive.h"
 #include "jobSystem.h"
 
+static const char* kBatchOutputDir = "SNDH_Render";
+static const uint32_t kBatchReplayRate = 44100;
+static const int kBatchDurationByDefaultInSec = 4 * 60;
+static const int kRadixBits = 11;
 
 SndhArchive::SndhArchive()
 {
-	m_zipArchive = NULL;
 	m_list = NULL;
+	m_size = 0;
 	m_filteredList = NULL;
 	m_filterdSize = 0;
+	m_sortKeys[0].column = kColAuthor;
+	m_sortKeys[0].descending = false;
+	m_sortKeyCount = 1;
+	m_sortScratch = NULL;
+	m_radixKeys = NULL;
+	m_ranked = false;
 	m_firstSearchFocus = false;
 	m_asyncBrowse = false;
+	m_loadSlots = NULL;
+	m_loadSlotCount = 0;
+	m_loadLog = NULL;
+	m_loadLogWrite = 0;
+	m_loadLogRead = 0;
+	m_loadDone = 0;
+	m_mergeScratch = NULL;
+	m_playingZipIndex = -1;
+	m_playingRow = -1;
+	m_hideDuplicates = false;
+	m_sFilename[0] = 0;
+	m_batchRan = false;
 }
 
 SndhArchive::~SndhArchive()
@@ -24,116 +48,369 @@ bool SndhArchive::JobZipItemProcessing(void* user, int itemId, int workerId)
 	return snd->LoadZipEntry(itemId, workerId);
 }
 
-bool SndhArchive::JobZipItemComplete(void* user, int workerId)
+bool SndhArchive::LoadZipEntry(int itemId, int /*workerId*/)
 {
-	SndhArchive* snd = (SndhArchive*)user;
-	return snd->LoadZipEnd();
+	bool ret = false;
+	PlayListItem& item = m_loadSlots[itemId];
+	int size;
+	void* unpack = m_zipView.ExtractAlloc(item.zipIndex, size);
+	if (unpack)
+	{
+		SndhFile sndhFile;
+		if (sndhFile.Load(unpack, size, 44100, true))		// dummy host replay rate, only header is parsed (no copy)
+		{
+			SndhFile::SubSongInfo info;
+			if (sndhFile.GetSubsongInfo(sndhFile.GetDefaultSubsong(), info))
+			{
+				char fname[_MAX_PATH];
+				m_zipView.GetEntryName(item.zipIndex, fname, sizeof(fname));
+				item.author = info.musicAuthor ? _strdup(info.musicAuthor) : _strdup("Not defined");
+				item.title = info.musicName ? _strdup(info.musicName) : _strdup(fname);
+				item.duration = info.playerTickCount / info.playerTickRate;
+				item.year = (info.year && info.year[0]) ? _strdup(info.year) : NULL;
+				item.subsongCount = info.subsongCount;
+				item.authorKey = CollationKey(item.author);
+				item.titleKey = CollationKey(item.title);
+				item.yearValue = item.year ? atoi(item.year) : 0;
+				ret = true;
+			}
+		}
+	}
+	free(unpack);
+
+	// publish: the release store makes the slot content visible to the UI thread
+	if (ret)
+	{
+		const int pos = m_loadLogWrite.fetch_add(1);
+		m_loadLog[pos].store(itemId, std::memory_order_release);
+	}
+	m_loadDone++;
+	return ret;
 }
 
-bool SndhArchive::LoadZipEntry(int itemId, int workerId)
+// first 8 chars, lowered like _stricmp does, packed big endian: comparing keys is comparing the prefixes
+uint64_t	SndhArchive::CollationKey(const char* s)
 {
-	bool ret = false;
-	int progress = ((itemId+1) * 100) / m_size;
-	if (progress > m_progress)
-		m_progress = progress;
+	uint64_t key = 0;
+	int i = 0;
+	for (; (i < 8) && (s[i]); i++)
+		key = (key << 8) | uint8_t(tolower(uint8_t(s[i])));
+	if (0 == i)
+		return 0;
+	return key << ((8 - i) * 8);
+}
+
+int	SndhArchive::CompareColumn(const PlayListItem& a, const PlayListItem& b, int column) const
+{
+	switch (column)
+	{
+	case kColAuthor:
+		if (m_ranked)
+			return a.authorRank - b.authorRank;
+		if (a.authorKey != b.authorKey)
+			return (a.authorKey < b.authorKey) ? -1 : 1;
+		return _stricmp(a.author, b.author);
+	case kColTitle:
+		if (m_ranked)
+			return a.titleRank - b.titleRank;
+		if (a.titleKey != b.titleKey)
+			return (a.titleKey < b.titleKey) ? -1 : 1;
+		return _stricmp(a.title, b.title);
+	case kColDuration:
+		return a.duration - b.duration;
+	case kColSubsongs:
+		return a.subsongCount - b.subsongCount;
+	case kColYear:
+		return a.yearValue - b.yearValue;
+	default:
+		return 0;
+	}
+}
+
+// user sort columns, then author & title (former fixed order), then zip order so the result is unique
+int	SndhArchive::CompareItems(const PlayListItem& a, const PlayListItem& b) const
+{
+	for (int k = 0; k < m_sortKeyCount; k++)
+	{
+		const int r = CompareColumn(a, b, m_sortKeys[k].column);
+		if (r)
+			return m_sortKeys[k].descending ? -r : r;
+	}
+	int r = CompareColumn(a, b, kColAuthor);
+	if (0 == r)
+		r = CompareColumn(a, b, kColTitle);
+	if (0 == r)
+		r = a.zipIndex - b.zipIndex;
+	return r;
+}
+
+void	SndhArchive::SetSortSpecs(const ImGuiTableSortSpecs* specs)
+{
+	m_sortKeyCount = 0;
+	for (int i = 0; (i < specs->SpecsCount) && (m_sortKeyCount < kColCount); i++)
+	{
+		m_sortKeys[m_sortKeyCount].column = int(specs->Specs[i].ColumnUserID);
+		m_sortKeys[m_sortKeyCount].descending = (ImGuiSortDirection_Descending == specs->Specs[i].SortDirection);
+		m_sortKeyCount++;
+	}
+}
+
+// many authors & titles share their first 8 chars: once the archive is indexed, both string columns are
+// sorted once and each item gets the rank of its string, so any later sort only compares integers
+void	SndhArchive::BuildRanks()
+{
+	const SortKey savedKey = m_sortKeys[0];
+	const int savedCount = m_sortKeyCount;
+	m_ranked = false;
+	m_sortKeyCount = 1;
+	for (int column = kColAuthor; column <= kColTitle; column++)
+	{
+		m_sortKeys[0].column = column;
+		m_sortKeys[0].descending = false;
+		memcpy(m_mergeScratch, m_list, m_size * sizeof(int));
+		MergeSortList(m_mergeScratch, m_size);
+		int rank = 0;
+		for (int i = 0; i < m_size; i++)
+		{
+			PlayListItem& item = m_loadSlots[m_mergeScratch[i]];
+			if ((0 == i) || (CompareColumn(m_loadSlots[m_mergeScratch[i - 1]], item, column) != 0))
+				rank++;
+			if (kColAuthor == column)
+				item.authorRank = rank;
+			else
+				item.titleRank = rank;
+		}
+	}
+	m_sortKeys[0] = savedKey;
+	m_sortKeyCount = savedCount;
+	m_ranked = true;
+}
+
+// bottom-up merge sort of slot indices, ping-pong with m_sortScratch (only the indices move)
+void	SndhArchive::MergeSortList(int* list, int size)
+{
+	int* src = list;
+	int* dst = m_sortScratch;
+	for (int width = 1; width < size; width *= 2)
+	{
+		for (int lo = 0; lo < size; lo += 2 * width)
+		{
+			const int mid = (lo + width < size) ? lo + width : size;
+			const int hi = (lo + 2 * width < size) ? lo + 2 * width : size;
+			int a = lo;
+			int b = mid;
+			int w = lo;
+			while ((a < mid) && (b < hi))
+				dst[w++] = (CompareItems(m_loadSlots[src[b]], m_loadSlots[src[a]]) < 0) ? src[b++] : src[a++];
+			while (a < mid)
+				dst[w++] = src[a++];
+			while (b < hi)
+				dst[w++] = src[b++];
+		}
+		int* tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	if (src != list)
+		memcpy(list, src, size * sizeof(int));
+}
 
-	struct zip_t* zip = m_zipPerWorker[workerId];
+// only valid once ranked. Any other column is the load slot, that is the zip order
+uint32_t	SndhArchive::ColumnValue(int slot, int column) const
+{
+	const PlayListItem& item = m_loadSlots[slot];
+	switch (column)
+	{
+	case kColAuthor:	return uint32_t(item.authorRank);
+	case kColTitle:		return uint32_t(item.titleRank);
+	case kColDuration:	return uint32_t(item.duration);
+	case kColSubsongs:	return uint32_t(item.subsongCount);
+	case kColYear:		return uint32_t(item.yearValue);
+	default:			return uint32_t(slot);
+	}
+}
 
-	PlayListItem& item = m_list[itemId];
-	if (0 == zip_entry_openbyindex(zip, item.zipIndex))
+// LSD radix sort, same order as CompareItems: stable passes from the last tie-break (zip order) up to the
+// first user sort key. Each column key is read once, then only (key, index) pairs move
+void	SndhArchive::RadixSortList(int* list, int size)
+{
+	int columns[kColCount + 3];
+	bool descending[kColCount + 3];
+	int columnCount = 0;
+	columns[columnCount] = kColCount;
+	descending[columnCount++] = false;
+	columns[columnCount] = kColTitle;
+	descending[columnCount++] = false;
+	columns[columnCount] = kColAuthor;
+	descending[columnCount++] = false;
+	for (int k = m_sortKeyCount - 1; k >= 0; k--)
 	{
-		assert(!zip_entry_isdir(zip));
-		size_t size = zip_entry_size(zip);
-		void* unpack = calloc(1, size);
-		size_t depackSize = zip_entry_noallocread(zip, unpack, size);
-		if (depackSize == size)
+		columns[columnCount] = m_sortKeys[k].column;
+		descending[columnCount++] = m_sortKeys[k].descending;
+	}
+
+	int* src = list;
+	int* dst = m_sortScratch;
+	uint32_t* keys = m_radixKeys;
+	uint32_t* dstKeys = m_radixKeys + m_loadSlotCount;
+	int count[1 << kRadixBits];
+	for (int c = 0; c < columnCount; c++)
+	{
+		uint32_t maxKey = 0;
+		for (int i = 0; i < size; i++)
+		{
+			keys[i] = ColumnValue(src[i], columns[c]);
+			maxKey = (keys[i] > maxKey) ? keys[i] : maxKey;
+		}
+		if (descending[c])
 		{
-			const char* fname = zip_entry_name(zip);
-			SndhFile sndhFile;
-			if (sndhFile.Load(unpack, int(size), 44100))		// dummy host replay rate
+			for (int i = 0; i < size; i++)
+				keys[i] = maxKey - keys[i];
+		}
+
+		for (int shift = 0; (0 == shift) || ((shift < 32) && (maxKey >> shift)); shift += kRadixBits)
+		{
+			memset(count, 0, sizeof(count));
+			for (int i = 0; i < size; i++)
+				count[(keys[i] >> shift) & ((1 << kRadixBits) - 1)]++;
+			int pos = 0;
+			for (int d = 0; d < (1 << kRadixBits); d++)
 			{
-				SndhFile::SubSongInfo info;
-				if (sndhFile.GetSubsongInfo(sndhFile.GetDefaultSubsong(), info))
-				{
-					item.author = info.musicAuthor ? _strdup(info.musicAuthor) : _strdup("Not defined");
-					item.title = info.musicName ? _strdup(info.musicName) : _strdup(fname);
-					item.duration = info.playerTickCount / info.playerTickRate;
-					item.year = NULL;
-					item.subsongCount = info.subsongCount;
-					ret = true;
-				}
+				const int n = count[d];
+				count[d] = pos;
+				pos += n;
+			}
+			for (int i = 0; i < size; i++)
+			{
+				const int w = count[(keys[i] >> shift) & ((1 << kRadixBits) - 1)]++;
+				dst[w] = src[i];
+				dstKeys[w] = keys[i];
 			}
+			int* tmp = src;
+			src = dst;
+			dst = tmp;
+			uint32_t* tmpKeys = keys;
+			keys = dstKeys;
+			dstKeys = tmpKeys;
 		}
-		free(unpack);
 	}
-	zip_entry_close(zip);
-	if (!ret)
-		item.zipIndex = -1;
-	return ret;
+	if (src != list)
+		memcpy(list, src, size * sizeof(int));
+}
+
+void	SndhArchive::SortLists()
+{
+	if (!m_ranked)
+	{
+		MergeSortList(m_list, m_size);
+		MergeSortList(m_filteredList, m_filterdSize);
+		return;
+	}
+
+	// filtered list gets the new order without being sorted: mark its items, then walk the sorted list
+	RadixSortList(m_list, m_size);
+	memset(m_mergeScratch, 0, m_loadSlotCount * sizeof(int));
+	for (int i = 0; i < m_filterdSize; i++)
+		m_mergeScratch[m_filteredList[i]] = 1;
+	int n = 0;
+	for (int i = 0; i < m_size; i++)
+	{
+		if (m_mergeScratch[m_list[i]])
+			m_filteredList[n++] = m_list[i];
+	}
 }
 
-bool SndhArchive::LoadZipEnd()
+// merge sorted "add" items into the sorted "list" (room for size+addSize items), from the end so no copy of list is needed
+void	SndhArchive::MergeSorted(int* list, int size, const int* add, int addSize) const
 {
-	for (int t=0;t<m_zipWorkersCount;t++)
-		zip_close(m_zipPerWorker[t]);
+	int r = size - 1;
+	int a = addSize - 1;
+	int w = size + addSize - 1;
+	while (a >= 0)
+	{
+		if ((r >= 0) && (CompareItems(m_loadSlots[list[r]], m_loadSlots[add[a]]) > 0))
+			list[w--] = list[r--];
+		else
+			list[w--] = add[a--];
+	}
+}
 
-	// pack the list, removing not loaded items
-	const PlayListItem* r = m_list;
-	PlayListItem* w = m_list;
-	for (int i=0;i<m_size;i++)
+void	SndhArchive::ConsumeLoadLog()
+{
+	// grab every contiguous published slot (a worker could still be between fetch_add and store)
+	int count = 0;
+	while (m_loadLogRead < m_loadSlotCount)
 	{
-		if (r->zipIndex >= 0)
-			*w++ = *r;
-		r++;
+		const int slot = m_loadLog[m_loadLogRead].load(std::memory_order_acquire);
+		if (slot < 0)
+			break;
+		m_mergeScratch[count++] = slot;
+		m_loadLogRead++;
 	}
-	m_size = int(w - m_list);
-	m_firstSearchFocus = true;
-	qsort((void *)m_list, (size_t)m_size, sizeof(PlayListItem), fEntrySort);
-	RebuildFilterList();
-	return true;
+	if (0 == count)
+		return;
+
+	// sort the new batch only, then merge it in the already sorted list and filtered list
+	MergeSortList(m_mergeScratch, count);
+	MergeSorted(m_list, m_size, m_mergeScratch, count);
+	m_size += count;
+
+	int filteredCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (PassFilter(m_loadSlots[m_mergeScratch[i]]))
+			m_mergeScratch[filteredCount++] = m_mergeScratch[i];
+	}
+	MergeSorted(m_filteredList, m_filterdSize, m_mergeScratch, filteredCount);
+	m_filterdSize += filteredCount;
 }
 
-bool	SndhArchive::Open(const char* sFilename)
+bool	SndhArchive::Open(const char* sFilename, uint32_t hostReplayRate)
 {
 	Close();
 	bool ret = false;
 
-	m_zipArchive = zip_open(sFilename, 0, 'r');
-	if (m_zipArchive)
+	if (m_zipView.Open(sFilename))
 	{
-		int entryCount = int(zip_entries_total(m_zipArchive));
-		m_list = (PlayListItem*)malloc(entryCount * sizeof(PlayListItem));
-		memset(m_list, 0, entryCount * sizeof(PlayListItem));
-		m_filteredList = (PlayListItem*)malloc(entryCount * sizeof(PlayListItem));
-		m_size = 0;
+		snprintf(m_sFilename, sizeof(m_sFilename), "%s", sFilename);
+		const int entryCount = m_zipView.GetEntryCount();
+		m_loadSlots = (PlayListItem*)malloc(entryCount * sizeof(PlayListItem));
+		memset(m_loadSlots, 0, entryCount * sizeof(PlayListItem));
+		m_loadSlotCount = 0;
 		for (int i = 0; i < entryCount; i++)
 		{
-			if (0 == zip_entry_openbyindex(m_zipArchive, i))
+			if (!m_zipView.GetEntry(i).isDirectory)
 			{
-				int isdir = zip_entry_isdir(m_zipArchive);
-				if (!isdir)
-				{
-					m_list[m_size].zipIndex = i;
-					m_size++;
-				}
+				m_loadSlots[m_loadSlotCount].zipIndex = i;
+				m_loadSlotCount++;
 			}
-			zip_entry_close(m_zipArchive);
 		}
-		if (m_size > 0)
+		if (m_loadSlotCount > 0)
 		{
-			m_progress = 0;
-
-			m_zipWorkersCount = JobSystem::GetHardwareWorkerCount();
-			if (m_zipWorkersCount > kMaxZipWorkers)
-				m_zipWorkersCount = kMaxZipWorkers;
-			for (int w=0;w<m_zipWorkersCount;w++)
-				m_zipPerWorker[w] = zip_open(sFilename, 0, 'r');
-
+			m_list = (int*)malloc(m_loadSlotCount * sizeof(int));
+			m_filteredList = (int*)malloc(m_loadSlotCount * sizeof(int));
+			m_mergeScratch = (int*)malloc(m_loadSlotCount * sizeof(int));
+			m_sortScratch = (int*)malloc(m_loadSlotCount * sizeof(int));
+			m_radixKeys = (uint32_t*)malloc(2 * m_loadSlotCount * sizeof(uint32_t));
+			m_loadLog = new std::atomic<int>[m_loadSlotCount];
+			for (int i = 0; i < m_loadSlotCount; i++)
+				m_loadLog[i] = -1;
+			m_loadLogWrite = 0;
+			m_loadLogRead = 0;
+			m_loadDone = 0;
+			m_size = 0;
+			m_filterdSize = 0;
+			m_firstSearchFocus = true;
+			m_prefetcher.Open(&m_zipView, hostReplayRate);
 			m_asyncBrowse = true;
-			m_jsBrowse.RunJobs(this, m_size, JobZipItemProcessing, JobZipItemComplete, m_zipWorkersCount);
+			m_jsBrowse.RunJobs(this, m_loadSlotCount, JobZipItemProcessing, NULL, JobSystem::GetHardwareWorkerCount());
 
 			ret = true;
 		}
+		else
+		{
+			m_zipView.Close();
+		}
 	}
 	return ret;
 }
@@ -141,26 +418,82 @@ bool	SndhArchive::Open(const char* sFilename)
 void	SndhArchive::Close()
 {
 
-	if (m_jsBrowse.Running())
+	if (m_asyncBrowse)
+	{
 		m_jsBrowse.Join();
+		m_asyncBrowse = false;
+	}
 
-	if (m_zipArchive)
-		zip_close(m_zipArchive);
+	m_prefetcher.Close();
+	m_dedup.Stop();
+	m_zipView.Close();
+	m_playingZipIndex = -1;
+	m_playingRow = -1;
 
-	for (int i = 0; i < m_size; i++)
+	// lists are load slot indices, strings are owned by the load slots
+	for (int i = 0; i < m_loadSlotCount; i++)
 	{
-		free((void*)m_list[i].author);
-		free((void*)m_list[i].title);
+		free((void*)m_loadSlots[i].author);
+		free((void*)m_loadSlots[i].title);
+		free((void*)m_loadSlots[i].year);
 	}
+	free(m_loadSlots);
 	free(m_list);
 	free(m_filteredList);
+	free(m_mergeScratch);
+	free(m_sortScratch);
+	free(m_radixKeys);
+	delete[] m_loadLog;
+	m_loadSlots = NULL;
+	m_loadSlotCount = 0;
 	m_list = NULL;
 	m_filteredList = NULL;
-	m_filteredList = 0;
+	m_mergeScratch = NULL;
+	m_sortScratch = NULL;
+	m_radixKeys = NULL;
+	m_ranked = false;
+	m_loadLog = NULL;
 	m_size = 0;
 	m_filterdSize = 0;
 }
 
+void	SndhArchive::UpdatePrefetch(int hoveredRow, int firstVisibleRow)
+{
+	int zipIndices[kPrefetchCount];
+	int count = 0;
+	if (hoveredRow >= 0)
+		zipIndices[count++] = FilteredItem(hoveredRow).zipIndex;
+
+	// rows following the playing one in the current sort order, or the first visible ones if nothing is playing
+	int row = firstVisibleRow;
+	if (m_playingZipIndex >= 0)
+	{
+		if ((m_playingRow < 0) || (m_playingRow >= m_filterdSize) || (FilteredItem(m_playingRow).zipIndex != m_playingZipIndex))
+		{
+			m_playingRow = -1;
+			for (int i = 0; i < m_filterdSize; i++)
+			{
+				if (FilteredItem(i).zipIndex == m_playingZipIndex)
+				{
+					m_playingRow = i;
+					break;
+				}
+			}
+		}
+		if (m_playingRow >= 0)
+			row = m_playingRow + 1;
+	}
+	for (; (row < m_filterdSize) && (count < kPrefetchCount); row++)
+	{
+		const int zipIndex = FilteredItem(row).zipIndex;
+		if ((zipIndex != m_playingZipIndex) && ((0 == count) || (zipIndices[0] != zipIndex)))
+			zipIndices[count++] = zipIndex;
+	}
+
+	m_prefetcher.Request(zipIndices, count);
+	m_prefetcher.Update();
+}
+
 void OsOpenInShell(const char* path)
 {
 #ifdef _WIN32
@@ -189,7 +522,7 @@ void	SndhArchive::ImGuiDraw(SndhArchivePlayer& player)
 			{
 				ImGui::Text("Parsing large SNDH ZIP archive...");
 				ImGui::SameLine();
-				ImGui::ProgressBar(float(m_progress)/100.f);
+				ImGui::ProgressBar(float(m_loadDone) / float(m_loadSlotCount));
 			}
 			else
 			{
@@ -197,102 +530,186 @@ void	SndhArchive::ImGuiDraw(SndhArchivePlayer& player)
 				m_jsBrowse.Join();
 				m_asyncBrowse = false;
 			}
+			// already loaded files can be searched & played while the archive is still parsed
+			ConsumeLoadLog();
+			if (!m_asyncBrowse)
+			{
+				BuildRanks();
+				int* zipIndices = (int*)malloc(m_size * sizeof(int));
+				for (int i = 0; i < m_size; i++)
+					zipIndices[i] = m_loadSlots[m_list[i]].zipIndex;
+				m_dedup.Start(&m_zipView, zipIndices, m_size);
+				free(zipIndices);
+			}
 		}
 
-		if ( !m_asyncBrowse )
+		// duplicate groups are known: hidden ones leave the filtered list
+		const bool dedupWasReady = m_dedup.IsReady();
+		m_dedup.Update();
+		if ((!dedupWasReady) && (m_dedup.IsReady()) && (m_hideDuplicates))
+			RebuildFilterList();
+
+		if (IsOpen())
 		{
-			if (IsOpen())
+			ImGui::Text("Search:");
+			ImGui::SameLine();
+			if (m_firstSearchFocus)
+			{
+				ImGui::SetKeyboardFocusHere();
+				m_firstSearchFocus = false;
+			}
+			if (m_ImGuiFilter.Draw("Found:"))
+				RebuildFilterList();
+
+			int count = GetFilteredSize();
+			ImGui::SameLine();
+			ImGui::Text("%d files", count);
+
+			ImGui::SameLine();
+			if (m_batch.Update())
 			{
-				ImGui::Text("Search:");
+				ImGui::Text("Rendering (%d%%)", m_batch.GetProgress());
 				ImGui::SameLine();
-				if (m_firstSearchFocus)
+				if (ImGui::SmallButton("Cancel"))
+					m_batch.Cancel();
+			}
+			else
+			{
+				// whole archive render needs the complete list
+				ImGui::BeginDisabled(m_asyncBrowse);
+				const bool bRenderAll = ImGui::SmallButton("Render all to FLAC");
+				ImGui::EndDisabled();
+				if (bRenderAll)
 				{
-					ImGui::SetKeyboardFocusHere();
-					m_firstSearchFocus = false;
+					// same decoded image renders the same audio: exact duplicates are written as manifest aliases
+					// of their leader instead of being rendered (near ones are rendered)
+					int* zipIndices = (int*)malloc(m_size * sizeof(int));
+					int* leaders = (int*)malloc(m_size * sizeof(int));
+					for (int i = 0; i < m_size; i++)
+					{
+						zipIndices[i] = m_loadSlots[m_list[i]].zipIndex;
+						leaders[i] = m_dedup.GetLeader(zipIndices[i], true);
+					}
+					m_batchRan = m_batch.Start(m_sFilename, zipIndices, leaders, m_size, kBatchOutputDir, kBatchReplayRate, kBatchDurationByDefaultInSec);
+					free(leaders);
+					free(zipIndices);
 				}
-				if (m_ImGuiFilter.Draw("Found:"))
+			}
+			if ((m_batchRan) && (ImGui::IsItemHovered()))
+			{
+				ImGui::SetTooltip("Output: \"%s\"\n%d files rendered, %d up to date, %d failed\n%d duplicates recorded as aliases",
+					kBatchOutputDir, m_batch.GetRenderedCount(), m_batch.GetSkippedCount(), m_batch.GetFailedCount(), m_batch.GetAliasCount());
+			}
+
+			if (m_dedup.IsReady())
+			{
+				if (ImGui::Checkbox("Hide duplicates", &m_hideDuplicates))
 					RebuildFilterList();
+				if (ImGui::IsItemHovered())
+					ImGui::SetTooltip("%d exact duplicates (same file content)\n%d near duplicates (same audio)", m_dedup.GetExactDuplicateCount(), m_dedup.GetNearDuplicateCount());
+			}
+			else if (m_dedup.IsRunning())
+			{
+				ImGui::Text("Finding duplicates (%d%%)", m_dedup.GetProgress());
+			}
 
-				int count = GetFilteredSize();
-				ImGui::SameLine();
-				ImGui::Text("%d files", count);
-
-				// When using ScrollX or ScrollY we need to specify a size for our table container!
-				// Otherwise by default the table will fit all available space, like a BeginChild() call.
-				static ImGuiTableFlags flags = ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_Resizable | ImGuiTableFlags_Reorderable | ImGuiTableFlags_Hideable;
-				// 		ImVec2 outer_size = ImVec2(0.0f, ImGui::GetTextLineHeightWithSpacing() * 8);
-				// 		if (ImGui::BeginTable("table_scrolly", 3, flags, outer_size))
-
-		/*
-				static ImGuiTableFlags flags =
-					ImGuiTableFlags_Resizable | ImGuiTableFlags_Reorderable | ImGuiTableFlags_Hideable
-					| ImGuiTableFlags_Sortable | ImGuiTableFlags_SortMulti
-					| ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_NoBordersInBody
-					| ImGuiTableFlags_ScrollX | ImGuiTableFlags_ScrollY
-					| ImGuiTableFlags_SizingFixedFit;
-		*/
-				if (ImGui::BeginTable("table_advanced", 4, flags))
+			// When using ScrollX or ScrollY we need to specify a size for our table container!
+			// Otherwise by default the table will fit all available space, like a BeginChild() call.
+			static ImGuiTableFlags flags = ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_Resizable | ImGuiTableFlags_Reorderable | ImGuiTableFlags_Hideable
+				| ImGuiTableFlags_Sortable | ImGuiTableFlags_SortMulti;
+			if (ImGui::BeginTable("table_advanced", kColCount, flags))
+			{
+				ImGui::TableSetupScrollFreeze(0, 1); // Make top row always visible
+				ImGui::TableSetupColumn("Author", ImGuiTableColumnFlags_WidthStretch | ImGuiTableColumnFlags_DefaultSort, 40.0f, kColAuthor);
+				ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthStretch,40.0f, kColTitle);
+				ImGui::TableSetupColumn("Duration", ImGuiTableColumnFlags_WidthStretch,10.f, kColDuration);
+				ImGui::TableSetupColumn("Sub-Song", ImGuiTableColumnFlags_WidthStretch,10.f, kColSubsongs);
+				ImGui::TableSetupColumn("Year", ImGuiTableColumnFlags_WidthStretch,10.f, kColYear);
+				ImGui::TableHeadersRow();
+
+				// new order: the whole list is sorted, filtered list too (no need to filter again)
+				ImGuiTableSortSpecs* sortSpecs = ImGui::TableGetSortSpecs();
+				if ((sortSpecs) && (sortSpecs->SpecsDirty))
+				{
+					SetSortSpecs(sortSpecs);
+					SortLists();
+					m_playingRow = -1;
+					sortSpecs->SpecsDirty = false;
+				}
+
+				// Demonstrate using clipper for large vertical lists
+				int hoveredRow = -1;
+				int firstVisibleRow = 0;
+				ImGuiListClipper clipper;
+				clipper.Begin(count);
+				while (clipper.Step())
 				{
-					ImGui::TableSetupScrollFreeze(0, 1); // Make top row always visible
-					ImGui::TableSetupColumn("Author", ImGuiTableColumnFlags_WidthStretch, 40.0f);
-					ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthStretch,40.0f);
-					ImGui::TableSetupColumn("Duration", ImGuiTableColumnFlags_WidthStretch,10.f);
-					ImGui::TableSetupColumn("Sub-Song", ImGuiTableColumnFlags_WidthStretch,10.f);
-					ImGui::TableHeadersRow();
-
-					// Demonstrate using clipper for large vertical lists
-					ImGuiListClipper clipper;
-					clipper.Begin(count);
-					while (clipper.Step())
+					firstVisibleRow = clipper.DisplayStart;
+					for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
 					{
-						for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
-						{
-							ImGui::PushID(row);
+						ImGui::PushID(row);
 
-							const PlayListItem& item = m_filteredList[row];
+						const PlayListItem& item = FilteredItem(row);
 
-							ImGui::TableNextRow(ImGuiTableRowFlags_None, 0);
+						ImGui::TableNextRow(ImGuiTableRowFlags_None, 0);
 
-							ImGui::TableSetColumnIndex(0);
-							if (item.author)
-								ImGui::TextUnformatted(item.author);
-							else
-								ImGui::TextUnformatted("");
+						ImGui::TableSetColumnIndex(0);
+						if (item.author)
+							ImGui::TextUnformatted(item.author);
+						else
+							ImGui::TextUnformatted("");
 
-							ImGui::TableSetColumnIndex(1);
-							const ImGuiSelectableFlags selectable_flags = ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowOverlap;
-							if (ImGui::Selectable(item.title, false, selectable_flags, ImVec2(0, 0)))
+						ImGui::TableSetColumnIndex(1);
+						const ImGuiSelectableFlags selectable_flags = ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowOverlap;
+						if (ImGui::Selectable(item.title, false, selectable_flags, ImVec2(0, 0)))
+						{
+							player.PlayZipEntry(*this, item.zipIndex);
+							m_playingZipIndex = item.zipIndex;
+							m_playingRow = row;
+						}
+						if (ImGui::IsItemHovered())
+							hoveredRow = row;
+						if (m_hideDuplicates)
+						{
+							const int groupSize = m_dedup.GetGroupSize(item.zipIndex);
+							if (groupSize > 1)
 							{
-								player.PlayZipEntry(*this, item.zipIndex);
+								ImGui::SameLine();
+								ImGui::TextDisabled("(+%d)", groupSize - 1);
 							}
+						}
 
-							ImGui::TableSetColumnIndex(2);
-							if (item.duration > 0)
-							{
-								const int mm = item.duration / 60;
-								const int ss = item.duration % 60;
-								ImGui::Text("%d:%02d", mm, ss);
-							}
-							else
-								ImGui::TextUnformatted("?");
+						ImGui::TableSetColumnIndex(2);
+						if (item.duration > 0)
+						{
+							const int mm = item.duration / 60;
+							const int ss = item.duration % 60;
+							ImGui::Text("%d:%02d", mm, ss);
+						}
+						else
+							ImGui::TextUnformatted("?");
 
-							ImGui::TableSetColumnIndex(3);
-							if ( item.subsongCount>1)
-								ImGui::Text("%d", item.subsongCount);
+						ImGui::TableSetColumnIndex(3);
+						if ( item.subsongCount>1)
+							ImGui::Text("%d", item.subsongCount);
 
-							ImGui::PopID();
-						}
+						ImGui::TableSetColumnIndex(4);
+						if (item.year)
+							ImGui::TextUnformatted(item.year);
+
+						ImGui::PopID();
 					}
-					ImGui::EndTable();
 				}
+				ImGui::EndTable();
+				UpdatePrefetch(hoveredRow, firstVisibleRow);
 			}
-			else
+		}
+		else
+		{
+			ImGui::Text("Please drop a large SNDH Archive .zip file here!");
+			if (ImGui::Button("(you can get some from https://sndh.atari.org/download.php)"))
 			{
-				ImGui::Text("Please drop a large SNDH Archive .zip file here!");
-				if (ImGui::Button("(you can get some from https://sndh.atari.org/download.php)"))
-				{
-					OsOpenInShell("https://sndh.atari.org/download.php");
-				}
+				OsOpenInShell("https://sndh.atari.org/download.php");
 			}
 		}
 	}
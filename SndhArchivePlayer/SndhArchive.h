@@ -3,12 +3,14 @@
 #include <thread>
 #include <atomic>
 #include "imgui_internal.h"
-#include "extern/zip/src/zip.h"
 #include "jobSystem.h"
+#include "BatchRender.h"
+#include "ZipView.h"
+#include "TrackPrefetcher.h"
+#include "ArchiveDedup.h"
 
 
 class SndhArchivePlayer;
-struct zip_t;
 
 class SndhArchive
 {
@@ -16,14 +18,15 @@ public:
 	SndhArchive();
 	~SndhArchive();
 
-	struct zip_t* GetZipArchiveHandle() { return m_zipArchive; }
+	const ZipView&	GetZipView() const { return m_zipView; }
+	TrackPrefetcher&	GetPrefetcher() { return m_prefetcher; }
 
-	bool	Open(const char* sFilename);
+	bool	Open(const char* sFilename, uint32_t hostReplayRate);
 	void	Close();
 	int		GetFilteredSize() const { return m_filterdSize; }
 	int		GetUnFilteredSize() const { return m_size; }
 	void	ImGuiDraw(SndhArchivePlayer& player);
-	bool	IsOpen() const { return m_zipArchive != NULL; }
+	bool	IsOpen() const { return m_zipView.IsOpen(); }
 	bool	IsOpening() const { return m_asyncBrowse; }
 
 private:
@@ -35,17 +38,39 @@ private:
 		const char* year;
 		int	duration;
 		int subsongCount;
+		// sort keys computed once at load: most compares never touch the strings
+		uint64_t authorKey;
+		uint64_t titleKey;
+		int yearValue;			// 0 if unknown
+		int authorRank;			// rank of the full string, once the whole archive is indexed
+		int titleRank;
 	};
 
+	enum SortColumn
+	{
+		kColAuthor,
+		kColTitle,
+		kColDuration,
+		kColSubsongs,
+		kColYear,
+		kColCount
+	};
+
+	struct SortKey
+	{
+		int column;
+		bool descending;
+	};
+
+	const PlayListItem&	FilteredItem(int row) const { return m_loadSlots[m_filteredList[row]]; }
+
 	void			RebuildFilterList()
 	{
+		// m_list is already in the active order, so is the filtered list
 		m_filterdSize = 0;
 		for (int i = 0; i < m_size; i++)
 		{
-			bool bFilter = m_ImGuiFilter.PassFilter(m_list[i].author);
-			if ( !bFilter )
-				bFilter = m_ImGuiFilter.PassFilter(m_list[i].title);
-			if (bFilter)
+			if (PassFilter(m_loadSlots[m_list[i]]))
 			{
 				m_filteredList[m_filterdSize] = m_list[i];
 				m_filterdSize++;
@@ -53,34 +78,68 @@ private:
 		}
 	}
 
-	PlayListItem*	m_list;
-	int				m_size;
-	PlayListItem*	m_filteredList;
-	int				m_filterdSize;
-	ImGuiTextFilter m_ImGuiFilter;
-	struct zip_t*	m_zipArchive;
-	static int fEntrySort(const void *arg1, const void *arg2)
+	bool			PassFilter(const PlayListItem& item) const
 	{
-		const PlayListItem* a = (const PlayListItem*)arg1;
-		const PlayListItem* b = (const PlayListItem*)arg2;
-		int r = _stricmp(a->author, b->author);
-		if ( 0 == r )
-			r = _stricmp(a->title, b->title);
-		return r;
+		if ((m_hideDuplicates) && (m_dedup.GetLeader(item.zipIndex, false) != item.zipIndex))
+			return false;
+		return m_ImGuiFilter.PassFilter(item.author) || m_ImGuiFilter.PassFilter(item.title);
 	}
 
-	static const int kMaxZipWorkers = 16;
+	void			ConsumeLoadLog();
+	void			MergeSorted(int* list, int size, const int* add, int addSize) const;
+	void			SortLists();
+	void			MergeSortList(int* list, int size);
+	void			RadixSortList(int* list, int size);
+	uint32_t		ColumnValue(int slot, int column) const;
+	void			SetSortSpecs(const ImGuiTableSortSpecs* specs);
+	int				CompareItems(const PlayListItem& a, const PlayListItem& b) const;
+	int				CompareColumn(const PlayListItem& a, const PlayListItem& b, int column) const;
+	void			BuildRanks();
+	static uint64_t	CollationKey(const char* s);
+
+	ZipView			m_zipView;		// central directory parsed once, zipIndex is an entry of this view
+	int*			m_list;			// load slot indices, in the active sort order
+	int				m_size;
+	int*			m_filteredList;
+	int				m_filterdSize;
+	ImGuiTextFilter m_ImGuiFilter;
+	SortKey			m_sortKeys[kColCount];
+	int				m_sortKeyCount;
+	int*			m_sortScratch;
+	uint32_t*		m_radixKeys;	// 2 x load slot count
+	bool			m_ranked;		// string columns compare authorRank & titleRank
 
-	// job system large SNDH zip archive reader
-	struct zip_t* m_zipPerWorker[kMaxZipWorkers];
+	// job system large SNDH zip archive reader (all workers inflate from the same mapped archive)
 	JobSystem m_jsBrowse;
 	static bool JobZipItemProcessing(void* user, int itemId, int workerId);
-	static bool JobZipItemComplete(void* user, int workerId);
 	bool LoadZipEntry(int itemId, int workerId);
-	bool LoadZipEnd();
-	int m_zipWorkersCount;
 	bool m_asyncBrowse;
-	std::atomic<int> m_progress;
+
+	// workers fill one slot per zip file (slots own the strings), then append the slot index to the
+	// load log. UI thread consumes the log each frame and merges new items into the sorted m_list
+	PlayListItem*		m_loadSlots;
+	int					m_loadSlotCount;
+	std::atomic<int>*	m_loadLog;			// slot index, or -1 while not published yet
+	std::atomic<int>	m_loadLogWrite;
+	int					m_loadLogRead;
+	std::atomic<int>	m_loadDone;
+	int*				m_mergeScratch;
 	bool m_firstSearchFocus;
 
+	// next likely played entries are prepared in the background: hovered row, then rows after the playing one
+	static const int kPrefetchCount = 4;
+	void			UpdatePrefetch(int hoveredRow, int firstVisibleRow);
+	TrackPrefetcher	m_prefetcher;
+	int				m_playingZipIndex;
+	int				m_playingRow;			// hint only, list changes while indexing or filtering
+
+	// duplicate entries search, started once the archive is indexed. Only first entry of a group is listed if hidden
+	ArchiveDedup	m_dedup;
+	bool			m_hideDuplicates;
+
+	// whole archive render to FLAC
+	char m_sFilename[_MAX_PATH];
+	BatchRender m_batch;
+	bool m_batchRan;
+
 };
@@ -1,4 +1,6 @@
 #define _CRT_SECURE_NO_WARNINGS
+#include <math.h>
+#include <windows.h>
 #include "imgui.h"
 #include "imgui_impl_win32.h"
 #include "imgui_impl_dx11.h"
@@ -31,7 +33,7 @@ bool	SndhArchivePlayer::StartSubsong(int subsong)
 	bool ret = false;
 	if ((subsong >= 1) && (subsong <= m_sndh.GetSubsongCount()))
 	{
-		if (m_sndh.StartSubsong(subsong, gDefaultDurationInMin*60))
+		if (m_sndh.StartSubsong(subsong, GetDurationByDefaultInSec(subsong)))
 		{
 			m_currentSubSong = subsong;
 		}
@@ -39,53 +41,69 @@ bool	SndhArchivePlayer::StartSubsong(int subsong)
 	return ret;
 }
 
+// used if the subsong has no TIME tag: analyzed duration is better than the default one
+int	SndhArchivePlayer::GetDurationByDefaultInSec(int subsong) const
+{
+	SubsongAnalyzer::Result analysis;
+	if ((m_analyzer.GetResult(subsong, analysis)) && (analysis.durationInMs > 0))
+		return (analysis.durationInMs + 999) / 1000;
+	return gDefaultDurationInMin * 60;
+}
+
+void	SndhArchivePlayer::AnalyzeMusic(const void* raw, int size)
+{
+	m_analyzer.Start(raw, size, kHostReplayRate, gDefaultDurationInMin * 60);
+}
+
+void	SndhArchivePlayer::AnalyzeLoadedMusic()
+{
+	int size;
+	const void* raw = m_sndh.GetRawData(size);
+	AnalyzeMusic(raw, size);
+}
+
 bool	SndhArchivePlayer::LoadNewMusic(const char* sFilename)
 {
 	bool ret = false;
 
-	m_sndh.Unload();
-
-	FILE* h = fopen(sFilename, "rb");
-	if (h)
+	if (m_sndh.LoadSndhFile(sFilename, kHostReplayRate))
 	{
-		fseek(h, 0, SEEK_END);
-		int sndhSize = ftell(h);
-		void* sndhBuffer = malloc(sndhSize);
-		fseek(h, 0, SEEK_SET);
-		fread(sndhBuffer, 1, sndhSize, h);
-		fclose(h);
-
-		if (m_sndh.LoadSndh(sndhBuffer, sndhSize, kHostReplayRate))
-		{
-			if ( StartSubsong(m_sndh.GetDefaultSubsong()))
-				ret = true;
-		}
-		free(sndhBuffer);
+		AnalyzeLoadedMusic();
+		if ( StartSubsong(m_sndh.GetDefaultSubsong()))
+			ret = true;
 	}
 	return ret;
 }
 
 void	SndhArchivePlayer::PlayZipEntry(SndhArchive& sndhArchive, int zipIndex)
 {
-	struct zip_t* zipArchive = sndhArchive.GetZipArchiveHandle();
-	if (zipArchive)
+	// most of the time, the entry is already loaded, initialized and its first samples rendered
+	TrackPrefetcher::Track track;
+	if (sndhArchive.GetPrefetcher().Take(zipIndex, track))
 	{
-		if (0 == zip_entry_openbyindex(zipArchive, zipIndex))
-		{
-			size_t size = zip_entry_size(zipArchive);
-			void* unpack = calloc(1, size);
+		// analysis first, so the duration is chosen like a StartSubsong one (known if the music was played before)
+		AnalyzeMusic(track.sndh->GetRawData(), track.sndh->GetRawDataSize());
+		if (m_sndh.StartPrerendered(track.sndh, kHostReplayRate, track.subSongId, track.audio, track.viewInfo, track.frameCount, GetDurationByDefaultInSec(track.subSongId)))
+			m_currentSubSong = track.subSongId;
+		TrackPrefetcher::ReleaseTrack(track);
+		return;
+	}
 
-			size_t depackSize = zip_entry_noallocread(zipArchive, unpack, size);
-			if (depackSize == size)
+	const ZipView& zipView = sndhArchive.GetZipView();
+	if ((zipView.IsOpen()) && (zipIndex >= 0) && (zipIndex < zipView.GetEntryCount()))
+	{
+		int size;
+		void* unpack = zipView.ExtractAlloc(zipIndex, size);
+		if (unpack)
+		{
+			m_sndh.Unload();
+			if (m_sndh.LoadSndh(unpack, size, kHostReplayRate))
 			{
-				m_sndh.Unload();
-				if (m_sndh.LoadSndh(unpack, int(size), kHostReplayRate))
-				{
-					StartSubsong(m_sndh.GetDefaultSubsong());
-				}
+				AnalyzeLoadedMusic();
+				StartSubsong(m_sndh.GetDefaultSubsong());
 			}
-			free(unpack);
 		}
+		free(unpack);
 	}
 }
 
@@ -95,7 +113,7 @@ void	SndhArchivePlayer::DrawPlayList()
 }
 
 
-void	ImDrawOscillo(const int16_t* audio, int count, const char* winName)
+void	ImDrawOscillo(const int16_t* audio, int count, int channelCount, const char* winName)
 {
 	const float dpiScale = 1.0f;
 //	ImGui::SetNextWindowSizeConstraints(ImVec2(64.0f*dpiScale, 32.0f*dpiScale), ImVec2(1280, 800));
@@ -151,7 +169,8 @@ void	ImDrawOscillo(const int16_t* audio, int count, const char* winName)
 				float y = 0.f;
 				if (audio)
 				{
-					y = float(audio[rPos >> 16])*(1.0f / 65536.f);
+					const int16_t* frame = audio + (rPos >> 16) * channelCount;
+					y = float((channelCount > 1) ? ((frame[0] + frame[1]) >> 1) : frame[0])*(1.0f / 65536.f);
 					rPos += rStep;
 					{
 						if (y < -0.5f) y = -0.5f;
@@ -277,10 +296,11 @@ void	SndhArchivePlayer::DropFile(const char* sFilename)
 	if (gArchive.IsOpening())
 		return;
 
+	m_analyzer.Stop();
 	m_sndh.Unload();
 
 	// first, try to open as a big ZIP archive
-	bool loadOk = gArchive.Open(sFilename);
+	bool loadOk = gArchive.Open(sFilename, kHostReplayRate);
 
 	if (!loadOk)
 	{
@@ -296,6 +316,7 @@ void	SndhArchivePlayer::DropFile(const char* sFilename)
 
 void	SndhArchivePlayer::Startup()
 {
+	m_analyzer.SetCacheFile("SNDH_Analysis.txt");
 	char sFilename[_MAX_PATH];
 	DWORD nc = GetPrivateProfileStringA("SNDH-Archive-Player", "ArchiveFile", "", sFilename, _MAX_PATH, ".\\SNDH_Archive.ini");
 	if (nc > 0)
@@ -317,12 +338,91 @@ static bool CenteredButton(const char* label, float widthScale = 1.2f)
 	return ImGui::Button(label, ImVec2(buttonWidth, 0));
 }
 
+static void	DrawDbfs(int level)
+{
+	if (level > 0)
+		ImGui::Text("%.1f", 20.0f * log10f(float(level) / 32768.0f));
+	else
+		ImGui::TextUnformatted("-inf");
+}
+
+void	SndhArchivePlayer::DrawSubsongTable()
+{
+	const int count = m_analyzer.GetSubsongCount();
+	if ((count <= 0) || (!ImGui::CollapsingHeader("All sub-tunes")))
+		return;
+
+	if (m_analyzer.GetDoneCount() < count)
+	{
+		char sBuf[32];
+		sprintf_s(sBuf, "%d/%d", m_analyzer.GetDoneCount(), count);
+		ImGui::ProgressBar(float(m_analyzer.GetDoneCount()) / float(count), ImVec2(-1.0f, 0.0f), sBuf);
+	}
+
+	const ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingFixedFit;
+	const float height = ImGui::GetTextLineHeightWithSpacing() * float(((count < 8) ? count : 8) + 1);
+	if (ImGui::BeginTable("subtunes", 6, flags, ImVec2(0.0f, height)))
+	{
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("#");
+		ImGui::TableSetupColumn("Duration");
+		ImGui::TableSetupColumn("Loop");
+		ImGui::TableSetupColumn("Peak dB");
+		ImGui::TableSetupColumn("RMS dB");
+		ImGui::TableSetupColumn("Silence in/out");
+		ImGui::TableHeadersRow();
+
+		for (int s = 1; s <= count; s++)
+		{
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			char sLabel[16];
+			sprintf_s(sLabel, "%d", s);
+			if (ImGui::Selectable(sLabel, s == m_currentSubSong, ImGuiSelectableFlags_SpanAllColumns))
+				StartSubsong(s);
+
+			SubsongAnalyzer::Result r;
+			if (!m_analyzer.GetResult(s, r))
+			{
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted("...");
+				continue;
+			}
+			if (!r.valid)
+			{
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted("init failed");
+				continue;
+			}
+			ImGui::TableNextColumn();
+			if (r.durationInMs > 0)
+				ImGui::Text("%d:%02d", r.durationInMs / 60000, (r.durationInMs / 1000) % 60);
+			else
+				ImGui::TextUnformatted("?");
+			ImGui::TableNextColumn();
+			if (r.loopStartMs >= 0)
+				ImGui::Text("%d:%02d +%d:%02d", r.loopStartMs / 60000, (r.loopStartMs / 1000) % 60, r.loopLengthMs / 60000, (r.loopLengthMs / 1000) % 60);
+			else
+				ImGui::TextUnformatted("-");
+			ImGui::TableNextColumn();
+			DrawDbfs(r.peakLevel);
+			ImGui::TableNextColumn();
+			DrawDbfs(r.rmsLevel);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1fs / %.1fs", float(r.leadingSilenceMs) / 1000.0f, float(r.trailingSilenceMs) / 1000.0f);
+		}
+		ImGui::EndTable();
+	}
+}
+
 void	SndhArchivePlayer::UpdateImGui()
 {
 	
 	
 	ImGuiIO& io = ImGui::GetIO(); (void)io;
 
+	m_analyzer.Update();
+
 	ImGui::PushStyleVar(ImGuiStyleVar_FrameRounding, 4.0f);
 
 
@@ -341,6 +441,9 @@ void	SndhArchivePlayer::UpdateImGui()
 
 //		if (ImGui::BeginTable("song", 2, ImGuiTableFlags_SizingStretchProp | ImGuiTableFlags_NoBordersInBody))
 
+		// driver init runs on the stream worker: a failure stops the sink, DrawGui then tells it
+		m_sndh.CheckInitFailure();
+
 		SndhFile::SubSongInfo info;
 		if (m_sndh.GetSubsongInfo(m_currentSubSong, info))
 		{
@@ -394,6 +497,7 @@ void	SndhArchivePlayer::UpdateImGui()
 				ImGui::EndTable();
 				m_sndh.DrawGui(info.musicName);
 			}
+			DrawSubsongTable();
 		}
 
 		{
@@ -463,8 +567,8 @@ void	SndhArchivePlayer::UpdateImGui()
 
 	uint32_t* debugAudio = nullptr;
 	const int16_t* display = m_sndh.GetDisplaySampleData(kLatencySampleCount, &debugAudio);
-	ImDrawOscillo(display, kLatencySampleCount,kWndAudioOut);
-	ImDrawOscillo4Voices(debugAudio, kLatencySampleCount);
+	ImDrawOscillo(display, kLatencySampleCount, m_sndh.GetChannelCount(), kWndAudioOut);
+	ImDrawOscillo4Voices(debugAudio, kLatencySampleCount / AsyncSndhStream::kViewInfoDecimation);
 
 	// 1. Show the big demo window (Most of the sample code is in ImGui::ShowDemoWindow()! You can browse its code to learn more about Dear ImGui!).
 //	show_demo_window = true;
@@ -486,4 +590,5 @@ void	SndhArchivePlayer::UpdateImGui()
 
 void	SndhArchivePlayer::Shutdown()
 {
+	m_analyzer.Stop();
 }
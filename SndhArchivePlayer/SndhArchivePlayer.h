@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include "../AtariAudio/AtariAudio.h"
 #include "AsyncSndhStream.h"
+#include "SubsongAnalyzer.h"
 
 class SndhArchive;
 
@@ -28,11 +29,16 @@ public:
 
 private:
 	bool	StartSubsong(int subsong);
+	void	AnalyzeLoadedMusic();
+	void	AnalyzeMusic(const void* raw, int size);
+	int		GetDurationByDefaultInSec(int subsong) const;
+	void	DrawSubsongTable();
 	void	DrawPlayList();
 	bool show_demo_window = false;
 	bool show_another_window = false;
 
 	AsyncSndhStream	m_sndh;
 	int			m_currentSubSong;
+	SubsongAnalyzer	m_analyzer;
 
 };
\ No newline at end of file
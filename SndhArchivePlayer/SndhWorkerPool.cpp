@@ -0,0 +1,31 @@
+#include <assert.h>
+#include "SndhWorkerPool.h"
+
+SndhWorkerPool::SndhWorkerPool()
+{
+	for (int w = 0; w < kMaxEmulationWorkers; w++)
+		m_sndh[w] = NULL;
+}
+
+SndhWorkerPool::~SndhWorkerPool()
+{
+	for (int w = 0; w < kMaxEmulationWorkers; w++)
+		delete m_sndh[w];
+}
+
+SndhFile&	SndhWorkerPool::Get(int workerId)
+{
+	assert((workerId >= 0) && (workerId < kMaxEmulationWorkers));
+	if (NULL == m_sndh[workerId])
+		m_sndh[workerId] = new SndhFile;
+	return *m_sndh[workerId];
+}
+
+void	SndhWorkerPool::UnloadAll()
+{
+	for (int w = 0; w < kMaxEmulationWorkers; w++)
+	{
+		if (m_sndh[w])
+			m_sndh[w]->Unload();
+	}
+}
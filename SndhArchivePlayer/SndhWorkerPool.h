@@ -0,0 +1,18 @@
+#pragma once
+#include "../AtariAudio/AtariAudio.h"
+#include "jobSystem.h"
+
+// One SndhFile per job worker, for jobs running a whole Atari emulation. Each SndhFile owns a whole Atari RAM:
+// it's allocated at the first job of its worker, then kept for the next jobs
+class SndhWorkerPool
+{
+public:
+	SndhWorkerPool();
+	~SndhWorkerPool();
+
+	SndhFile&	Get(int workerId);		// workerId < kMaxEmulationWorkers, only called by this worker
+	void		UnloadAll();			// jobs should be joined
+
+private:
+	SndhFile*	m_sndh[kMaxEmulationWorkers];
+};
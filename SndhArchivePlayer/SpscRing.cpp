@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "SpscRing.h"
+
+SpscRing::SpscRing()
+{
+	m_writePos = 0;
+	m_readPos = 0;
+	m_data = NULL;
+	m_mask = 0;
+	m_channelCount = 1;
+}
+
+SpscRing::~SpscRing()
+{
+	Release();
+}
+
+bool	SpscRing::Init(int minCapacityFrames, int channelCount)
+{
+	Release();
+	assert(minCapacityFrames > 0);
+	uint32_t capacity = 1;
+	while (capacity < uint32_t(minCapacityFrames))
+		capacity <<= 1;
+	m_data = (int16_t*)malloc(capacity * channelCount * sizeof(int16_t));
+	if (NULL == m_data)
+		return false;
+	m_mask = capacity - 1;
+	m_channelCount = channelCount;
+	m_writePos = 0;
+	m_readPos = 0;
+	return true;
+}
+
+void	SpscRing::Release()
+{
+	free(m_data);
+	m_data = NULL;
+	m_mask = 0;
+	m_writePos = 0;
+	m_readPos = 0;
+}
+
+// frame copy, "dst" or "src" is in the ring. Caller splits the copy at ring end
+void	SpscRing::Copy(int16_t* dst, const int16_t* src, int frameCount) const
+{
+	memcpy(dst, src, frameCount * m_channelCount * sizeof(int16_t));
+}
+
+int		SpscRing::Write(const int16_t* data, int frameCount)
+{
+	const uint32_t writePos = m_writePos.load(std::memory_order_relaxed);
+	const uint32_t readPos = m_readPos.load(std::memory_order_acquire);
+	const int freeSpace = int(m_mask + 1 - (writePos - readPos));
+	if (frameCount > freeSpace)
+		frameCount = freeSpace;
+
+	const uint32_t offset = writePos & m_mask;
+	const int first = (int(m_mask + 1 - offset) < frameCount) ? int(m_mask + 1 - offset) : frameCount;
+	Copy(m_data + offset * m_channelCount, data, first);
+	Copy(m_data, data + first * m_channelCount, frameCount - first);
+
+	// frames are visible to the consumer once the counter is published
+	m_writePos.store(writePos + frameCount, std::memory_order_release);
+	return frameCount;
+}
+
+int		SpscRing::Read(int16_t* data, int frameCount)
+{
+	const uint32_t readPos = m_readPos.load(std::memory_order_relaxed);
+	const uint32_t writePos = m_writePos.load(std::memory_order_acquire);
+	const int fillLevel = int(writePos - readPos);
+	if (frameCount > fillLevel)
+		frameCount = fillLevel;
+
+	const uint32_t offset = readPos & m_mask;
+	const int first = (int(m_mask + 1 - offset) < frameCount) ? int(m_mask + 1 - offset) : frameCount;
+	Copy(data, m_data + offset * m_channelCount, first);
+	Copy(data + first * m_channelCount, m_data, frameCount - first);
+
+	m_readPos.store(readPos + frameCount, std::memory_order_release);
+	return frameCount;
+}
+
+int		SpscRing::Flush()
+{
+	const uint32_t readPos = m_readPos.load(std::memory_order_relaxed);
+	const uint32_t writePos = m_writePos.load(std::memory_order_acquire);
+	m_readPos.store(writePos, std::memory_order_release);
+	return int(writePos - readPos);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free single producer / single consumer ring of audio frames (one frame is "channelCount" int16_t)
+// Read & write counters are on their own cache line, so producer and consumer threads don't false share
+class SpscRing
+{
+public:
+	SpscRing();
+	~SpscRing();
+
+	bool	Init(int minCapacityFrames, int channelCount);		// capacity is rounded up to a power of 2
+	void	Release();
+
+	int		GetCapacity() const { return int(m_mask + 1); }
+	int		GetFillLevel() const { return int(m_writePos.load(std::memory_order_acquire) - m_readPos.load(std::memory_order_acquire)); }
+	int		GetFreeSpace() const { return GetCapacity() - GetFillLevel(); }
+
+	int		Write(const int16_t* data, int frameCount);		// producer only, returns written frames (could be less if ring is full)
+	int		Read(int16_t* data, int frameCount);			// consumer only, returns read frames (could be less if ring is empty)
+	int		Flush();										// consumer only, drop any written frame, returns dropped count
+
+private:
+	void	Copy(int16_t* dst, const int16_t* src, int frameCount) const;
+
+	static const int kCacheLineSize = 64;
+
+	alignas(kCacheLineSize) std::atomic<uint32_t>	m_writePos;		// counters never wrap to ring size, only on 32bits
+	alignas(kCacheLineSize) std::atomic<uint32_t>	m_readPos;
+	alignas(kCacheLineSize) int16_t*	m_data;
+	uint32_t	m_mask;
+	int			m_channelCount;
+};
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "SubsongAnalyzer.h"
+#include "AsyncSndhStream.h"
+
+SubsongAnalyzer::SubsongAnalyzer()
+{
+	m_raw = NULL;
+	m_rawSize = 0;
+	m_hash = 0;
+	m_replayRate = 0;
+	m_durationByDefaultInSec = 0;
+	m_subsongCount = 0;
+	for (int i = 0; i < kSubsongCountMax; i++)
+		m_ready[i] = false;
+	m_doneCount = 0;
+	m_cancel = false;
+	m_running = false;
+	m_cache = NULL;
+	m_cacheSize = 0;
+	m_cacheCapacity = 0;
+	m_sCacheFile = NULL;
+	m_cacheFileLoaded = false;
+}
+
+SubsongAnalyzer::~SubsongAnalyzer()
+{
+	Stop();
+	for (int i = 0; i < m_cacheSize; i++)
+		free(m_cache[i].results);
+	free(m_cache);
+	free(m_sCacheFile);
+}
+
+void	SubsongAnalyzer::SetCacheFile(const char* sFilename)
+{
+	free(m_sCacheFile);
+	m_sCacheFile = sFilename ? _strdup(sFilename) : NULL;
+	m_cacheFileLoaded = false;
+}
+
+void	SubsongAnalyzer::Start(const void* rawSndh, int size, uint32_t replayRate, int durationByDefaultInSec)
+{
+	Stop();
+	if ((NULL == rawSndh) || (size <= 0))
+		return;
+
+	m_hash = SndhImage::ContentHash(rawSndh, size);
+	m_replayRate = replayRate;
+	m_durationByDefaultInSec = durationByDefaultInSec;
+
+	// already analyzed with the same settings (latest item wins, like in the cache file)
+	if (!m_cacheFileLoaded)
+		LoadCacheFile();
+	for (int i = m_cacheSize - 1; i >= 0; i--)
+	{
+		const CacheItem& item = m_cache[i];
+		if ((item.hash == m_hash) && (item.replayRate == replayRate) && (item.durationByDefaultInSec == durationByDefaultInSec))
+		{
+			m_subsongCount = item.subsongCount;
+			memcpy(m_results, item.results, m_subsongCount * sizeof(Result));
+			for (int s = 0; s < m_subsongCount; s++)
+				m_ready[s] = true;
+			m_doneCount = m_subsongCount;
+			return;
+		}
+	}
+
+	// worker 0 SndhFile isn't used by any job yet: parse the header here to get the subsong count
+	m_raw = malloc(size);
+	memcpy(m_raw, rawSndh, size);
+	m_rawSize = size;
+	SndhFile& header = m_sndhPool.Get(0);
+	if (!header.Load(m_raw, m_rawSize, m_replayRate, true))
+	{
+		Stop();
+		return;
+	}
+	m_subsongCount = header.GetSubsongCount();
+	if (m_subsongCount > kSubsongCountMax)
+		m_subsongCount = kSubsongCountMax;
+	header.Unload();
+
+	if (m_subsongCount > 0)
+	{
+		int workers = JobSystem::GetHardwareWorkerCount();
+		if (workers > kMaxEmulationWorkers)
+			workers = kMaxEmulationWorkers;
+		m_cancel = false;
+		m_running = true;
+		m_jobs.RunJobs(this, m_subsongCount, sJobAnalyze, NULL, workers);
+	}
+}
+
+void	SubsongAnalyzer::Stop()
+{
+	if (m_running)
+	{
+		m_cancel = true;
+		m_jobs.Join();
+		m_running = false;
+	}
+	m_sndhPool.UnloadAll();
+	free(m_raw);
+	m_raw = NULL;
+	m_rawSize = 0;
+	m_subsongCount = 0;
+	for (int i = 0; i < kSubsongCountMax; i++)
+		m_ready[i] = false;
+	m_doneCount = 0;
+}
+
+bool	SubsongAnalyzer::Update()
+{
+	if (m_running)
+	{
+		if (m_jobs.Running())
+			return true;
+		m_jobs.Join();
+		m_running = false;
+		if (m_doneCount == m_subsongCount)
+			StoreInCache();
+	}
+	return false;
+}
+
+bool	SubsongAnalyzer::GetResult(int subSongId, Result& out) const
+{
+	if ((subSongId < 1) || (subSongId > m_subsongCount))
+		return false;
+	if (!m_ready[subSongId - 1].load(std::memory_order_acquire))
+		return false;
+	out = m_results[subSongId - 1];
+	return true;
+}
+
+SubsongAnalyzer::CacheItem&	SubsongAnalyzer::AddCacheItem()
+{
+	if (m_cacheSize == m_cacheCapacity)
+	{
+		m_cacheCapacity = m_cacheCapacity ? m_cacheCapacity * 2 : 256;
+		m_cache = (CacheItem*)realloc(m_cache, m_cacheCapacity * sizeof(CacheItem));
+	}
+	return m_cache[m_cacheSize++];
+}
+
+void	SubsongAnalyzer::StoreInCache()
+{
+	CacheItem& item = AddCacheItem();
+	item.results = (Result*)malloc(m_subsongCount * sizeof(Result));
+	memcpy(item.results, m_results, m_subsongCount * sizeof(Result));
+	item.hash = m_hash;
+	item.replayRate = m_replayRate;
+	item.durationByDefaultInSec = m_durationByDefaultInSec;
+	item.subsongCount = m_subsongCount;
+	AppendCacheFile(item);
+}
+
+// one line per file: "hash version replayRate durationByDefault subsongCount" then 8 values per subsong.
+// Lines of another emulation version are ignored (results could be different), later lines override earlier ones
+void	SubsongAnalyzer::LoadCacheFile()
+{
+	m_cacheFileLoaded = true;
+	if (NULL == m_sCacheFile)
+		return;
+	FILE* h = fopen(m_sCacheFile, "rb");
+	if (NULL == h)
+		return;
+
+	const int kLineMax = 64 + kSubsongCountMax * kResultFields * 12;
+	char* sLine = (char*)malloc(kLineMax);
+	while (fgets(sLine, kLineMax, h))
+	{
+		// a line without end of line was being written when the previous session stopped
+		if (NULL == strchr(sLine, '\n'))
+			continue;
+		unsigned long long hash;
+		int version, replayRate, durationByDefault, subsongCount, pos = 0;
+		if ((5 != sscanf(sLine, "%llx %d %d %d %d%n", &hash, &version, &replayRate, &durationByDefault, &subsongCount, &pos)) ||
+			(version != ATARI_AUDIO_EMULATION_VERSION) || (subsongCount <= 0) || (subsongCount > kSubsongCountMax))
+			continue;
+
+		Result* results = (Result*)malloc(subsongCount * sizeof(Result));
+		bool ok = true;
+		for (int s = 0; (s < subsongCount) && (ok); s++)
+		{
+			Result& r = results[s];
+			int valid, n = 0;
+			ok = (kResultFields == sscanf(sLine + pos, "%d %d %d %d %d %d %d %d%n", &valid, &r.durationInMs, &r.loopStartMs, &r.loopLengthMs,
+				&r.peakLevel, &r.rmsLevel, &r.leadingSilenceMs, &r.trailingSilenceMs, &n));
+			r.valid = (valid != 0);
+			pos += n;
+		}
+		if (!ok)
+		{
+			free(results);
+			continue;
+		}
+		CacheItem& item = AddCacheItem();
+		item.hash = hash;
+		item.replayRate = uint32_t(replayRate);
+		item.durationByDefaultInSec = durationByDefault;
+		item.subsongCount = subsongCount;
+		item.results = results;
+	}
+	free(sLine);
+	fclose(h);
+}
+
+void	SubsongAnalyzer::AppendCacheFile(const CacheItem& item) const
+{
+	if (NULL == m_sCacheFile)
+		return;
+	FILE* h = fopen(m_sCacheFile, "ab");
+	if (NULL == h)
+		return;
+	fprintf(h, "%016llx %d %d %d %d", (unsigned long long)item.hash, ATARI_AUDIO_EMULATION_VERSION, int(item.replayRate), item.durationByDefaultInSec, item.subsongCount);
+	for (int s = 0; s < item.subsongCount; s++)
+	{
+		const Result& r = item.results[s];
+		fprintf(h, " %d %d %d %d %d %d %d %d", r.valid ? 1 : 0, r.durationInMs, r.loopStartMs, r.loopLengthMs,
+			r.peakLevel, r.rmsLevel, r.leadingSilenceMs, r.trailingSilenceMs);
+	}
+	fprintf(h, "\n");
+	fclose(h);
+}
+
+bool	SubsongAnalyzer::sJobAnalyze(void* user, int itemId, int workerId)
+{
+	SubsongAnalyzer* _this = (SubsongAnalyzer*)user;
+	return _this->Analyze(itemId + 1, workerId);
+}
+
+// coarse tick loudness (about 3dB steps) used to find where the music repeats. 0 is kept for silent ticks
+uint8_t	SubsongAnalyzer::TickSignature(uint64_t sumSq, int64_t sum, int count)
+{
+	const int64_t mean = sum / count;
+	const int64_t variance = int64_t(sumSq / count) - mean * mean;
+	int level = 1;
+	for (int64_t v = variance; v > 1; v >>= 1)
+		level++;
+	return uint8_t(level);
+}
+
+// the tail of the render is compared with the music one period earlier. Among the matching periods, the
+// loop is the one repeating over the longest part of the music (a repeated pattern only matches locally)
+void	SubsongAnalyzer::DetectLoop(const uint8_t* signature, int tickCount, int tickRate, int& loopStart, int& loopLength)
+{
+	loopStart = -1;
+	loopLength = 0;
+	int window = 10 * tickRate;
+	if (window > tickCount / 4)
+		window = tickCount / 4;
+	if (window < tickRate)
+		return;
+
+	// silent or flat tail matches any period
+	const uint8_t* tail = signature + tickCount - window;
+	int lo = 255;
+	int hi = 0;
+	for (int i = 0; i < window; i++)
+	{
+		lo = (tail[i] < lo) ? tail[i] : lo;
+		hi = (tail[i] > hi) ? tail[i] : hi;
+	}
+	if (hi - lo <= 2)
+		return;
+
+	int bestRepeat = 0;
+	for (int period = 2 * tickRate; period <= tickCount - window; period++)
+	{
+		const uint8_t* earlier = tail - period;
+		int i = 0;
+		while ((i < window) && (abs(tail[i] - earlier[i]) <= 1))
+			i++;
+		if (i < window)
+			continue;
+
+		int start = tickCount - window - period;
+		while ((start > 0) && (abs(signature[start - 1] - signature[start - 1 + period]) <= 1))
+			start--;
+		const int repeat = tickCount - period - start;
+		if (repeat > bestRepeat)
+		{
+			bestRepeat = repeat;
+			loopStart = start;
+			loopLength = period;
+		}
+	}
+}
+
+void	SubsongAnalyzer::SetFailed(Result& out)
+{
+	out.valid = false;
+	out.durationInMs = 0;
+	out.loopStartMs = -1;
+	out.loopLengthMs = 0;
+	out.peakLevel = 0;
+	out.rmsLevel = 0;
+	out.leadingSilenceMs = 0;
+	out.trailingSilenceMs = 0;
+}
+
+bool	SubsongAnalyzer::Analyze(int subSongId, int workerId)
+{
+	if (m_cancel)
+		return false;
+
+	// a subsong that can't be analyzed is done too, so the analysis ends (and is cached) anyway
+	Result& out = m_results[subSongId - 1];
+
+	SndhFile& sndh = m_sndhPool.Get(workerId);
+
+	SndhFile::SubSongInfo info;
+	const bool loaded = sndh.Load(m_raw, m_rawSize, m_replayRate, true);
+	bool ok = (loaded) && (sndh.GetSubsongInfo(subSongId, info)) && (info.playerTickRate > 0);
+
+	// same output as the player (so same levels), for the same length
+	const bool tagged = (ok) && (info.playerTickCount > 0);
+	const int lenInSec = tagged ? info.playerTickCount / info.playerTickRate : m_durationByDefaultInSec;
+	ok = (ok) && (lenInSec >= 1) && (AsyncSndhStream::InitSubsong(sndh, subSongId));
+	if (!ok)
+	{
+		if (loaded)
+			sndh.Unload();
+		SetFailed(out);
+		m_ready[subSongId - 1].store(true, std::memory_order_release);
+		m_doneCount++;
+		return false;
+	}
+
+	const int channels = sndh.GetChannelCount();
+	int tickSamples = int(m_replayRate) / info.playerTickRate;
+	if (tickSamples < 1)
+		tickSamples = 1;
+	const int tickCount = int((uint64_t(lenInSec) * m_replayRate) / tickSamples);
+	uint8_t* signature = (uint8_t*)malloc(tickCount);
+	int16_t* buffer = (int16_t*)malloc(tickSamples * channels * sizeof(int16_t));
+
+	int firstSound = -1;
+	int lastSound = -1;
+	int peak = 0;
+	uint64_t totalSq = 0;
+	int t;
+	for (t = 0; (t < tickCount) && (!m_cancel); t++)
+	{
+		sndh.AudioRender(buffer, tickSamples);
+
+		// levels on all channels, silence & signature on the mono mix
+		int lo = 32767;
+		int hi = -32768;
+		int64_t sum = 0;
+		uint64_t sumSq = 0;
+		const int16_t* r = buffer;
+		for (int i = 0; i < tickSamples; i++)
+		{
+			int mix = 0;
+			for (int c = 0; c < channels; c++)
+			{
+				const int v = *r++;
+				const int a = (v < 0) ? -v : v;
+				peak = (a > peak) ? a : peak;
+				totalSq += uint64_t(v * v);
+				mix += v;
+			}
+			mix /= channels;
+			lo = (mix < lo) ? mix : lo;
+			hi = (mix > hi) ? mix : hi;
+			sum += mix;
+			sumSq += uint64_t(mix * mix);
+		}
+		const bool silent = (hi - lo <= kSilenceRange);
+		if (!silent)
+		{
+			if (firstSound < 0)
+				firstSound = t;
+			lastSound = t;
+		}
+		signature[t] = silent ? 0 : TickSignature(sumSq, sum, tickSamples);
+	}
+	free(buffer);
+	sndh.Unload();
+	if (t < tickCount)
+	{
+		free(signature);
+		return false;
+	}
+
+	const uint64_t tickMs = uint64_t(tickSamples) * 1000;
+	out.valid = true;
+	out.peakLevel = peak;
+	out.rmsLevel = int(sqrt(double(totalSq) / (double(tickCount) * tickSamples * channels)));
+	out.leadingSilenceMs = int(((firstSound < 0) ? tickCount : firstSound) * tickMs / m_replayRate);
+	out.trailingSilenceMs = int(((firstSound < 0) ? tickCount : tickCount - 1 - lastSound) * tickMs / m_replayRate);
+
+	int loopStart = -1;
+	int loopLength = 0;
+	if (firstSound >= 0)
+		DetectLoop(signature, tickCount, info.playerTickRate, loopStart, loopLength);
+	free(signature);
+	out.loopStartMs = (loopStart >= 0) ? int(loopStart * tickMs / m_replayRate) : -1;
+	out.loopLengthMs = int(loopLength * tickMs / m_replayRate);
+
+	// without TIME tag: music ends where it starts again, or where the final silence starts
+	if (tagged)
+		out.durationInMs = lenInSec * 1000;
+	else if (loopStart >= 0)
+		out.durationInMs = out.loopStartMs + out.loopLengthMs;
+	else if ((lastSound >= 0) && (out.trailingSilenceMs >= 2000))
+		out.durationInMs = int((lastSound + 1) * tickMs / m_replayRate);
+	else
+		out.durationInMs = 0;
+
+	m_ready[subSongId - 1].store(true, std::memory_order_release);
+	m_doneCount++;
+	return true;
+}
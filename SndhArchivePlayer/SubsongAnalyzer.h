@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include "../AtariAudio/AtariAudio.h"
+#include "jobSystem.h"
+#include "SndhWorkerPool.h"
+
+// Headless render of every subsong of a file, one emulator per job worker, to know the real duration,
+// levels & silences of each subsong before it's played. Results are cached (keyed by content hash & emulation
+// version) and saved to a text file, so a file analyzed once, even in a previous session, doesn't need any render
+class SubsongAnalyzer
+{
+public:
+	struct Result
+	{
+		bool	valid;				// false if the subsong couldn't be loaded or initialized (other fields are unknown)
+		int		durationInMs;		// TIME tag if any, else end of music detected (silence or loop), 0 if unknown
+		int		loopStartMs;		// -1 if no loop detected
+		int		loopLengthMs;
+		int		peakLevel;			// absolute sample peak (32768 is full scale)
+		int		rmsLevel;			// whole subsong RMS, same scale
+		int		leadingSilenceMs;
+		int		trailingSilenceMs;
+	};
+
+	SubsongAnalyzer();
+	~SubsongAnalyzer();
+
+	void	SetCacheFile(const char* sFilename);		// results are appended to this file, loaded at first Start
+	void	Start(const void* rawSndh, int size, uint32_t replayRate, int durationByDefaultInSec);		// raw data is copied
+	void	Stop();
+	bool	Update();				// call every frame, returns true while analysis is running
+
+	int		GetSubsongCount() const { return m_subsongCount; }
+	int		GetDoneCount() const { return m_doneCount; }
+	bool	GetResult(int subSongId, Result& out) const;		// false if this subsong isn't analyzed yet
+
+private:
+	static const int kResultFields = 8;				// per subsong, in the cache file
+	static const int kSilenceRange = 64;			// a tick with a smaller sample range is silent (DC offset ignored)
+
+	struct CacheItem
+	{
+		uint64_t	hash;
+		uint32_t	replayRate;
+		int			durationByDefaultInSec;
+		int			subsongCount;
+		Result*		results;
+	};
+
+	static bool	sJobAnalyze(void* user, int itemId, int workerId);
+	bool	Analyze(int subSongId, int workerId);
+	static void	DetectLoop(const uint8_t* signature, int tickCount, int tickRate, int& loopStart, int& loopLength);
+	static uint8_t	TickSignature(uint64_t sumSq, int64_t sum, int count);
+	void	StoreInCache();
+	CacheItem&	AddCacheItem();
+	void	LoadCacheFile();
+	void	AppendCacheFile(const CacheItem& item) const;
+	static void	SetFailed(Result& out);
+
+	void*		m_raw;
+	int			m_rawSize;
+	uint64_t	m_hash;
+	uint32_t	m_replayRate;
+	int			m_durationByDefaultInSec;
+	int			m_subsongCount;
+	Result		m_results[kSubsongCountMax];
+	std::atomic<bool>	m_ready[kSubsongCountMax];		// result is published by a release store
+	std::atomic<int>	m_doneCount;
+	std::atomic<bool>	m_cancel;
+	bool		m_running;
+
+	JobSystem	m_jobs;
+	SndhWorkerPool	m_sndhPool;
+
+	CacheItem*	m_cache;
+	int			m_cacheSize;
+	int			m_cacheCapacity;
+	char*		m_sCacheFile;
+	bool		m_cacheFileLoaded;
+};
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+#include "TrackPrefetcher.h"
+#include "AsyncSndhStream.h"
+#include "ZipView.h"
+
+TrackPrefetcher::TrackPrefetcher()
+{
+	m_zipView = NULL;
+	m_replayRate = 0;
+	for (int i = 0; i < kCacheSize; i++)
+	{
+		Slot& slot = m_slots[i];
+		slot.zipIndex = -1;
+		slot.state = kFree;
+		slot.loadOk = false;
+		slot.prepared = false;
+		slot.lastUse = 0;
+		memset(&slot.track, 0, sizeof(slot.track));
+	}
+	m_jobCount = 0;
+	m_useClock = 0;
+	m_requestCount = 0;
+}
+
+TrackPrefetcher::~TrackPrefetcher()
+{
+	Close();
+	for (int i = 0; i < kCacheSize; i++)
+		delete m_slots[i].track.sndh;
+}
+
+void	TrackPrefetcher::Open(const ZipView* zipView, uint32_t replayRate)
+{
+	Close();
+	m_zipView = zipView;
+	m_replayRate = replayRate;
+}
+
+void	TrackPrefetcher::Close()
+{
+	if (m_jobCount > 0)
+		JoinJobs();
+	for (int i = 0; i < kCacheSize; i++)
+		FreeSlot(m_slots[i]);
+	m_zipView = NULL;
+	m_requestCount = 0;
+}
+
+void	TrackPrefetcher::ReleaseTrack(Track& track)
+{
+	free(track.audio);
+	free(track.viewInfo);
+	track.audio = NULL;
+	track.viewInfo = NULL;
+	track.frameCount = 0;
+}
+
+// SndhFile object is kept for the next track (its Atari RAM is allocated once)
+void	TrackPrefetcher::FreeSlot(Slot& slot)
+{
+	ReleaseTrack(slot.track);
+	if (slot.track.sndh)
+		slot.track.sndh->Unload();
+	slot.state = kFree;
+	slot.zipIndex = -1;
+}
+
+int	TrackPrefetcher::FindSlot(int zipIndex) const
+{
+	for (int i = 0; i < kCacheSize; i++)
+	{
+		if ((m_slots[i].state != kFree) && (m_slots[i].zipIndex == zipIndex))
+			return i;
+	}
+	return -1;
+}
+
+bool	TrackPrefetcher::IsRequested(int zipIndex) const
+{
+	for (int i = 0; i < m_requestCount; i++)
+	{
+		if (m_request[i] == zipIndex)
+			return true;
+	}
+	return false;
+}
+
+void	TrackPrefetcher::Request(const int* zipIndices, int count)
+{
+	if (count > kCacheSize)
+		count = kCacheSize;
+	if ((count == m_requestCount) && (0 == memcmp(zipIndices, m_request, count * sizeof(int))))
+		return;
+
+	memcpy(m_request, zipIndices, count * sizeof(int));
+	m_requestCount = count;
+
+	// most likely track is the most recently used
+	for (int i = count - 1; i >= 0; i--)
+	{
+		const int s = FindSlot(zipIndices[i]);
+		if (s >= 0)
+			m_slots[s].lastUse = ++m_useClock;
+	}
+}
+
+void	TrackPrefetcher::Update()
+{
+	if (m_jobCount > 0)
+	{
+		if (m_jobs.Running())
+			return;
+		JoinJobs();
+	}
+	StartJobs();
+}
+
+void	TrackPrefetcher::StartJobs()
+{
+	if (NULL == m_zipView)
+		return;
+
+	for (int r = 0; r < m_requestCount; r++)
+	{
+		const int zipIndex = m_request[r];
+		if (FindSlot(zipIndex) >= 0)
+			continue;
+
+		// free slot, or least recently used ready track not requested anymore
+		int s = -1;
+		for (int i = 0; i < kCacheSize; i++)
+		{
+			const Slot& slot = m_slots[i];
+			if (kFree == slot.state)
+			{
+				s = i;
+				break;
+			}
+			if ((kReady == slot.state) && (!IsRequested(slot.zipIndex)) && ((s < 0) || (slot.lastUse < m_slots[s].lastUse)))
+				s = i;
+		}
+		if (s < 0)
+			break;
+
+		Slot& slot = m_slots[s];
+		FreeSlot(slot);
+		slot.zipIndex = zipIndex;
+		slot.state = kLoading;
+		slot.loadOk = false;
+		slot.prepared = false;
+		slot.lastUse = ++m_useClock;
+		m_jobSlots[m_jobCount++] = s;
+	}
+
+	if (m_jobCount > 0)
+		m_jobs.RunJobs(this, m_jobCount, sJobPrepare, NULL, JobSystem::GetHardwareWorkerCount());
+}
+
+void	TrackPrefetcher::JoinJobs()
+{
+	m_jobs.Join();
+	for (int i = 0; i < m_jobCount; i++)
+	{
+		// slot may already be taken
+		Slot& slot = m_slots[m_jobSlots[i]];
+		if (kLoading == slot.state)
+			slot.state = kReady;
+	}
+	m_jobCount = 0;
+}
+
+bool	TrackPrefetcher::Take(int zipIndex, Track& out)
+{
+	const int s = FindSlot(zipIndex);
+	if (s < 0)
+		return false;
+
+	// still being prepared: UI thread doesn't wait, caller loads the entry the usual way (driver init on the
+	// stream worker). Job goes on, and its track stays in the cache for next time
+	Slot& slot = m_slots[s];
+	if ((kLoading == slot.state) && (!slot.prepared.load(std::memory_order_acquire)))
+		return false;
+	if (!slot.loadOk)
+		return false;
+
+	out = slot.track;
+	slot.track.sndh = NULL;
+	slot.track.audio = NULL;
+	slot.track.viewInfo = NULL;
+	FreeSlot(slot);
+	return true;
+}
+
+bool	TrackPrefetcher::sJobPrepare(void* user, int itemId, int /*workerId*/)
+{
+	TrackPrefetcher* _this = (TrackPrefetcher*)user;
+	Slot& slot = _this->m_slots[_this->m_jobSlots[itemId]];
+	const bool ok = _this->Prepare(slot);
+	slot.loadOk = ok;
+	slot.prepared.store(true, std::memory_order_release);
+	return ok;
+}
+
+bool	TrackPrefetcher::Prepare(Slot& slot)
+{
+	bool ret = false;
+	int size;
+	void* unpack = m_zipView->ExtractAlloc(slot.zipIndex, size);
+	if (unpack)
+	{
+		Track& track = slot.track;
+		if (NULL == track.sndh)
+			track.sndh = new SndhFile;
+
+		// not borrowed: file goes to a shared image, so the inflated buffer can be released
+		SndhFile::SubSongInfo info;
+		if ((track.sndh->Load(unpack, size, m_replayRate)) &&
+			(track.sndh->GetSubsongInfo(track.sndh->GetDefaultSubsong(), info)) &&
+			(AsyncSndhStream::InitSubsong(*track.sndh, track.sndh->GetDefaultSubsong())))
+		{
+			const uint32_t frameCount = ((m_replayRate * kPrerenderMs) / 1000) & ~(AsyncSndhStream::kViewInfoDecimation - 1);
+			track.subSongId = track.sndh->GetDefaultSubsong();
+			track.audio = (int16_t*)malloc(frameCount * track.sndh->GetChannelCount() * sizeof(int16_t));
+			track.viewInfo = (uint32_t*)malloc((frameCount / AsyncSndhStream::kViewInfoDecimation) * sizeof(uint32_t));
+			track.sndh->AudioRender(track.audio, int(frameCount), track.viewInfo);
+			track.frameCount = frameCount;
+			ret = true;
+		}
+	}
+	free(unpack);
+	return ret;
+}
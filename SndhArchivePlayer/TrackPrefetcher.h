@@ -0,0 +1,74 @@
+#pragma once
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include "../AtariAudio/AtariAudio.h"
+#include "jobSystem.h"
+
+class ZipView;
+
+// Prepare the archive entries the user will most likely play next, on the job system: entry is inflated and
+// loaded (ICE depacked), default subsong driver is initialized and the first few hundred ms are rendered.
+// Ready tracks are kept in a small LRU cache, so starting one of them doesn't need any emulation
+class TrackPrefetcher
+{
+public:
+	struct Track
+	{
+		SndhFile*	sndh;				// loaded, subsong initialized by AsyncSndhStream::InitSubsong
+		int			subSongId;
+		int16_t*	audio;				// first samples (interleaved if stereo)
+		uint32_t*	viewInfo;			// one entry every AsyncSndhStream::kViewInfoDecimation samples
+		uint32_t	frameCount;
+	};
+
+	TrackPrefetcher();
+	~TrackPrefetcher();
+
+	void	Open(const ZipView* zipView, uint32_t replayRate);
+	void	Close();										// waits for the running jobs
+	void	Request(const int* zipIndices, int count);		// most likely first. Cheap if nothing changed
+	void	Update();										// call every frame, starts the jobs of missing tracks
+	bool	Take(int zipIndex, Track& out);					// caller owns out.sndh, and calls ReleaseTrack once started
+	static void	ReleaseTrack(Track& track);
+
+	static const int kCacheSize = 6;
+
+private:
+	static const int kPrerenderMs = 300;
+
+	enum SlotState
+	{
+		kFree,
+		kLoading,			// owned by a job until it sets "prepared"
+		kReady,
+	};
+
+	struct Slot
+	{
+		int			zipIndex;
+		SlotState	state;
+		bool		loadOk;			// false: failed entry is kept, so it's not tried again and again
+		std::atomic<bool>	prepared;	// job is done with the slot, even if the other jobs are still running
+		uint32_t	lastUse;
+		Track		track;
+	};
+
+	static bool	sJobPrepare(void* user, int itemId, int workerId);
+	bool	Prepare(Slot& slot);
+	void	StartJobs();
+	void	JoinJobs();
+	int		FindSlot(int zipIndex) const;
+	bool	IsRequested(int zipIndex) const;
+	static void	FreeSlot(Slot& slot);
+
+	const ZipView*	m_zipView;
+	uint32_t		m_replayRate;
+	Slot			m_slots[kCacheSize];
+	int				m_jobSlots[kCacheSize];
+	int				m_jobCount;
+	JobSystem		m_jobs;
+	uint32_t		m_useClock;
+	int				m_request[kCacheSize];
+	int				m_requestCount;
+};
@@ -1,13 +1,57 @@
 #define	_CRT_SECURE_NO_WARNINGS
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdint.h>
 #include "WavWriter.h"
 
+static void*	alignedAlloc(size_t size, size_t align)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, align);
+#else
+	void* p = NULL;
+	if (0 != posix_memalign(&p, align, size))
+		return NULL;
+	return p;
+#endif
+}
+
+static void		alignedFree(void* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+static uint8_t*	put16(uint8_t* p, uint32_t v)
+{
+	p[0] = uint8_t(v);
+	p[1] = uint8_t(v >> 8);
+	return p + 2;
+}
+
+static uint8_t*	put32(uint8_t* p, uint32_t v)
+{
+	p = put16(p, v & 0xffff);
+	return put16(p, v >> 16);
+}
+
+static uint8_t*	put64(uint8_t* p, uint64_t v)
+{
+	p = put32(p, uint32_t(v));
+	return put32(p, uint32_t(v >> 32));
+}
+
 WavWriter::WavWriter()
 {
 	m_h = NULL;
+	m_blocks[0] = NULL;
+	m_blocks[1] = NULL;
+	m_ioThread = NULL;
 }
 
 WavWriter::~WavWriter()
@@ -16,17 +60,48 @@ WavWriter::~WavWriter()
 		Close();
 }
 
-bool	WavWriter::Open(const char* sFilename, int samplingRate, int channelCount /* = 2 */)
+bool	WavWriter::Open(const char* sFilename, int samplingRate, int channelCount /* = 2 */, Format format /* = kFormatPcm16 */)
 {
 	bool ret = false;
 	m_h = fopen(sFilename, "wb");
 	if (m_h)
 	{
-		WAVHeader dummy;
-		fwrite(&dummy, sizeof(WAVHeader), 1, m_h);
+		// blocks are big enough, no need of CRT buffering
+		setvbuf(m_h, NULL, _IONBF, 0);
+
 		m_samplingRate = samplingRate;
 		m_channelCount = channelCount;
+		m_format = format;
 		m_sampleCount = 0;
+		static const int sBytesPerSample[3] = { 2, 3, 4 };
+		m_frameSize = sBytesPerSample[format] * channelCount;
+
+		// header is written again with real sizes at Close
+		uint8_t header[kMaxHeaderSize];
+		const int headerSize = BuildHeader(header, 0);
+		fwrite(header, 1, headerSize, m_h);
+
+		m_blockCapacity = (kBlockSize / m_frameSize) * m_frameSize;
+		m_blocks[0] = (uint8_t*)alignedAlloc(kBlockSize, kBlockAlign);
+		m_blocks[1] = (uint8_t*)alignedAlloc(kBlockSize, kBlockAlign);
+		if ((NULL == m_blocks[0]) || (NULL == m_blocks[1]))
+		{
+			printf("ERROR: Out of memory writing file \"%s\"\n", sFilename);
+			alignedFree(m_blocks[0]);
+			alignedFree(m_blocks[1]);
+			m_blocks[0] = NULL;
+			m_blocks[1] = NULL;
+			fclose(m_h);
+			m_h = NULL;
+			return false;
+		}
+		m_blockFill = 0;
+		m_currentBlock = 0;
+		m_pendingBlock = NULL;
+		m_pendingSize = 0;
+		m_quit = false;
+		m_ioError = false;
+		m_ioThread = new std::thread(&WavWriter::IoThreadFunction, this);
 		ret = true;
 	}
 	else
@@ -36,38 +111,165 @@ bool	WavWriter::Open(const char* sFilename, int samplingRate, int channelCount /
 	return ret;
 }
 
+// Build header for the given data size. Always the same size for a given format: a JUNK chunk
+// reserves room for the RF64 "ds64" chunk
+int		WavWriter::BuildHeader(uint8_t* header, uint64_t dataSize) const
+{
+	const bool isFloat = (kFormatFloat32 == m_format);
+	const uint32_t fmtSize = isFloat ? 18 : 16;
+	const int headerSize = 12 + (8 + 28) + (8 + fmtSize) + (isFloat ? 12 : 0) + 8;
+	assert(headerSize <= kMaxHeaderSize);
+	const uint64_t riffSize = headerSize - 8 + dataSize + (dataSize & 1);
+	const bool rf64 = (riffSize > 0xffffffff);
+
+	uint8_t* p = header;
+	p = put32(p, rf64 ? ID_RF64 : ID_RIFF);
+	p = put32(p, rf64 ? 0xffffffff : uint32_t(riffSize));
+	p = put32(p, ID_WAVE);
+
+	p = put32(p, rf64 ? ID_DS64 : ID_JUNK);
+	p = put32(p, 28);
+	p = put64(p, rf64 ? riffSize : 0);
+	p = put64(p, rf64 ? dataSize : 0);
+	p = put64(p, rf64 ? m_sampleCount : 0);
+	p = put32(p, 0);			// no table
+
+	const uint32_t bytesPerSample = m_frameSize / m_channelCount;
+	p = put32(p, ID_FMT);
+	p = put32(p, fmtSize);
+	p = put16(p, isFloat ? 3 : 1);		// WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+	p = put16(p, m_channelCount);
+	p = put32(p, m_samplingRate);
+	p = put32(p, m_samplingRate * m_frameSize);
+	p = put16(p, m_frameSize);
+	p = put16(p, bytesPerSample * 8);
+	if (isFloat)
+	{
+		p = put16(p, 0);
+		p = put32(p, ID_FACT);
+		p = put32(p, 4);
+		p = put32(p, (m_sampleCount > 0xffffffff) ? 0xffffffff : uint32_t(m_sampleCount));
+	}
+
+	p = put32(p, ID_DATA);
+	p = put32(p, rf64 ? 0xffffffff : uint32_t(dataSize));
+	assert(p - header == headerSize);
+	return headerSize;
+}
+
 void	WavWriter::AddAudioData(const int16_t* data, int sampleCount)
 {
 	if (m_h)
 	{
-		const int rawSize = sizeof(int16_t) * sampleCount * m_channelCount;
-		fwrite(data, sizeof(int16_t)*m_channelCount, sampleCount, m_h);
 		m_sampleCount += sampleCount;
+		while (sampleCount > 0)
+		{
+			int count = (m_blockCapacity - m_blockFill) / m_frameSize;
+			if (count > sampleCount)
+				count = sampleCount;
+			const int valueCount = count * m_channelCount;
+			uint8_t* w = m_blocks[m_currentBlock] + m_blockFill;
+			switch (m_format)
+			{
+			case kFormatPcm16:
+				for (int i = 0; i < valueCount; i++)
+					w = put16(w, uint16_t(data[i]));
+				break;
+			case kFormatPcm24:
+				for (int i = 0; i < valueCount; i++)
+				{
+					*w++ = 0;
+					w = put16(w, uint16_t(data[i]));
+				}
+				break;
+			case kFormatFloat32:
+				for (int i = 0; i < valueCount; i++)
+				{
+					const float f = float(data[i]) * (1.0f / 32768.0f);
+					uint32_t v;
+					memcpy(&v, &f, sizeof(v));
+					w = put32(w, v);
+				}
+				break;
+			}
+			m_blockFill += count * m_frameSize;
+			data += valueCount;
+			sampleCount -= count;
+			if (m_blockFill == m_blockCapacity)
+				SubmitBlock();
+		}
 	}
 }
 
-void	WavWriter::Close()
+// hand the current block to the I/O thread (wait if it's still writing the previous one), then fill the other one
+void	WavWriter::SubmitBlock()
 {
+	if (m_blockFill > 0)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this] { return NULL == m_pendingBlock; });
+		m_pendingBlock = m_blocks[m_currentBlock];
+		m_pendingSize = m_blockFill;
+		m_cond.notify_all();
+		m_currentBlock ^= 1;
+		m_blockFill = 0;
+	}
+}
+
+void	WavWriter::IoThreadFunction()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_cond.wait(lock, [this] { return (m_pendingBlock != NULL) || (m_quit); });
+		if (NULL == m_pendingBlock)
+			break;
+
+		const uint8_t* block = m_pendingBlock;
+		const int size = m_pendingSize;
+		lock.unlock();
+		const bool ok = (size_t(size) == fwrite(block, 1, size, m_h));
+		lock.lock();
+		if (!ok)
+			m_ioError = true;
+		m_pendingBlock = NULL;
+		m_cond.notify_all();
+	}
+}
+
+bool	WavWriter::Close()
+{
+	bool ret = false;
 	if (m_h)
 	{
+		SubmitBlock();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+			m_cond.notify_all();
+		}
+		m_ioThread->join();
+		delete m_ioThread;
+		m_ioThread = NULL;
+
+		const uint64_t dataSize = m_sampleCount * m_frameSize;
+		if (dataSize & 1)
+			fputc(0, m_h);			// RIFF chunks are word aligned
+
+		uint8_t header[kMaxHeaderSize];
+		const int headerSize = BuildHeader(header, dataSize);
 		fseek(m_h, 0, SEEK_SET);
-		WAVHeader head;
-		head.RIFFMagic = ID_RIFF;
-		head.FileType = ID_WAVE;
-		head.FormMagic = ID_FMT;
-		head.DataMagic = ID_DATA;
-		head.FormLength = 0x10;
-		head.SampleFormat = 1;
-		head.NumChannels = (unsigned short)m_channelCount;
-		head.PlayRate = m_samplingRate;
-		head.BitsPerSample = 16;
-		head.Stride = (head.BitsPerSample / 8) * head.NumChannels;
-		head.BytesPerSec = head.PlayRate * head.Stride;
-		head.DataLength = m_sampleCount * head.Stride;
-		head.FileLength = head.DataLength + sizeof(WAVHeader) - 8;
-		fwrite(&head, 1, sizeof(WAVHeader), m_h);
-		fseek(m_h, 0, SEEK_END);
-		fclose(m_h);
+		if (size_t(headerSize) != fwrite(header, 1, headerSize, m_h))
+			m_ioError = true;
+		if (0 != fclose(m_h))
+			m_ioError = true;
 		m_h = NULL;
+
+		alignedFree(m_blocks[0]);
+		alignedFree(m_blocks[1]);
+		m_blocks[0] = NULL;
+		m_blocks[1] = NULL;
+		ret = !m_ioError;
 	}
+	return ret;
 }
@@ -1,46 +1,66 @@
 #pragma once
 
+#include <stdio.h>
 #include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #define ID_RIFF 0x46464952
+#define ID_RF64 0x34364652
 #define ID_WAVE 0x45564157
+#define ID_JUNK 0x4b4e554a
+#define ID_DS64 0x34367364
 #define ID_FMT  0x20746D66
+#define ID_FACT 0x74636166
 #define ID_DATA 0x61746164
 
+// WAV file writer. Audio data is converted in large blocks, written to disk by an I/O thread
+// (so caller can keep rendering). File switches to RF64 at Close if data doesn't fit in 4GiB
 class WavWriter
 {
 public:
 
+	enum Format
+	{
+		kFormatPcm16,
+		kFormatPcm24,
+		kFormatFloat32,
+	};
+
 	WavWriter();
 	~WavWriter();
 
-	bool	Open(const char* sFilename, int samplingRate, int channelCount = 2);
-	void	AddAudioData(const int16_t* data, int sampleCount);
-	void	Close();
+	bool	Open(const char* sFilename, int samplingRate, int channelCount = 2, Format format = kFormatPcm16);
+	void	AddAudioData(const int16_t* data, int sampleCount);		// sampleCount frames, interleaved if stereo. Could be called while rendering
+	bool	Close();												// false if any disk write failed
 
 private:
+	static const int kBlockSize = 1 << 20;
+	static const int kBlockAlign = 4096;
+	static const int kMaxHeaderSize = 96;
+
+	void	IoThreadFunction();
+	void	SubmitBlock();
+	int		BuildHeader(uint8_t* header, uint64_t dataSize) const;
+
 	FILE*	m_h;
-	int		m_sampleCount;
+	uint64_t	m_sampleCount;
 	int		m_channelCount;
 	int		m_samplingRate;
+	Format	m_format;
+	int		m_frameSize;
 
-	struct WAVHeader
-	{
-		unsigned int RIFFMagic;
-		unsigned int FileLength;
-		unsigned int FileType;
-		unsigned int FormMagic;
-		unsigned int FormLength;
-		unsigned short	SampleFormat;
-		unsigned short NumChannels;
-		unsigned int PlayRate;
-		unsigned int BytesPerSec;
-		unsigned short Stride;
-		unsigned short BitsPerSample;
-		unsigned int DataMagic;
-		unsigned int DataLength;
-	};
-
+	// double buffering: caller fills one block while the I/O thread writes the other one
+	uint8_t*	m_blocks[2];
+	int		m_blockCapacity;		// whole frames only
+	int		m_blockFill;
+	int		m_currentBlock;
+	const uint8_t*	m_pendingBlock;
+	int		m_pendingSize;
+	bool	m_quit;
+	bool	m_ioError;
+	std::thread*	m_ioThread;
+	std::mutex	m_mutex;
+	std::condition_variable	m_cond;
 };
-
-
@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ZipView.h"
+
+// miniz is compiled in zip.c, only its declarations are needed here. Raw deflate decoder state lives on
+// the caller stack, so each extracting thread has its own one, without any allocation
+#define	MINIZ_HEADER_FILE_ONLY
+#define	MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "extern/zip/src/miniz.h"
+
+static const uint32_t kSigLocalHeader = 0x04034b50;
+static const uint32_t kSigCentralHeader = 0x02014b50;
+static const uint32_t kSigEndOfCentralDir = 0x06054b50;
+static const uint32_t kSigZip64EndOfCentralDir = 0x06064b50;
+static const uint32_t kSigZip64Locator = 0x07064b50;
+static const int kLocalHeaderSize = 30;
+static const int kCentralHeaderSize = 46;
+static const int kEndOfCentralDirSize = 22;
+static const uint32_t kDosDirectoryAttribute = 0x10;
+
+static inline uint16_t	read16(const uint8_t* p) { return uint16_t(p[0] | (p[1] << 8)); }
+static inline uint32_t	read32(const uint8_t* p) { return uint32_t(read16(p)) | (uint32_t(read16(p + 2)) << 16); }
+static inline uint64_t	read64(const uint8_t* p) { return uint64_t(read32(p)) | (uint64_t(read32(p + 4)) << 32); }
+
+ZipView::ZipView()
+{
+	m_entries = NULL;
+	m_entryCount = 0;
+}
+
+ZipView::~ZipView()
+{
+	Close();
+}
+
+bool	ZipView::Open(const char* sFilename)
+{
+	Close();
+	if (!m_file.Open(sFilename))
+		return false;
+	if (!ParseCentralDirectory())
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void	ZipView::Close()
+{
+	free(m_entries);
+	m_entries = NULL;
+	m_entryCount = 0;
+	m_file.Close();
+}
+
+bool	ZipView::ParseCentralDirectory()
+{
+	const uint8_t* data = (const uint8_t*)m_file.GetData();
+	const uint64_t fileSize = m_file.GetSize();
+	if (fileSize < uint64_t(kEndOfCentralDirSize))
+		return false;
+
+	// end of central directory record is followed by a comment of up to 64KiB
+	int64_t eocd = -1;
+	const int64_t scanEnd = (fileSize > 0xffff + kEndOfCentralDirSize) ? int64_t(fileSize) - (0xffff + kEndOfCentralDirSize) : 0;
+	for (int64_t pos = int64_t(fileSize) - kEndOfCentralDirSize; pos >= scanEnd; pos--)
+	{
+		if (kSigEndOfCentralDir == read32(data + pos))
+		{
+			eocd = pos;
+			break;
+		}
+	}
+	if (eocd < 0)
+		return false;
+
+	uint64_t entryCount = read16(data + eocd + 10);
+	uint64_t cdSize = read32(data + eocd + 12);
+	uint64_t cdOffset = read32(data + eocd + 16);
+	if ((0xffff == entryCount) || (0xffffffff == cdSize) || (0xffffffff == cdOffset))
+	{
+		// zip64: locator just before the classic record gives the zip64 end of central directory
+		if ((eocd < 20) || (kSigZip64Locator != read32(data + eocd - 20)))
+			return false;
+		const uint64_t zip64Eocd = read64(data + eocd - 20 + 8);
+		if ((zip64Eocd + 56 > fileSize) || (kSigZip64EndOfCentralDir != read32(data + zip64Eocd)))
+			return false;
+		entryCount = read64(data + zip64Eocd + 32);
+		cdSize = read64(data + zip64Eocd + 40);
+		cdOffset = read64(data + zip64Eocd + 48);
+	}
+	if ((cdOffset + cdSize > fileSize) || (entryCount > cdSize / kCentralHeaderSize))
+		return false;
+
+	m_entries = (Entry*)malloc(size_t(entryCount ? entryCount : 1) * sizeof(Entry));
+	if (NULL == m_entries)
+		return false;
+
+	const uint8_t* r = data + cdOffset;
+	const uint8_t* cdEnd = r + cdSize;
+	for (uint64_t i = 0; i < entryCount; i++)
+	{
+		if ((r + kCentralHeaderSize > cdEnd) || (kSigCentralHeader != read32(r)))
+			return false;
+		const uint16_t nameLen = read16(r + 28);
+		const uint16_t extraLen = read16(r + 30);
+		const uint16_t commentLen = read16(r + 32);
+		if (r + kCentralHeaderSize + nameLen + extraLen + commentLen > cdEnd)
+			return false;
+
+		uint64_t size = read32(r + 24);
+		uint64_t compressedSize = read32(r + 20);
+		uint64_t localHeaderOffset = read32(r + 42);
+
+		// zip64 extended information: only the saturated fields are present, in this order
+		const uint8_t* extra = r + kCentralHeaderSize + nameLen;
+		const uint8_t* extraEnd = extra + extraLen;
+		while (extra + 4 <= extraEnd)
+		{
+			const uint16_t id = read16(extra);
+			const uint16_t len = read16(extra + 2);
+			const uint8_t* field = extra + 4;
+			const uint8_t* fieldEnd = field + len;
+			if (fieldEnd > extraEnd)
+				break;
+			if (0x0001 == id)
+			{
+				if ((0xffffffff == size) && (field + 8 <= fieldEnd))
+				{
+					size = read64(field);
+					field += 8;
+				}
+				if ((0xffffffff == compressedSize) && (field + 8 <= fieldEnd))
+				{
+					compressedSize = read64(field);
+					field += 8;
+				}
+				if ((0xffffffff == localHeaderOffset) && (field + 8 <= fieldEnd))
+					localHeaderOffset = read64(field);
+				break;
+			}
+			extra = fieldEnd;
+		}
+
+		// a SNDH entry is a few hundred KiB at most, larger entries are kept but never extracted
+		Entry& e = m_entries[i];
+		e.localHeaderOffset = localHeaderOffset;
+		e.compressedSize = (compressedSize > 0xffffffff) ? 0xffffffff : uint32_t(compressedSize);
+		e.size = (size > 0x7fffffff) ? kInvalidSize : uint32_t(size);
+		e.nameOffset = uint32_t(r + kCentralHeaderSize - data);
+		e.crc = read32(r + 16);
+		e.nameLen = nameLen;
+		const uint16_t method = read16(r + 10);
+		e.method = (method <= 0xff) ? uint8_t(method) : 0xff;
+		e.isDirectory = ((nameLen > 0) && ('/' == r[kCentralHeaderSize + nameLen - 1])) || (read32(r + 38) & kDosDirectoryAttribute);
+		r += kCentralHeaderSize + nameLen + extraLen + commentLen;
+	}
+	m_entryCount = int(entryCount);
+	return true;
+}
+
+void	ZipView::GetEntryName(int index, char* sName, int nameSize) const
+{
+	const Entry& e = m_entries[index];
+	const int len = (e.nameLen < nameSize - 1) ? e.nameLen : nameSize - 1;
+	memcpy(sName, (const uint8_t*)m_file.GetData() + e.nameOffset, len);
+	sName[len] = 0;
+}
+
+bool	ZipView::Extract(int index, void* dst) const
+{
+	const Entry& e = m_entries[index];
+	if (kInvalidSize == e.size)
+		return false;
+
+	const uint8_t* data = (const uint8_t*)m_file.GetData();
+	const uint64_t fileSize = m_file.GetSize();
+	if ((e.localHeaderOffset + kLocalHeaderSize > fileSize) || (kSigLocalHeader != read32(data + e.localHeaderOffset)))
+		return false;
+
+	// local header name & extra field could differ from the central directory ones
+	const uint8_t* local = data + e.localHeaderOffset;
+	const uint64_t dataOffset = e.localHeaderOffset + kLocalHeaderSize + read16(local + 26) + read16(local + 28);
+	if (dataOffset + e.compressedSize > fileSize)
+		return false;
+
+	const uint8_t* src = data + dataOffset;
+	switch (e.method)
+	{
+	case 0:
+		if (e.compressedSize != e.size)
+			return false;
+		memcpy(dst, src, e.size);
+		break;
+	case 8:
+	{
+		const size_t out = tinfl_decompress_mem_to_mem(dst, e.size, src, e.compressedSize, 0);
+		if ((TINFL_DECOMPRESS_MEM_TO_MEM_FAILED == out) || (out != e.size))
+			return false;
+		break;
+	}
+	default:
+		return false;
+	}
+	return (uint32_t(mz_crc32(MZ_CRC32_INIT, (const mz_uint8*)dst, e.size)) == e.crc);
+}
+
+void*	ZipView::ExtractAlloc(int index, int& size) const
+{
+	size = 0;
+	const Entry& e = m_entries[index];
+	if (kInvalidSize == e.size)
+		return NULL;
+
+	// a trailing zero so text parsers can't run past the end of the entry
+	uint8_t* p = (uint8_t*)malloc(e.size + 1);
+	if ((NULL == p) || (!Extract(index, p)))
+	{
+		free(p);
+		return NULL;
+	}
+	p[e.size] = 0;
+	size = int(e.size);
+	return p;
+}
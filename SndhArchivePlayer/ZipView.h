@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "MappedFile.h"
+
+// Read only zip archive view: the file is memory mapped once, and its central directory is parsed once
+// into a compact entry array. Entries are inflated straight from the mapped bytes, so any number of
+// threads can extract at the same time without any per-thread file handle
+class ZipView
+{
+public:
+	struct Entry
+	{
+		uint64_t	localHeaderOffset;
+		uint32_t	compressedSize;
+		uint32_t	size;
+		uint32_t	nameOffset;			// name bytes in the mapped central directory (not zero terminated)
+		uint32_t	crc;
+		uint16_t	nameLen;
+		uint8_t		method;				// 0: stored, 8: deflated (anything else is not supported)
+		bool		isDirectory;
+	};
+	static const uint32_t kInvalidSize = 0xffffffff;		// entry too large to be extracted in memory
+
+	ZipView();
+	~ZipView();
+
+	bool	Open(const char* sFilename);
+	void	Close();
+	bool	IsOpen() const { return m_entries != NULL; }
+
+	int				GetEntryCount() const { return m_entryCount; }
+	const Entry&	GetEntry(int index) const { return m_entries[index]; }		// index is the zip central directory order
+	void			GetEntryName(int index, char* sName, int nameSize) const;
+	bool			Extract(int index, void* dst) const;		// dst receives GetEntry(index).size bytes. Thread safe
+	void*			ExtractAlloc(int index, int& size) const;	// malloc'ed entry plus a zero byte (caller frees), NULL on failure. Thread safe
+
+private:
+	bool	ParseCentralDirectory();
+
+	MappedFile	m_file;
+	Entry*		m_entries;
+	int			m_entryCount;
+};
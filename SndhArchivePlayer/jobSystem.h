@@ -1,7 +1,9 @@
 #pragma once
+#include <thread>
 #include <atomic>
 
 static const int	kMaxWorkers = 64;
+static const int	kMaxEmulationWorkers = 16;		// jobs running an Atari emulation each need a whole Atari RAM (see SndhWorkerPool)
 
 class JobSystem
 {